@@ -5,8 +5,24 @@
 #include "Utils.h"
 #include "Picture.h"
 #include "PicProcess.h"
+#include "BlurKernel.h"
 
 void blur_function(void (*blur_func) (struct picture *picture));
+void blur_function_runs(void (*blur_func) (struct picture *picture), int runs);
+
+// length of the long chain of blurs, and how many times it is timed
+#define BLUR_CHAIN_LENGTH 200
+#define BLUR_CHAIN_RUNS 5
+
+  void blur_chain_one_by_one(struct picture *pic){
+    for (int i = 0; i < BLUR_CHAIN_LENGTH; i++) {
+      blur_picture(pic);
+    }
+  }
+
+  void blur_chain_fused(struct picture *pic){
+    blur_picture_n(pic, BLUR_CHAIN_LENGTH);
+  }
 
 // ---------- MAIN PROGRAM ---------- \\
 
@@ -15,6 +31,7 @@ void blur_function(void (*blur_func) (struct picture *picture));
     /* Outputs the average run time from 100 iterations of each blur implementation. */
 
     printf("Support Code for Running the Blur Optimisation Experiments... \n");
+    printf("Using the %s 3x3 blur kernel\n", blur_kernel_name());
 
     printf("Sequential blur took on average:\n");
     blur_function(&blur_picture);
@@ -31,21 +48,35 @@ void blur_function(void (*blur_func) (struct picture *picture));
     printf("Blur picture by quarter took on average:\n");
     blur_function(&blur_picture_by_quarter);
 
+    printf("Blur picture by cache-sized tiles took on average:\n");
+    blur_function(&blur_picture_tiled);
+
+    printf("Chain of %i blurs one at a time took on average:\n", BLUR_CHAIN_LENGTH);
+    blur_function_runs(&blur_chain_one_by_one, BLUR_CHAIN_RUNS);
+
+    printf("Chain of %i blurs fused into tiles took on average:\n", BLUR_CHAIN_LENGTH);
+    blur_function_runs(&blur_chain_fused, BLUR_CHAIN_RUNS);
+
 }
 
   void blur_function(void (*blur_func) (struct picture *pic)) 
+  {
+    blur_function_runs(blur_func, 100);
+  }
+
+  void blur_function_runs(void (*blur_func) (struct picture *pic), int runs)
   {
     long long sumTimes = 0;
     struct picture pic;
     struct timeval start, stop;
-    /* Loops 100 times recording how long it takes to run the blur function. */
-    for (int i = 0; i < 100; i++) {
-        init_picture_from_file(&pic, "test_images/charles.jpg");
+    /* Loops runs times recording how long it takes to run the blur function. */
+    for (int i = 0; i < runs; i++) {
+        init_picture_from_file(&pic, "test_images/charles.jpg", 1);
         gettimeofday(&start, NULL);
         blur_func(&pic);
         gettimeofday(&stop, NULL);
         sumTimes += (stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_usec - start.tv_usec) / 1000;
     }
-    sumTimes /= 100;
+    sumTimes /= runs;
     printf("%llu milliseconds\n", sumTimes);
   }
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "BlurKernel.h"
+#include "CpuFeatures.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BLUR_X86
+#include <immintrin.h>
+#endif
+
+// distance in bytes between horizontally neighbouring pixels
+#define PIXEL_STEP 3
+
+// x / 9 == (x * BLUR_RECIPROCAL) >> 16 for every 3x3 sum x of 8-bit values (x <= 2295)
+#define BLUR_RECIPROCAL 7282
+
+typedef void (*blur_row_fn)(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                            unsigned char *dst, int begin, int end);
+
+static inline int region_sum(const unsigned char *above, const unsigned char *row,
+                             const unsigned char *below, int k){
+  return above[k - PIXEL_STEP] + above[k] + above[k + PIXEL_STEP]
+       + row[k - PIXEL_STEP] + row[k] + row[k + PIXEL_STEP]
+       + below[k - PIXEL_STEP] + below[k] + below[k + PIXEL_STEP];
+}
+
+static void blur_row_scalar(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                            unsigned char *dst, int begin, int end){
+  for(int k = begin; k < end; k++){
+    dst[k] = (region_sum(above, row, below, k) * BLUR_RECIPROCAL) >> 16;
+  }
+}
+
+#ifdef BLUR_X86
+
+// 16-bit sums of the three vertically aligned 16-byte vectors starting at offset k
+__attribute__((target("sse2")))
+static inline void column_sums_sse2(const unsigned char *above, const unsigned char *row,
+                                    const unsigned char *below, int k, __m128i *lo, __m128i *hi){
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = _mm_loadu_si128((const __m128i *) (above + k));
+  __m128i r = _mm_loadu_si128((const __m128i *) (row + k));
+  __m128i b = _mm_loadu_si128((const __m128i *) (below + k));
+  *lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(r, zero)),
+                      _mm_unpacklo_epi8(b, zero));
+  *hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(r, zero)),
+                      _mm_unpackhi_epi8(b, zero));
+}
+
+__attribute__((target("sse2")))
+static void blur_row_sse2(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                          unsigned char *dst, int begin, int end){
+  const __m128i reciprocal = _mm_set1_epi16(BLUR_RECIPROCAL);
+  int k = begin;
+  for(; k + 16 <= end; k += 16){
+    __m128i left_lo, left_hi, mid_lo, mid_hi, right_lo, right_hi;
+    column_sums_sse2(above, row, below, k - PIXEL_STEP, &left_lo, &left_hi);
+    column_sums_sse2(above, row, below, k, &mid_lo, &mid_hi);
+    column_sums_sse2(above, row, below, k + PIXEL_STEP, &right_lo, &right_hi);
+    __m128i sum_lo = _mm_add_epi16(_mm_add_epi16(left_lo, mid_lo), right_lo);
+    __m128i sum_hi = _mm_add_epi16(_mm_add_epi16(left_hi, mid_hi), right_hi);
+    __m128i avg = _mm_packus_epi16(_mm_mulhi_epu16(sum_lo, reciprocal), _mm_mulhi_epu16(sum_hi, reciprocal));
+    _mm_storeu_si128((__m128i *) (dst + k), avg);
+  }
+  blur_row_scalar(above, row, below, dst, k, end);
+}
+
+__attribute__((target("avx2")))
+static inline void column_sums_avx2(const unsigned char *above, const unsigned char *row,
+                                    const unsigned char *below, int k, __m256i *lo, __m256i *hi){
+  __m256i zero = _mm256_setzero_si256();
+  __m256i a = _mm256_loadu_si256((const __m256i *) (above + k));
+  __m256i r = _mm256_loadu_si256((const __m256i *) (row + k));
+  __m256i b = _mm256_loadu_si256((const __m256i *) (below + k));
+  *lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(r, zero)),
+                         _mm256_unpacklo_epi8(b, zero));
+  *hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(r, zero)),
+                         _mm256_unpackhi_epi8(b, zero));
+}
+
+// the unpacks and the pack both work within 128-bit lanes, so bytes come back out in order
+__attribute__((target("avx2")))
+static void blur_row_avx2(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                          unsigned char *dst, int begin, int end){
+  const __m256i reciprocal = _mm256_set1_epi16(BLUR_RECIPROCAL);
+  int k = begin;
+  for(; k + 32 <= end; k += 32){
+    __m256i left_lo, left_hi, mid_lo, mid_hi, right_lo, right_hi;
+    column_sums_avx2(above, row, below, k - PIXEL_STEP, &left_lo, &left_hi);
+    column_sums_avx2(above, row, below, k, &mid_lo, &mid_hi);
+    column_sums_avx2(above, row, below, k + PIXEL_STEP, &right_lo, &right_hi);
+    __m256i sum_lo = _mm256_add_epi16(_mm256_add_epi16(left_lo, mid_lo), right_lo);
+    __m256i sum_hi = _mm256_add_epi16(_mm256_add_epi16(left_hi, mid_hi), right_hi);
+    __m256i avg = _mm256_packus_epi16(_mm256_mulhi_epu16(sum_lo, reciprocal),
+                                      _mm256_mulhi_epu16(sum_hi, reciprocal));
+    _mm256_storeu_si256((__m256i *) (dst + k), avg);
+  }
+  blur_row_sse2(above, row, below, dst, k, end);
+}
+
+#endif
+
+// implementations from fastest to slowest
+static const struct {
+  const char *name;
+  blur_row_fn fn;
+} kernels[] = {
+#ifdef BLUR_X86
+  {"avx2", blur_row_avx2},
+  {"sse2", blur_row_sse2},
+#endif
+  {"scalar", blur_row_scalar}
+};
+
+static int no_of_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static int kernel_index;
+
+static bool kernel_supported(int index){
+#ifdef BLUR_X86
+  if(kernels[index].fn == blur_row_avx2){
+    return cpu_has_avx2();
+  }
+  if(kernels[index].fn == blur_row_sse2){
+    return cpu_has_sse2();
+  }
+#endif
+  return true;
+}
+
+static void select_kernel(void){
+  kernel_index = 0;
+  while(!kernel_supported(kernel_index)){
+    kernel_index++;
+  }
+}
+
+void blur_row(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+              unsigned char *dst, int begin, int end){
+  pthread_once(&kernel_once, select_kernel);
+  kernels[kernel_index].fn(above, row, below, dst, begin, end);
+}
+
+const char *blur_kernel_name(void){
+  pthread_once(&kernel_once, select_kernel);
+  return kernels[kernel_index].name;
+}
+
+bool use_blur_kernel(const char *name){
+  pthread_once(&kernel_once, select_kernel);
+  for(int i = 0; i < no_of_kernels; i++){
+    if(strcmp(kernels[i].name, name) == 0 && kernel_supported(i)){
+      kernel_index = i;
+      return true;
+    }
+  }
+  return false;
+}
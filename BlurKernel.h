@@ -0,0 +1,21 @@
+#ifndef BLURKERNEL_H
+#define BLURKERNEL_H
+
+#include <stdbool.h>
+
+  // Set bytes [begin, end) of dst to the average of the 3x3 region of pixels
+  // around each byte, given the three interleaved source rows centred on it.
+  // begin must be at least one pixel into the row, and end at least one pixel
+  // before its end. The implementation (AVX2, SSE2 or scalar) is chosen on
+  // first use from the CPU features reported by cpuid.
+  void blur_row(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                unsigned char *dst, int begin, int end);
+
+  // name of the implementation used by blur_row
+  const char *blur_kernel_name(void);
+
+  // make blur_row use the named implementation ("avx2", "sse2" or "scalar")
+  // instead, returning false if this CPU does not support it
+  bool use_blur_kernel(const char *name);
+
+#endif
@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "BufferPool.h"
+
+/* Size of the smallest class; smaller requests are rounded up to it. */
+#define MIN_CLASS_SIZE 4096
+
+/* Number of size classes between consecutive powers of two. */
+#define CLASSES_PER_DOUBLING 4
+
+/* Enough classes for any size up to 2^63 bytes. */
+#define NO_SIZE_CLASSES (64 * CLASSES_PER_DOUBLING)
+
+/* Bookkeeping kept in the cache line before each buffer. */
+struct buffer_header
+{
+    int size_class;
+    struct buffer_header *next;     /* Next idle buffer of the same class. */
+};
+
+_Static_assert(sizeof(struct buffer_header) <= BUFFER_ALIGNMENT, "buffer header must fit before the buffer");
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct buffer_header *idle[NO_SIZE_CLASSES];
+static size_t idle_bytes = 0;
+static size_t pool_limit = DEFAULT_BUFFER_POOL_LIMIT;
+
+/* Smallest class holding size bytes, where class 4e + k has size 2^e * (4 + k) / 4 bytes. */
+static int size_class_of(size_t size)
+{
+    if (size <= MIN_CLASS_SIZE)
+        size = MIN_CLASS_SIZE;
+    int e = 63 - __builtin_clzll(size);
+    size_t step = ((size_t) 1 << e) / CLASSES_PER_DOUBLING;
+    int k = (size - ((size_t) 1 << e) + step - 1) / step;
+    return e * CLASSES_PER_DOUBLING + k;
+}
+
+static size_t class_size(int size_class)
+{
+    int e = size_class / CLASSES_PER_DOUBLING;
+    int k = size_class % CLASSES_PER_DOUBLING;
+    return ((size_t) 1 << e) / CLASSES_PER_DOUBLING * (CLASSES_PER_DOUBLING + k);
+}
+
+static void *buffer_of(struct buffer_header *header)
+{
+    return (char *) header + BUFFER_ALIGNMENT;
+}
+
+static struct buffer_header *header_of(void *buffer)
+{
+    return (struct buffer_header *) ((char *) buffer - BUFFER_ALIGNMENT);
+}
+
+/* Frees idle buffers, largest first, until they fit in limit. Requires the pool lock. */
+static void shrink_to(size_t limit)
+{
+    for (int c = NO_SIZE_CLASSES - 1; c >= 0 && idle_bytes > limit; c--) {
+        while (idle[c] != NULL && idle_bytes > limit) {
+            struct buffer_header *header = idle[c];
+            idle[c] = header->next;
+            idle_bytes -= class_size(c);
+            free(header);
+        }
+    }
+}
+
+void *acquire_buffer(size_t size)
+{
+    if (size > SIZE_MAX / 2)
+        return NULL;
+    int size_class = size_class_of(size);
+
+    pthread_mutex_lock(&pool_lock);
+    struct buffer_header *header = idle[size_class];
+    if (header != NULL) {
+        idle[size_class] = header->next;
+        idle_bytes -= class_size(size_class);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (header == NULL) {
+        header = aligned_alloc(BUFFER_ALIGNMENT, BUFFER_ALIGNMENT + class_size(size_class));
+        if (header == NULL)
+            return NULL;
+        header->size_class = size_class;
+    }
+    return buffer_of(header);
+}
+
+void release_buffer(void *buffer)
+{
+    if (buffer == NULL)
+        return;
+    struct buffer_header *header = header_of(buffer);
+    size_t size = class_size(header->size_class);
+
+    pthread_mutex_lock(&pool_lock);
+    bool keep = idle_bytes + size <= pool_limit;
+    if (keep) {
+        header->next = idle[header->size_class];
+        idle[header->size_class] = header;
+        idle_bytes += size;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!keep)
+        free(header);
+}
+
+void set_buffer_pool_limit(size_t limit)
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_limit = limit;
+    shrink_to(limit);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void trim_buffer_pool(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    shrink_to(0);
+    pthread_mutex_unlock(&pool_lock);
+}
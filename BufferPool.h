@@ -0,0 +1,28 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <stddef.h>
+
+/* Alignment of every buffer handed out by the pool, a whole cache line. */
+#define BUFFER_ALIGNMENT 64
+
+/* Default cap on the total size of the idle buffers kept by the pool for reuse. */
+#define DEFAULT_BUFFER_POOL_LIMIT ((size_t) 256 << 20)
+
+/* Returns an uninitialised buffer of at least size bytes, aligned to BUFFER_ALIGNMENT. Buffers are
+ * rounded up to one of a set of size classes, four per power of two, and a buffer of the same class
+ * released earlier is reused if there is one, saving the page faults of fresh memory. Returns NULL if
+ * no memory is available. Safe to call from any thread. */
+void *acquire_buffer(size_t size);
+
+/* Returns a buffer obtained from acquire_buffer to the pool, which frees it instead if keeping it would
+ * take the idle buffers over the pool's limit. Does nothing for NULL. */
+void release_buffer(void *buffer);
+
+/* Sets the cap on the total size of idle buffers kept by the pool, freeing idle buffers down to it. */
+void set_buffer_pool_limit(size_t limit);
+
+/* Frees every idle buffer kept by the pool. */
+void trim_buffer_pool(void);
+
+#endif
@@ -20,8 +20,8 @@
     struct picture pic1;
     struct picture pic2;
     
-    init_picture_from_file(&pic1, pic1_filename);
-    init_picture_from_file(&pic2, pic2_filename);
+    init_picture_from_file(&pic1, pic1_filename, 1);
+    init_picture_from_file(&pic2, pic2_filename, 1);
     
     int width = pic1.width;
     int height = pic1.height;
@@ -32,8 +32,8 @@
     }
   
     // iterate over the picture pixel-by-pixel and compare RGB values
-    for(int i = 0; i < width; i++){
-      for(int j = 0; j < height; j++){
+    for(int j = 0; j < height; j++){
+      for(int i = 0; i < width; i++){
         struct pixel pixel1 = get_pixel(&pic1, i, j);
         struct pixel pixel2 = get_pixel(&pic2, i, j);
         
@@ -0,0 +1,53 @@
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+bool cpu_has_sse2(void){
+  unsigned int eax, ebx, ecx, edx;
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)){
+    return false;
+  }
+  return (edx & bit_SSE2) != 0;
+}
+
+bool cpu_has_ssse3(void){
+  unsigned int eax, ebx, ecx, edx;
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)){
+    return false;
+  }
+  return (ecx & bit_SSSE3) != 0;
+}
+
+// AVX2 needs both the instructions and the OS saving the YMM registers (XCR0 bits 1 and 2)
+bool cpu_has_avx2(void){
+  unsigned int eax, ebx, ecx, edx;
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)){
+    return false;
+  }
+  unsigned int xcr0_lo, xcr0_hi;
+  __asm__ volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+  if((xcr0_lo & 6) != 6){
+    return false;
+  }
+  if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)){
+    return false;
+  }
+  return (ebx & bit_AVX2) != 0;
+}
+
+#else
+
+bool cpu_has_sse2(void){
+  return false;
+}
+
+bool cpu_has_ssse3(void){
+  return false;
+}
+
+bool cpu_has_avx2(void){
+  return false;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#include <stdbool.h>
+
+  // Whether the CPU (and, for AVX2, the OS) supports each instruction set
+  // extension used by the SIMD kernels, as reported by cpuid. All of them
+  // are false on machines other than x86.
+  bool cpu_has_sse2(void);
+  bool cpu_has_ssse3(void);
+  bool cpu_has_avx2(void);
+
+#endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The image reader is compiled into the benchmark itself, rather than linked
+   from sod.o, so that its static decoding kernels can be called directly. */
+#define STB_IMAGE_IMPLEMENTATION
+#include "sod_img_reader.h"
+
+/* Benchmark of the JPEG decoder's IDCT, upsampling and colour conversion kernels. */
+
+#define DEFAULT_JPEG "test_images/charles.jpg"
+#define REPEATS 3
+#define ROW_PIXELS 4096
+#define BLOCKS 4096
+#define ROUNDS 64
+
+/* One set of the kernels selected by stbi__setup_jpeg. */
+struct kernel_set {
+    const char *name;
+    int available;
+    void (*idct)(stbi_uc *out, int out_stride, short data[64]);
+    void (*ycc)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
+    stbi_uc *(*hv_2)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+};
+
+static struct kernel_set kernel_sets[] = {
+    {"scalar", 1, stbi__idct_block, stbi__YCbCr_to_RGB_row, stbi__resample_row_hv_2},
+#ifdef STBI_SSE2
+    {"sse2", 0, stbi__idct_simd, stbi__YCbCr_to_RGB_simd, stbi__resample_row_hv_2_simd},
+#endif
+#ifdef STBI_AVX2
+    {"avx2", 0, stbi__idct_avx2, stbi__YCbCr_to_RGB_avx2, stbi__resample_row_hv_2_avx2},
+#endif
+};
+
+#define NO_KERNEL_SETS ((int) (sizeof(kernel_sets) / sizeof(kernel_sets[0])))
+
+/* Inputs and outputs shared by the kernel runs. */
+STBI_SIMD_ALIGN(static short, coeffs[BLOCKS][64]);
+static stbi_uc plane[BLOCKS / 64 * 8][64 * 8];
+static stbi_uc y_row[ROW_PIXELS], cb_row[ROW_PIXELS], cr_row[ROW_PIXELS];
+static stbi_uc rgb_row[ROW_PIXELS * 4];
+static stbi_uc wide_row[ROW_PIXELS * 2];
+
+static struct kernel_set *current;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random coefficients shaped like dequantised JPEG blocks: a large DC term
+   and AC terms shrinking with frequency, many of them zero. */
+static void fill_inputs(void) {
+    srand(1);
+    for (int b = 0; b < BLOCKS; b++) {
+        for (int k = 1; k < 64; k++) {
+            int f = k % 8 + k / 8;
+            coeffs[b][k] = rand() % 4 == 0 ? (short) ((rand() % 513 - 256) / f) : 0;
+        }
+        coeffs[b][0] = (short) (rand() % 2049 - 1024);
+    }
+    for (int i = 0; i < ROW_PIXELS; i++) {
+        y_row[i] = (stbi_uc) rand();
+        cb_row[i] = (stbi_uc) rand();
+        cr_row[i] = (stbi_uc) rand();
+    }
+}
+
+/* Each run writes ROUNDS times over the kernel's output and returns its size in bytes. */
+static size_t run_idct(void) {
+    for (int r = 0; r < ROUNDS; r++)
+        for (int b = 0; b < BLOCKS; b++)
+            current->idct(&plane[b / 64 * 8][b % 64 * 8], sizeof(plane[0]), coeffs[b]);
+    return (size_t) ROUNDS * BLOCKS * 64;
+}
+
+static size_t run_hv_2(void) {
+    for (int r = 0; r < ROUNDS * 16; r++)
+        current->hv_2(wide_row, cb_row, cr_row, ROW_PIXELS, 2);
+    return (size_t) ROUNDS * 16 * ROW_PIXELS * 2;
+}
+
+static size_t run_ycc_3(void) {
+    for (int r = 0; r < ROUNDS * 16; r++)
+        current->ycc(rgb_row, y_row, cb_row, cr_row, ROW_PIXELS, 3);
+    return (size_t) ROUNDS * 16 * ROW_PIXELS * 3;
+}
+
+static size_t run_ycc_4(void) {
+    for (int r = 0; r < ROUNDS * 16; r++)
+        current->ycc(rgb_row, y_row, cb_row, cr_row, ROW_PIXELS, 4);
+    return (size_t) ROUNDS * 16 * ROW_PIXELS * 4;
+}
+
+/* Runs the kernel REPEATS times and returns the best throughput in MB/s. */
+static double measure(size_t (*run)(void)) {
+    double best = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        double start = now();
+        size_t bytes = run();
+        double rate = bytes / (now() - start) / 1e6;
+        if (rate > best)
+            best = rate;
+    }
+    return best;
+}
+
+/* Compares every kernel of a set with the scalar one on the benchmark inputs
+   and on the row widths around the vector loops' boundaries. */
+static int matches_scalar(struct kernel_set *set) {
+    static stbi_uc expected[ROW_PIXELS * 4], actual[ROW_PIXELS * 4];
+    struct kernel_set *scalar = &kernel_sets[0];
+    for (int b = 0; b < BLOCKS; b++) {
+        scalar->idct(expected, 8, coeffs[b]);
+        set->idct(actual, 8, coeffs[b]);
+        if (memcmp(expected, actual, 64) != 0)
+            return 0;
+    }
+    for (int w = 1; w <= 80; w++) {
+        int count = ROW_PIXELS - w;
+        memset(actual, 0, sizeof(actual));
+        scalar->hv_2(expected, cb_row + w, cr_row + w, w, 2);
+        set->hv_2(actual, cb_row + w, cr_row + w, w, 2);
+        if (memcmp(expected, actual, w * 2) != 0)
+            return 0;
+        for (int step = 3; step <= 4; step++) {
+            scalar->ycc(expected, y_row + w, cb_row + w, cr_row + w, count, step);
+            set->ycc(actual, y_row + w, cb_row + w, cr_row + w, count, step);
+            if (memcmp(expected, actual, (size_t) count * step) != 0)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Decodes a whole JPEG with the given kernel set, as stbi__jpeg_load would. */
+static stbi_uc *decode_with(struct kernel_set *set, stbi_uc *file, int len, int *width, int *height) {
+    stbi__context s;
+    stbi__jpeg j;
+    int comp;
+    stbi__start_mem(&s, file, len);
+    j.s = &s;
+    stbi__setup_jpeg(&j);
+    j.idct_block_kernel = set->idct;
+    j.YCbCr_to_RGB_kernel = set->ycc;
+    j.resample_row_hv_2_kernel = set->hv_2;
+    return load_jpeg_image(&j, width, height, &comp, 3);
+}
+
+static stbi_uc *read_file(const char *path, int *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = (int) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    stbi_uc *buf = malloc(*len);
+    if (buf != NULL && fread(buf, 1, *len, f) != (size_t) *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+// ---------- MAIN PROGRAM ---------- \\
+
+  int main(int argc, char **argv){
+
+    /* Usage: ./decode_bench [jpeg file] */
+    const char *path = argc > 1 ? argv[1] : DEFAULT_JPEG;
+
+#ifdef STBI_SSE2
+    kernel_sets[1].available = stbi__sse2_available();
+#endif
+#ifdef STBI_AVX2
+    kernel_sets[NO_KERNEL_SETS - 1].available = stbi__avx2_available();
+#endif
+
+    fill_inputs();
+    int exit_code = 0;
+
+    printf("Kernel throughput in MB/s of decoded output:\n");
+    printf("  %-8s %10s %10s %10s %10s   %s\n", "", "idct", "hv_2", "ycc rgb", "ycc rgbx", "vs scalar");
+    for (int k = 0; k < NO_KERNEL_SETS; k++) {
+        current = &kernel_sets[k];
+        if (!current->available) {
+            printf("  %-8s not supported by this CPU\n", current->name);
+            continue;
+        }
+        int same = matches_scalar(current);
+        if (!same)
+            exit_code = 1;
+        printf("  %-8s %10.1f %10.1f %10.1f %10.1f   %s\n", current->name,
+               measure(run_idct), measure(run_hv_2), measure(run_ycc_3), measure(run_ycc_4),
+               same ? "bit-identical" : "MISMATCH");
+    }
+
+    int len;
+    stbi_uc *file = read_file(path, &len);
+    if (file == NULL) {
+        printf("[!] unable to read %s\n", path);
+        return 1;
+    }
+
+    printf("Whole decode of %s in MB/s of RGB output:\n", path);
+    stbi_uc *reference = NULL;
+    for (int k = 0; k < NO_KERNEL_SETS; k++) {
+        if (!kernel_sets[k].available)
+            continue;
+        double best = 0;
+        int width = 0, height = 0;
+        stbi_uc *pixels = NULL;
+        for (int r = 0; r < REPEATS; r++) {
+            STBI_FREE(pixels);
+            double start = now();
+            pixels = decode_with(&kernel_sets[k], file, len, &width, &height);
+            double seconds = now() - start;
+            if (pixels == NULL) {
+                printf("[!] unable to decode %s: %s\n", path, stbi_failure_reason());
+                free(file);
+                return 1;
+            }
+            if (width * 3.0 * height / seconds / 1e6 > best)
+                best = width * 3.0 * height / seconds / 1e6;
+        }
+        int same = reference == NULL || memcmp(reference, pixels, (size_t) width * height * 3) == 0;
+        if (!same)
+            exit_code = 1;
+        printf("  %-8s %10.1f   %s\n", kernel_sets[k].name, best, same ? "bit-identical" : "MISMATCH");
+        if (reference == NULL)
+            reference = pixels;
+        else
+            STBI_FREE(pixels);
+    }
+    STBI_FREE(reference);
+    free(file);
+    return exit_code;
+  }
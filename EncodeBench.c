@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The image reader and writer are compiled into the benchmark itself, rather
+   than linked from sod.o, so that the writer's static encoding kernels can be
+   called directly. */
+#define STB_IMAGE_IMPLEMENTATION
+#include "sod_img_reader.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "sod_img_writer.h"
+
+/* Benchmark of the JPEG encoder's DCT/quantization and colour conversion kernels. */
+
+#define DEFAULT_JPEG "test_images/charles.jpg"
+#define QUALITY 90
+#define REPEATS 3
+#define ROW_PIXELS 4096
+#define BLOCKS 4096
+#define ROUNDS 64
+
+/* One set of the kernels selected by stbiw__jpg_setup_kernels. */
+struct kernel_set {
+    const char *name;
+    int available;
+    void (*quantize)(float *CDU, const float *fdtbl, int *DU);
+    void (*ycbcr)(const unsigned char *row, int width, int padded_width, int comp, float *Y, float *U, float *V);
+};
+
+static struct kernel_set kernel_sets[] = {
+    {"scalar", 1, stbiw__jpg_quantizeDU, stbiw__jpg_rgb_to_ycbcr_row},
+#ifdef STBIW_SSE2
+    {"sse2", 1, stbiw__jpg_quantizeDU_sse2, stbiw__jpg_rgb_to_ycbcr_row_sse2},
+#endif
+#ifdef STBIW_AVX2
+    {"avx2", 0, stbiw__jpg_quantizeDU_avx2, stbiw__jpg_rgb_to_ycbcr_row_avx2},
+#endif
+};
+
+#define NO_KERNEL_SETS ((int) (sizeof(kernel_sets) / sizeof(kernel_sets[0])))
+
+/* Inputs and outputs shared by the kernel runs. */
+static float samples[BLOCKS][64];
+static float work[64];
+static int coeffs[64];
+static unsigned char rgb_row[ROW_PIXELS * 4];
+static float y_row[ROW_PIXELS], u_row[ROW_PIXELS], v_row[ROW_PIXELS];
+static unsigned char y_table[64], uv_table[64];
+static float fdtbl_y[64], fdtbl_uv[64];
+
+static struct kernel_set *current;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Level shifted samples of smooth blocks with some noise, and random pixels. */
+static void fill_inputs(void) {
+    srand(1);
+    for (int b = 0; b < BLOCKS; b++) {
+        int base = rand() % 256, dx = rand() % 17 - 8, dy = rand() % 17 - 8;
+        for (int k = 0; k < 64; k++) {
+            int v = base + dx * (k % 8) + dy * (k / 8) + rand() % 9 - 4;
+            samples[b][k] = (v < 0 ? 0 : v > 255 ? 255 : v) - 128.0f;
+        }
+    }
+    for (int i = 0; i < ROW_PIXELS * 4; i++)
+        rgb_row[i] = (unsigned char) rand();
+    stbiw__jpg_setupTables(QUALITY, y_table, uv_table, fdtbl_y, fdtbl_uv);
+}
+
+/* Each run returns the number of 8-bit samples or pixel bytes it went through. */
+static size_t run_quantize(void) {
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int b = 0; b < BLOCKS; b++) {
+            memcpy(work, samples[b], sizeof(work));
+            current->quantize(work, fdtbl_y, coeffs);
+        }
+    }
+    return (size_t) ROUNDS * BLOCKS * 64;
+}
+
+static size_t run_ycbcr(void) {
+    for (int r = 0; r < ROUNDS * 4; r++)
+        current->ycbcr(rgb_row, ROW_PIXELS, ROW_PIXELS, 3, y_row, u_row, v_row);
+    return (size_t) ROUNDS * 4 * ROW_PIXELS * 3;
+}
+
+/* Runs the kernel REPEATS times and returns the best throughput in MB/s. */
+static double measure(size_t (*run)(void)) {
+    double best = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        double start = now();
+        size_t bytes = run();
+        double rate = bytes / (now() - start) / 1e6;
+        if (rate > best)
+            best = rate;
+    }
+    return best;
+}
+
+/* Compares the kernels of a set with the scalar ones on the benchmark blocks
+   and on every pixel layout, for the row widths around the vector loops'
+   boundaries. */
+static int matches_scalar(struct kernel_set *set) {
+    static float expected[3][ROW_PIXELS + 8], actual[3][ROW_PIXELS + 8];
+    struct kernel_set *scalar = &kernel_sets[0];
+    for (int b = 0; b < BLOCKS; b++) {
+        float block[64];
+        int expected_du[64], actual_du[64];
+        memcpy(block, samples[b], sizeof(block));
+        scalar->quantize(block, fdtbl_uv, expected_du);
+        memcpy(block, samples[b], sizeof(block));
+        set->quantize(block, fdtbl_uv, actual_du);
+        if (memcmp(expected_du, actual_du, sizeof(expected_du)) != 0)
+            return 0;
+    }
+    for (int comp = 1; comp <= 4; comp++) {
+        for (int width = 1; width <= 48; width++) {
+            int padded_width = (width + 7) & ~7;
+            scalar->ycbcr(rgb_row + width, width, padded_width, comp, expected[0], expected[1], expected[2]);
+            set->ycbcr(rgb_row + width, width, padded_width, comp, actual[0], actual[1], actual[2]);
+            for (int c = 0; c < 3; c++)
+                if (memcmp(expected[c], actual[c], padded_width * sizeof(float)) != 0)
+                    return 0;
+        }
+    }
+    return 1;
+}
+
+/* Entropy-coded data written by the encoder, kept for comparison. */
+struct output {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static void write_output(void *context, void *data, int size) {
+    struct output *out = context;
+    if (out->size + size > out->capacity) {
+        out->capacity = 2 * (out->size + size);
+        out->data = realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+/* Encodes the scan of a whole image with the given kernel set and MCU size
+   (16 for 4:2:0 chroma), as stbi_write_jpg_core does without restart intervals. */
+static void encode_with(struct kernel_set *set, stbi_uc *pixels, int width, int height, int mcu_size,
+                        struct output *out) {
+    stbi__write_context s;
+    stbiw__jpg_image image;
+    image.data = pixels;
+    image.width = width;
+    image.height = height;
+    image.comp = 3;
+    image.stride = width * 3;
+    image.fdtbl_Y = fdtbl_y;
+    image.fdtbl_UV = fdtbl_uv;
+    image.mcu_size = mcu_size;
+    image.flip = 0;
+    image.quantize_kernel = set->quantize;
+    image.ycbcr_kernel = set->ycbcr;
+    out->size = 0;
+    stbi__start_write_callbacks(&s, write_output, out);
+    stbiw__jpg_encodeRows(&s, &image, 0, height);
+}
+
+// ---------- MAIN PROGRAM ---------- \\
+
+  int main(int argc, char **argv){
+
+    /* Usage: ./encode_bench [image file] */
+    const char *path = argc > 1 ? argv[1] : DEFAULT_JPEG;
+
+#ifdef STBIW_AVX2
+    kernel_sets[NO_KERNEL_SETS - 1].available = stbiw__avx2_available();
+#endif
+
+    fill_inputs();
+    int exit_code = 0;
+
+    printf("Kernel throughput in MB/s of 8-bit input:\n");
+    printf("  %-8s %10s %10s   %s\n", "", "dct+quant", "ycbcr", "vs scalar");
+    for (int k = 0; k < NO_KERNEL_SETS; k++) {
+        current = &kernel_sets[k];
+        if (!current->available) {
+            printf("  %-8s not supported by this CPU\n", current->name);
+            continue;
+        }
+        int same = matches_scalar(current);
+        if (!same)
+            exit_code = 1;
+        printf("  %-8s %10.1f %10.1f   %s\n", current->name,
+               measure(run_quantize), measure(run_ycbcr), same ? "bit-identical" : "MISMATCH");
+    }
+
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load(path, &width, &height, &channels, 3);
+    if (pixels == NULL) {
+        printf("[!] unable to load %s: %s\n", path, stbi_failure_reason());
+        return 1;
+    }
+
+    printf("Whole encode of %s (%i x %i, quality %i) in MB/s of RGB input:\n", path, width, height, QUALITY);
+    printf("  %-8s %10s %10s   %s\n", "", "4:4:4", "4:2:0", "vs scalar");
+    struct output reference[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    struct output out = {NULL, 0, 0};
+    for (int k = 0; k < NO_KERNEL_SETS; k++) {
+        if (!kernel_sets[k].available)
+            continue;
+        double best[2] = {0, 0};
+        int same = 1;
+        for (int m = 0; m < 2; m++) {
+            struct output *dest = reference[m].size == 0 ? &reference[m] : &out;
+            for (int r = 0; r < REPEATS; r++) {
+                double start = now();
+                encode_with(&kernel_sets[k], pixels, width, height, 8 << m, dest);
+                double rate = width * 3.0 * height / (now() - start) / 1e6;
+                if (rate > best[m])
+                    best[m] = rate;
+            }
+            if (dest == &out)
+                same &= out.size == reference[m].size && memcmp(out.data, reference[m].data, out.size) == 0;
+        }
+        if (!same)
+            exit_code = 1;
+        printf("  %-8s %10.1f %10.1f   %s\n", kernel_sets[k].name, best[0], best[1],
+               same ? "bit-identical" : "MISMATCH");
+    }
+    printf("Scan size: %zu bytes at 4:4:4, %zu bytes at 4:2:0\n", reference[0].size, reference[1].size);
+    free(reference[0].data);
+    free(reference[1].data);
+    free(out.data);
+    stbi_image_free(pixels);
+    return exit_code;
+  }
@@ -0,0 +1,121 @@
+#include "JpegTransform.h"
+#include "sod_img_reader.h"
+#include "sod_img_writer.h"
+#include <stdlib.h>
+
+/* Coefficients in an 8x8 DCT block, and the edge length of a block in pixels. */
+#define BLOCK_COEFFS 64
+#define BLOCK_SIZE 8
+
+/* Where each coefficient of a remapped block comes from: block[k] = sign[k] * source_block[source[k]].
+ * Transposing a block transposes its coefficients, and mirroring it negates the coefficients of odd
+ * frequency along the mirrored axis. */
+struct block_remap {
+    int source[BLOCK_COEFFS];
+    short sign[BLOCK_COEFFS];
+};
+
+static void init_block_remap(struct block_remap *remap, enum orientation o) {
+    for (int ky = 0; ky < BLOCK_SIZE; ky++) {
+        for (int kx = 0; kx < BLOCK_SIZE; kx++) {
+            // frequencies of the source coefficient along the stored x and y axes
+            int u = o & ORIENT_TRANSPOSE ? ky : kx;
+            int v = o & ORIENT_TRANSPOSE ? kx : ky;
+            bool negate = ((o & ORIENT_MIRROR_X) && (u & 1)) != ((o & ORIENT_MIRROR_Y) && (v & 1));
+
+            remap->source[ky * BLOCK_SIZE + kx] = v * BLOCK_SIZE + u;
+            remap->sign[ky * BLOCK_SIZE + kx] = negate ? -1 : 1;
+        }
+    }
+}
+
+/* Checks that every mirrored edge of the picture falls on a whole MCU, so that the partial blocks
+ * padding the right and bottom edges stay at the right and bottom once remapped. */
+static bool mirrors_whole_mcus(const stbi_jpeg_coefficients *c, enum orientation o) {
+    int mcu_w = 0, mcu_h = 0;
+    for (int i = 0; i < c->comp; i++) {
+        if (c->component[i].h * BLOCK_SIZE > mcu_w) mcu_w = c->component[i].h * BLOCK_SIZE;
+        if (c->component[i].v * BLOCK_SIZE > mcu_h) mcu_h = c->component[i].v * BLOCK_SIZE;
+    }
+    if ((o & ORIENT_MIRROR_X) && c->x % mcu_w != 0) return false;
+    if ((o & ORIENT_MIRROR_Y) && c->y % mcu_h != 0) return false;
+    return true;
+}
+
+/* Builds the blocks of one remapped component, by the same mapping of positions as the pixels of a
+ * picture with that orientation, applied to the grid of blocks and within each block. The component's
+ * quantization table is transposed along with its coefficients, into quant. */
+static short *remap_component(const stbi_jpeg_coefficients *c, int i, enum orientation o,
+                              const struct block_remap *remap, stbi_write_jpg_component *out,
+                              unsigned short quant[BLOCK_COEFFS]) {
+    int src_w = c->component[i].blocks_w;
+    int src_h = c->component[i].blocks_h;
+    int out_w = o & ORIENT_TRANSPOSE ? src_h : src_w;
+    int out_h = o & ORIENT_TRANSPOSE ? src_w : src_h;
+
+    short *coeff = malloc((size_t) out_w * out_h * BLOCK_COEFFS * sizeof(short));
+    if (coeff == NULL) {
+        return NULL;
+    }
+
+    for (int by = 0; by < out_h; by++) {
+        for (int bx = 0; bx < out_w; bx++) {
+            int u = o & ORIENT_TRANSPOSE ? by : bx;
+            int v = o & ORIENT_TRANSPOSE ? bx : by;
+            if (o & ORIENT_MIRROR_X) u = src_w - 1 - u;
+            if (o & ORIENT_MIRROR_Y) v = src_h - 1 - v;
+
+            const short *src = c->component[i].coeff + ((size_t) v * c->component[i].coeff_stride + u) * BLOCK_COEFFS;
+            short *dst = coeff + ((size_t) by * out_w + bx) * BLOCK_COEFFS;
+            for (int k = 0; k < BLOCK_COEFFS; k++) {
+                dst[k] = remap->sign[k] * src[remap->source[k]];
+            }
+        }
+    }
+
+    for (int k = 0; k < BLOCK_COEFFS; k++) {
+        quant[k] = c->component[i].quant[remap->source[k]];
+    }
+
+    out->id = c->component[i].id;
+    out->h = o & ORIENT_TRANSPOSE ? c->component[i].v : c->component[i].h;
+    out->v = o & ORIENT_TRANSPOSE ? c->component[i].h : c->component[i].v;
+    out->quant = quant;
+    out->coeff = coeff;
+    out->coeff_stride = out_w;
+    return coeff;
+}
+
+bool transform_jpeg_file(const char *src_path, const char *dst_path, enum orientation orientation) {
+    stbi_jpeg_coefficients c;
+    if (!stbi_jpeg_load_coefficients(src_path, &c)) {
+        return false;
+    }
+    if (!mirrors_whole_mcus(&c, orientation)) {
+        stbi_jpeg_free_coefficients(&c);
+        return false;
+    }
+
+    struct block_remap remap;
+    init_block_remap(&remap, orientation);
+
+    stbi_write_jpg_component out[3];
+    unsigned short quant[3][BLOCK_COEFFS];
+    short *coeff[3] = {NULL, NULL, NULL};
+    bool ok = true;
+    for (int i = 0; i < c.comp && ok; i++) {
+        coeff[i] = remap_component(&c, i, orientation, &remap, &out[i], quant[i]);
+        ok = coeff[i] != NULL;
+    }
+    stbi_jpeg_free_coefficients(&c);
+
+    if (ok) {
+        int width = orientation & ORIENT_TRANSPOSE ? c.y : c.x;
+        int height = orientation & ORIENT_TRANSPOSE ? c.x : c.y;
+        ok = stbi_write_jpg_coefficients(dst_path, width, height, c.comp, out);
+    }
+    for (int i = 0; i < c.comp; i++) {
+        free(coeff[i]);
+    }
+    return ok;
+}
@@ -0,0 +1,13 @@
+#ifndef JPEGTRANSFORM_H
+#define JPEGTRANSFORM_H
+
+#include "Picture.h"
+
+/* Writes the JPEG file at src_path to dst_path with the given orientation applied (as in struct
+ * picture), by rearranging its quantized DCT coefficients instead of decoding and re-encoding the
+ * pixels, so no quality is lost. Returns false without writing anything when src_path is not a grey
+ * or YCbCr JPEG, or when a mirrored edge of the picture does not fall on a whole MCU, in which case
+ * the caller has to go through the pixels instead. */
+bool transform_jpeg_file(const char *src_path, const char *dst_path, enum orientation orientation);
+
+#endif
@@ -0,0 +1,193 @@
+#include "Orientation.h"
+#include "RotateKernel.h"
+#include "Traversal.h"
+#include <string.h>
+
+/* Edge length in pixels of the tiles of a transposing remap: a source block and its transpose take
+ * 96KB together, in L2 cache. */
+#define TRANSPOSE_TILE_SIZE 128
+
+/* Size of a cache line, the step between prefetches. */
+#define CACHE_LINE_BYTES 64
+
+/* Bytes of a row moved at a time when swapping two rows. */
+#define SWAP_CHUNK 4096
+
+/* Stored and remapped pictures of a transposing remap, and the orientation it applies. */
+struct remap_context {
+    struct picture *src;
+    struct picture *dst;
+    enum orientation orientation;
+};
+
+int oriented_width(struct picture *pic) {
+    return pic->orientation & ORIENT_TRANSPOSE ? pic->height : pic->width;
+}
+
+int oriented_height(struct picture *pic) {
+    return pic->orientation & ORIENT_TRANSPOSE ? pic->width : pic->height;
+}
+
+/* Writes the orientation as the 2x2 signed permutation matrix that takes a position in the picture,
+ * measured from its centre, to the position where that pixel is stored. */
+static void orientation_matrix(enum orientation o, int m[2][2]) {
+    int sign_x = o & ORIENT_MIRROR_X ? -1 : 1;
+    int sign_y = o & ORIENT_MIRROR_Y ? -1 : 1;
+    int swap = o & ORIENT_TRANSPOSE ? 1 : 0;
+
+    m[0][0] = swap ? 0 : sign_x;
+    m[0][1] = swap ? sign_x : 0;
+    m[1][0] = swap ? sign_y : 0;
+    m[1][1] = swap ? 0 : sign_y;
+}
+
+enum orientation compose_orientation(enum orientation stored, enum orientation applied) {
+    int a[2][2], b[2][2], m[2][2];
+    orientation_matrix(stored, a);
+    orientation_matrix(applied, b);
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            m[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j];
+        }
+    }
+
+    // read the bits back off the product, which is again a signed permutation matrix
+    enum orientation o = ORIENT_IDENTITY;
+    if (m[0][0] == 0) o |= ORIENT_TRANSPOSE;
+    if (m[0][0] + m[0][1] < 0) o |= ORIENT_MIRROR_X;
+    if (m[1][0] + m[1][1] < 0) o |= ORIENT_MIRROR_Y;
+    return o;
+}
+
+void orient_picture(struct picture *pic, enum orientation applied) {
+    pic->orientation = compose_orientation(pic->orientation, applied);
+}
+
+/* Exchanges the contents of two rows of the given length in bytes. */
+static void swap_rows(unsigned char *a, unsigned char *b, int bytes) {
+    unsigned char tmp[SWAP_CHUNK];
+
+    for (int k = 0; k < bytes; k += SWAP_CHUNK) {
+        int n = bytes - k < SWAP_CHUNK ? bytes - k : SWAP_CHUNK;
+        memcpy(tmp, a + k, n);
+        memcpy(a + k, b + k, n);
+        memcpy(b + k, tmp, n);
+    }
+}
+
+/* Mirrors a band of rows in place: with MIRROR_Y each row is exchanged with its mirror row, end for
+ * end if MIRROR_X is also set; with MIRROR_X alone each row is reversed. */
+static void mirror_block(struct region *block, void *ctx) {
+    struct picture *pic = ctx;
+
+    for (int j = block->y_begin; j < block->y_end; j++) {
+        unsigned char *row = get_row(pic, j);
+        unsigned char *mirror = pic->orientation & ORIENT_MIRROR_Y ? get_row(pic, pic->height - 1 - j) : row;
+
+        if (pic->orientation & ORIENT_MIRROR_X) {
+            reverse_swap_pixels(row, mirror, pic->width);
+        } else {
+            swap_rows(row, mirror, pic->width * PIXEL_CHANNELS);
+        }
+    }
+}
+
+/* Asks for the given span of bytes in each of a run of rows to be brought into cache, for writing or
+ * just for reading. */
+static void prefetch_rows(const unsigned char *first_row, ptrdiff_t stride, int rows, int bytes, bool write) {
+    for (int r = 0; r < rows; r++) {
+        const unsigned char *row = first_row + r * stride;
+        for (int k = 0; k < bytes; k += CACHE_LINE_BYTES) {
+            if (write) {
+                __builtin_prefetch(row + k, 1);
+            } else {
+                __builtin_prefetch(row + k, 0);
+            }
+        }
+    }
+}
+
+/* First stored row and column of the source block of the given remapped tile: the tile's columns come
+ * from stored rows, counted from the bottom with MIRROR_Y, and its rows from stored columns, counted
+ * from the right with MIRROR_X. */
+static const unsigned char *source_block(struct remap_context *rc, struct region *tile) {
+    int row = rc->orientation & ORIENT_MIRROR_Y ? rc->src->height - tile->x_end : tile->x_begin;
+    int column = rc->orientation & ORIENT_MIRROR_X ? rc->src->width - tile->y_end : tile->y_begin;
+    return get_row(rc->src, row) + column * PIXEL_CHANNELS;
+}
+
+/* Starts loading the source block and destination tile of the next tile along the row of tiles, which
+ * a traversal in row-major tile order usually visits next, so that its cache misses overlap the
+ * transpose of this one instead of stalling it. */
+static void prefetch_next_tile(struct region *tile, struct remap_context *rc) {
+    struct region next = *tile;
+    next.x_begin = tile->x_end;
+    next.x_end = tile->x_end + (tile->x_end - tile->x_begin);
+    if (next.x_end > rc->dst->width) {
+        next.x_end = rc->dst->width;
+    }
+    if (next.x_begin >= next.x_end) {
+        return;
+    }
+
+    prefetch_rows(source_block(rc, &next), rc->src->stride, next.x_end - next.x_begin,
+                  (next.y_end - next.y_begin) * PIXEL_CHANNELS, false);
+    prefetch_rows(get_row(rc->dst, next.y_begin) + next.x_begin * PIXEL_CHANNELS, rc->dst->stride,
+                  next.y_end - next.y_begin, (next.x_end - next.x_begin) * PIXEL_CHANNELS, true);
+}
+
+/* Fills a tile of the remapped picture by transposing the matching block of stored pixels, walking the
+ * stored rows upwards for MIRROR_Y and the tile's rows upwards for MIRROR_X. */
+static void transpose_block(struct region *tile, void *ctx) {
+    struct remap_context *rc = ctx;
+    ptrdiff_t src_stride = rc->src->stride;
+    ptrdiff_t dst_stride = rc->dst->stride;
+    int width = tile->y_end - tile->y_begin;
+    int height = tile->x_end - tile->x_begin;
+
+    prefetch_next_tile(tile, rc);
+
+    const unsigned char *src = source_block(rc, tile);
+    if (rc->orientation & ORIENT_MIRROR_Y) {
+        src += (height - 1) * src_stride;
+        src_stride = -src_stride;
+    }
+    int first_row = tile->y_begin;
+    if (rc->orientation & ORIENT_MIRROR_X) {
+        first_row = tile->y_end - 1;
+        dst_stride = -dst_stride;
+    }
+    unsigned char *dst = get_row(rc->dst, first_row) + tile->x_begin * PIXEL_CHANNELS;
+    transpose_pixels(src, src_stride, dst, dst_stride, width, height);
+}
+
+void materialise_picture(struct picture *pic) {
+    enum orientation o = pic->orientation;
+    if (o == ORIENT_IDENTITY) {
+        return;
+    }
+
+    // mirrors only exchange pairs of pixels, so need no second picture; with MIRROR_Y each band of the
+    // top half of the rows also writes their mirror rows, which no other band touches
+    if (!(o & ORIENT_TRANSPOSE)) {
+        struct region area = whole_picture(pic);
+        if (o & ORIENT_MIRROR_Y) {
+            area.y_end = o & ORIENT_MIRROR_X ? (pic->height + 1) / 2 : pic->height / 2;
+        }
+        parallel_traverse_rows(&area, mirror_block, pic);
+        pic->orientation = ORIENT_IDENTITY;
+        return;
+    }
+
+    // transpose into a new picture, every pixel of which is written, that then replaces the original
+    struct picture out;
+    init_picture_for_overwrite(&out, pic->height, pic->width);
+
+    // tile the output so that each source block and its transpose stay in cache together
+    struct remap_context rc = {pic, &out, o};
+    struct region area = whole_picture(&out);
+    parallel_traverse_tiles(&area, TRANSPOSE_TILE_SIZE, TRANSPOSE_TILE_SIZE, transpose_block, &rc);
+
+    clear_picture(pic);
+    *pic = out;
+}
@@ -0,0 +1,23 @@
+#ifndef ORIENTATION_H
+#define ORIENTATION_H
+
+#include "Picture.h"
+
+/* Width and height of the picture in its current orientation. */
+int oriented_width(struct picture *pic);
+int oriented_height(struct picture *pic);
+
+/* Returns the orientation of a picture stored with orientation stored and then given the symmetry
+ * applied, both as in struct picture. */
+enum orientation compose_orientation(enum orientation stored, enum orientation applied);
+
+/* Applies a symmetry to the picture by composing it with the picture's orientation, without touching
+ * any pixels. */
+void orient_picture(struct picture *pic, enum orientation applied);
+
+/* Rearranges the stored pixels into picture order in a single pass and resets the orientation to the
+ * identity. Does nothing when the orientation already is the identity. Mirrors alone are applied in
+ * place; orientations that transpose the picture go through a second buffer. */
+void materialise_picture(struct picture *pic);
+
+#endif
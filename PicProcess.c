@@ -1,417 +1,591 @@
 #include "PicProcess.h"
-#include "ThreadPool.c"
+#include "BlurKernel.h"
+#include "BufferPool.h"
+#include "Orientation.h"
+#include "ThreadPool.h"
+#include <string.h>
+#include <unistd.h>
 
 #define NO_RGB_COMPONENTS 3
 #define BLUR_REGION_SIZE 9
 #define NO_quarterS 4
 
+/* Width in pixels of the tiles of blur_picture_tiled: 768 bytes, a whole number of cache lines. */
+#define BLUR_TILE_WIDTH 256
+#define MIN_BLUR_TILE_HEIGHT 16
+#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
+
+/* Smallest side in pixels of the tiles of blur_picture_n, excluding their halo. */
+#define MIN_FUSED_TILE_SIZE 32
+
+/* Most blurs blur_picture_n fuses into one pass, as a fraction of the side of a tile with its halo.
+ * The halo is as wide as the number of blurs and is blurred along with the tile, so this keeps the
+ * extra work to about a sixth; with many more blurs per pass, most of the work goes on the halo. */
+#define FUSED_BLURS_PER_SIDE 16
+
+/* Source and destination pictures of a transform that cannot be applied in place. */
+struct transform_context {
+    struct picture *src;
+    struct picture *dst;
+};
+
+/* Sums one channel over the 3x3 region centred on byte offset k of the middle row. */
+static inline int region_sum(const unsigned char *above, const unsigned char *row,
+                             const unsigned char *below, int k) {
+    return above[k - PIXEL_CHANNELS] + above[k] + above[k + PIXEL_CHANNELS]
+         + row[k - PIXEL_CHANNELS] + row[k] + row[k + PIXEL_CHANNELS]
+         + below[k - PIXEL_CHANNELS] + below[k] + below[k + PIXEL_CHANNELS];
+}
 
-void invert_picture(struct picture *pic) {
-    // iterate over each pixel in the picture
-    for (int i = 0; i < pic->width; i++) {
-        for (int j = 0; j < pic->height; j++) {
-            struct pixel rgb = get_pixel(pic, i, j);
-
-            // invert RGB values of pixel
-            rgb.red = MAX_PIXEL_INTENSITY - rgb.red;
-            rgb.green = MAX_PIXEL_INTENSITY - rgb.green;
-            rgb.blue = MAX_PIXEL_INTENSITY - rgb.blue;
-
-            // set pixel to inverted RBG values
-            set_pixel(pic, i, j, &rgb);
+/* Replaces the pixels of pic with those of the transformed picture out, recycling the old buffer. The
+ * transforms using this keep every pixel where it is stored, so pic keeps its orientation. */
+static void replace_picture(struct picture *pic, struct picture *out) {
+    out->orientation = pic->orientation;
+    clear_picture(pic);
+    *pic = *out;
+}
+
+/* Initialises out as a picture of the same size as src holding only src's pixels within border of an
+ * edge, which a blur of src leaves unchanged, ready for the blurred interior to be written to it. */
+static void init_blur_destination(struct picture *out, struct picture *src, int border) {
+    init_picture_for_overwrite(out, src->width, src->height);
+    for (int j = 0; j < src->height; j++) {
+        const unsigned char *row = get_row(src, j);
+        unsigned char *dst = get_row(out, j);
+        int edge = border * PIXEL_CHANNELS;
+        int last = (src->width - border) * PIXEL_CHANNELS;
+
+        if (j < border || j >= src->height - border || src->width <= 2 * border) {
+            memcpy(dst, row, src->width * PIXEL_CHANNELS);
+            continue;
         }
+        memcpy(dst, row, edge);
+        memcpy(dst + last, row + last, edge);
     }
 }
 
-void grayscale_picture(struct picture *pic) {
-    // iterate over each pixel in the picture
-    for (int i = 0; i < pic->width; i++) {
-        for (int j = 0; j < pic->height; j++) {
-            struct pixel rgb = get_pixel(pic, i, j);
+static void invert_block(struct region *block, void *ctx) {
+    struct picture *pic = ctx;
+    const int max = MAX_PIXEL_INTENSITY;
+
+    for (int j = block->y_begin; j < block->y_end; j++) {
+        unsigned char *row = get_row(pic, j);
+
+        // invert RGB values of every pixel in the block
+        for (int k = block->x_begin * PIXEL_CHANNELS; k < block->x_end * PIXEL_CHANNELS; k++) {
+            row[k] = max - row[k];
+        }
+    }
+}
+
+void invert_picture(struct picture *pic) {
+    struct region area = whole_picture(pic);
+    parallel_traverse_rows(&area, invert_block, pic);
+}
+
+static void grayscale_block(struct region *block, void *ctx) {
+    struct picture *pic = ctx;
+
+    for (int j = block->y_begin; j < block->y_end; j++) {
+        unsigned char *row = get_row(pic, j);
+
+        for (int i = block->x_begin; i < block->x_end; i++) {
+            unsigned char *rgb = row + i * PIXEL_CHANNELS;
 
             // compute gray average of pixel's RGB values
-            int avg = (rgb.red + rgb.green + rgb.blue) / NO_RGB_COMPONENTS;
-            rgb.red = avg;
-            rgb.green = avg;
-            rgb.blue = avg;
+            int avg = (rgb[0] + rgb[1] + rgb[2]) / NO_RGB_COMPONENTS;
 
             // set pixel to gray-scale RBG value
-            set_pixel(pic, i, j, &rgb);
+            rgb[0] = avg;
+            rgb[1] = avg;
+            rgb[2] = avg;
         }
     }
 }
 
+void grayscale_picture(struct picture *pic) {
+    struct region area = whole_picture(pic);
+    parallel_traverse_rows(&area, grayscale_block, pic);
+}
+
 void rotate_picture(struct picture *pic, int angle) {
-    // make temporary copy of picture to work from
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-
-    int new_width = tmp.width;
-    int new_height = tmp.height;
-
-    // adjust output picture size as necessary
-    if (angle == 90 || angle == 270) {
-        new_width = tmp.height;
-        new_height = tmp.width;
-    }
-    clear_picture(pic);
-    init_picture_from_size(pic, new_width, new_height);
-
-    // iterate over each pixel in the picture
-    for (int i = 0; i < new_width; i++) {
-        for (int j = 0; j < new_height; j++) {
-            struct pixel rgb;
-            // determine rotation angle and execute corresponding pixel update
-            switch (angle) {
-                case (90):
-                    rgb = get_pixel(&tmp, j, new_width - 1 - i);
-                    break;
-                case (180):
-                    rgb = get_pixel(&tmp, new_width - 1 - i, new_height - 1 - j);
-                    break;
-                case (270):
-                    rgb = get_pixel(&tmp, new_height - 1 - j, i);
-                    break;
-                default:
-                    printf("[!] rotate is undefined for angle %i (must be 90, 180 or 270)\n", angle);
-                    clear_picture(&tmp);
-                    exit(IO_ERROR);
-            }
-            set_pixel(pic, i, j, &rgb);
-        }
+    // determine rotation angle before touching the picture
+    if (angle != 90 && angle != 180 && angle != 270) {
+        printf("[!] rotate is undefined for angle %i (must be 90, 180 or 270)\n", angle);
+        exit(IO_ERROR);
     }
 
-    // temporary picture clean-up
-    clear_picture(&tmp);
+    // only record the rotation, which is applied when the pixels are next needed in picture order
+    orient_picture(pic, angle == 90 ? ORIENT_ROTATE_90 : angle == 180 ? ORIENT_ROTATE_180 : ORIENT_ROTATE_270);
 }
 
 void flip_picture(struct picture *pic, char plane) {
-    // make temporary copy of picture to work from
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-
-    // iterate over each pixel in the picture
-    for (int i = 0; i < tmp.width; i++) {
-        for (int j = 0; j < tmp.height; j++) {
-            struct pixel rgb;
-            // determine flip plane and execute corresponding pixel update
-            switch (plane) {
-                case ('V'):
-                    rgb = get_pixel(&tmp, i, tmp.height - 1 - j);
-                    break;
-                case ('H'):
-                    rgb = get_pixel(&tmp, tmp.width - 1 - i, j);
-                    break;
-                default:
-                    printf("[!] flip is undefined for plane %c\n", plane);
-                    clear_picture(&tmp);
-                    exit(IO_ERROR);
-            }
-            set_pixel(pic, i, j, &rgb);
-        }
+    // determine flip plane before touching the picture
+    if (plane != 'V' && plane != 'H') {
+        printf("[!] flip is undefined for plane %c\n", plane);
+        exit(IO_ERROR);
     }
 
-    // temporary picture clean-up
-    clear_picture(&tmp);
+    // only record the flip, which is applied when the pixels are next needed in picture order
+    orient_picture(pic, plane == 'V' ? ORIENT_FLIP_V : ORIENT_FLIP_H);
 }
 
-void blur_picture(struct picture *pic) {
-    // make temporary copy of picture to work from
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-
-    // iterate over each pixel in the picture (ignoring boundary pixels)
-    for (int i = 1; i < tmp.width - 1; i++) {
-        for (int j = 1; j < tmp.height - 1; j++) {
-
-            // set-up a local pixel on the stack
-            struct pixel rgb;
-            int sum_red = 0;
-            int sum_green = 0;
-            int sum_blue = 0;
-
-            // check the surrounding pixel region
-            for (int n = -1; n <= 1; n++) {
-                for (int m = -1; m <= 1; m++) {
-                    rgb = get_pixel(&tmp, i + n, j + m);
-                    sum_red += rgb.red;
-                    sum_green += rgb.green;
-                    sum_blue += rgb.blue;
+/* Source and destination pictures of a shrink, and the side of the square of source pixels averaged
+ * into each destination pixel. */
+struct shrink_context {
+    struct picture *src;
+    struct picture *dst;
+    int factor;
+};
+
+static void shrink_block(struct region *block, void *ctx) {
+    struct shrink_context *sc = ctx;
+    int factor = sc->factor;
+
+    for (int j = block->y_begin; j < block->y_end; j++) {
+        int y_begin = j * factor;
+        int y_end = y_begin + factor < sc->src->height ? y_begin + factor : sc->src->height;
+        unsigned char *dst = get_row(sc->dst, j);
+
+        for (int i = block->x_begin; i < block->x_end; i++) {
+            int x_begin = i * factor;
+            int x_end = x_begin + factor < sc->src->width ? x_begin + factor : sc->src->width;
+            int count = (y_end - y_begin) * (x_end - x_begin);
+
+            // set each channel to the rounded average of the square, cut short at the edges
+            for (int c = 0; c < PIXEL_CHANNELS; c++) {
+                int sum = count / 2;
+                for (int y = y_begin; y < y_end; y++) {
+                    const unsigned char *row = get_row(sc->src, y);
+                    for (int x = x_begin; x < x_end; x++) {
+                        sum += row[x * PIXEL_CHANNELS + c];
+                    }
                 }
+                dst[i * PIXEL_CHANNELS + c] = sum / count;
             }
+        }
+    }
+}
 
-            // compute average pixel RGB value
-            rgb.red = sum_red / BLUR_REGION_SIZE;
-            rgb.green = sum_green / BLUR_REGION_SIZE;
-            rgb.blue = sum_blue / BLUR_REGION_SIZE;
+void shrink_picture(struct picture *pic, int factor) {
+    // determine the reduction factor before touching the picture
+    if (factor != 2 && factor != 4 && factor != 8) {
+        printf("[!] shrink is undefined for factor %i (must be 2, 4 or 8)\n", factor);
+        exit(IO_ERROR);
+    }
 
-            // set pixel to region average RBG value
-            set_pixel(pic, i, j, &rgb);
-        }
+    // the squares are counted from the stored top left corner, so an oriented picture whose edge
+    // squares would be cut short is put in picture order first
+    if (pic->orientation != ORIENT_IDENTITY && (pic->width % factor || pic->height % factor)) {
+        materialise_picture(pic);
     }
 
-    // temporary picture clean-up
-    clear_picture(&tmp);
+    struct picture out;
+    init_picture_for_overwrite(&out, (pic->width + factor - 1) / factor, (pic->height + factor - 1) / factor);
+
+    struct shrink_context sc = {pic, &out, factor};
+    struct region area = whole_picture(&out);
+    parallel_traverse_rows(&area, shrink_block, &sc);
+
+    replace_picture(pic, &out);
 }
 
-/* Takes in a picture_information structure and blurs the pixel at the given i and j coordinates. */
-void blur_pixel(struct picture_information *inf) {
-    struct picture *pic = inf->picture;
-    struct picture *tmp = inf->tmp;
-    int i = inf->i;
-    int j = inf->j;
+static void blur_block(struct region *block, void *ctx) {
+    struct transform_context *tc = ctx;
 
-    struct pixel rgb;
-    int sum_red = 0;
-    int sum_green = 0;
-    int sum_blue = 0;
-
-    /* check the surrounding pixel region */
-    for (int n = -1; n <= 1; n++) {
-        for (int m = -1; m <= 1; m++) {
-            rgb = get_pixel(tmp, i + n, j + m);
-            sum_red += rgb.red;
-            sum_green += rgb.green;
-            sum_blue += rgb.blue;
-        }
+    for (int j = block->y_begin; j < block->y_end; j++) {
+        const unsigned char *above = get_row(tc->src, j - 1);
+        const unsigned char *row = get_row(tc->src, j);
+        const unsigned char *below = get_row(tc->src, j + 1);
+        unsigned char *dst = get_row(tc->dst, j);
+
+        // set each channel to its region average value
+        blur_row(above, row, below, dst, block->x_begin * PIXEL_CHANNELS, block->x_end * PIXEL_CHANNELS);
     }
+}
+
+void blur_picture(struct picture *pic) {
+    // blur into a new picture that then replaces the original
+    struct picture out;
+    init_blur_destination(&out, pic, 1);
 
-    /* compute average pixel RGB value */
-    rgb.red = sum_red / BLUR_REGION_SIZE;
-    rgb.green = sum_green / BLUR_REGION_SIZE;
-    rgb.blue = sum_blue / BLUR_REGION_SIZE;
+    // iterate over each row in the picture (ignoring boundary pixels)
+    struct transform_context tc = {pic, &out};
+    struct region area = {1, 1, pic->width - 1, pic->height - 1};
+    traverse_rows(&area, blur_block, &tc);
 
-    /* set pixel to region average RBG value */
-    set_pixel(pic, i, j, &rgb);
+    replace_picture(pic, &out);
 }
 
-/* Blurs the picture by creating a thread for every pixel. */
-void parallel_blur_picture(struct picture *pic) {
-    /* make temporary copy of picture to work from */
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-
-    /* Initialise new thread pool. */
-    struct thread_pool thread_pool;
-    initialise_thread_pool(&thread_pool);
-
-    /* iterate over each pixel in the picture (ignoring boundary pixels) */
-    for (int i = 1; i < tmp.width - 1; i++) {
-        for (int j = 1; j < tmp.height - 1; j++) {
-            pthread_t thread;
-            /* Creates a new thread and will keep attempting to by calling try_join_threads which removes any terminated threads. */
-            while (!new_individual_thread(&thread, pic, &tmp, i, j)) {
-                try_join_threads(&thread_pool);
-            }
-            add_to_thread_pool(&thread_pool, thread);
+/* Sums of each channel over the window of 2 * radius + 1 pixels centred on each pixel of a row, for
+ * the pixels at least radius from its ends, which start at byte first and end before byte last. */
+static void box_row_sums(const unsigned char *row, int *sums, int first, int last) {
+    for (int c = 0; c < PIXEL_CHANNELS; c++) {
+        int sum = 0;
+        for (int k = c; k < first + first + PIXEL_CHANNELS; k += PIXEL_CHANNELS) {
+            sum += row[k];
+        }
+        sums[first + c] = sum;
+        for (int k = first + PIXEL_CHANNELS + c; k < last; k += PIXEL_CHANNELS) {
+            sum += row[k + first] - row[k - first - PIXEL_CHANNELS];
+            sums[k] = sum;
         }
     }
-    join_threads(&thread_pool);
-
-    /* Temporary picture clean-up */
-    clear_picture(&tmp);
 }
 
-/* Creates a new thread which then runs blur_and_free_pixel with the picture_information structure also created. */
-bool new_individual_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int i, int j) {
-    struct picture_information *inf = malloc(sizeof(struct picture_information));
-    inf->picture = pic;
-    inf->tmp = tmp;
-    inf->i = i;
-    inf->j = j;
+void box_blur_picture(struct picture *pic, int radius) {
+    int diameter = 2 * radius + 1;
+    int area = diameter * diameter;
+    int row_bytes = pic->width * PIXEL_CHANNELS;
 
-    int ans = pthread_create(thread, NULL, (void *(*)(void *)) blur_and_free_pixel, inf);
-    /* If an error is returned then free the structure and return false. */
-    if (ans != 0) {
-        free(inf);
-        return false;
+    // pixels closer than radius to an edge keep their value, like the boundary pixels of blur_picture
+    if (diameter > pic->width || diameter > pic->height) {
+        return;
     }
-    return true;
-}
-/* Blurs the pixel and then frees the structure. */
-void blur_and_free_pixel(struct picture_information *inf) {
-    blur_pixel(inf);
-    free(inf);
-}
+    int first = radius * PIXEL_CHANNELS;
+    int last = (pic->width - radius) * PIXEL_CHANNELS;
+
+    // blur into a new picture, so that the rows leaving the window can be summed again from the
+    // original rather than kept; the only state is the column sums and one row of horizontal sums
+    struct picture out;
+    init_blur_destination(&out, pic, radius);
+    int *sums = acquire_buffer(row_bytes * sizeof(int));
+    int *column_sums = acquire_buffer(row_bytes * sizeof(int));
+    memset(column_sums, 0, row_bytes * sizeof(int));
+
+    for (int j = 0; j < pic->height; j++) {
+        // add row j to the window, which then covers rows j - diameter + 1 to j
+        box_row_sums(get_row(pic, j), sums, first, last);
+        for (int k = first; k < last; k++) {
+            column_sums[k] += sums[k];
+        }
+        if (j < diameter - 1) {
+            continue;
+        }
 
-/* Blurs the picture by creating a thread for every column. */
-void blur_picture_by_col(struct picture *pic) {
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-
-    /* Initialise new thread pool. */
-    struct thread_pool thread_pool;
-    initialise_thread_pool(&thread_pool);
-
-    /* iterate over each pixel in the picture (ignoring boundary pixels) */
-    for (int i = 1; i < tmp.width - 1; i++) {
-        pthread_t thread;
-        /* Creates a new thread and will keep attempting to by calling try_join_threads which removes any terminated threads. */
-        while (!new_col_thread(&thread, pic, &tmp, i)) {
-            try_join_threads(&thread_pool);
+        unsigned char *dst = get_row(&out, j - radius);
+        for (int k = first; k < last; k++) {
+            dst[k] = column_sums[k] / area;
+        }
+
+        // drop the oldest row from the window
+        box_row_sums(get_row(pic, j - diameter + 1), sums, first, last);
+        for (int k = first; k < last; k++) {
+            column_sums[k] -= sums[k];
         }
-        add_to_thread_pool(&thread_pool, thread);
     }
-    join_threads(&thread_pool);
 
-    /* Temporary picture clean-up. */
-    clear_picture(&tmp);
+    release_buffer(column_sums);
+    release_buffer(sums);
+    replace_picture(pic, &out);
+}
+
+/* Blurs the part of a tile that lies inside the picture's boundary pixels. */
+static void blur_tile(struct region *tile, void *ctx) {
+    struct transform_context *tc = ctx;
+    struct region inner = *tile;
+
+    if (inner.x_begin < 1) inner.x_begin = 1;
+    if (inner.y_begin < 1) inner.y_begin = 1;
+    if (inner.x_end > tc->src->width - 1) inner.x_end = tc->src->width - 1;
+    if (inner.y_end > tc->src->height - 1) inner.y_end = tc->src->height - 1;
+    if (inner.x_begin < inner.x_end && inner.y_begin < inner.y_end) {
+        blur_block(&inner, tc);
+    }
+}
+
+/* Size in bytes of the L2 cache, or a typical size if it cannot be found. */
+static long l2_cache_size(void) {
+    long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return l2_size > 0 ? l2_size : DEFAULT_L2_CACHE_SIZE;
+}
+
+/* Height of blur tiles of the given width such that a source tile with its 1-pixel halo and the
+ * destination tile together fill about half of the L2 cache. */
+static int blur_tile_height(int tile_width) {
+    long l2_size = l2_cache_size();
+    int height = l2_size / 2 / (2 * tile_width * PIXEL_CHANNELS) - 2;
+    return height < MIN_BLUR_TILE_HEIGHT ? MIN_BLUR_TILE_HEIGHT : height;
 }
 
-/* Creates a new thread which then runs blur_and_free_col with the picture_information structure also created. */
-bool new_col_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int i) {
-    struct picture_information *inf = malloc(sizeof(struct picture_information));
-    inf->picture = pic;
-    inf->tmp = tmp;
-    inf->i = i;
+void blur_picture_tiled(struct picture *pic) {
+    // blur into a new picture that then replaces the original
+    struct picture out;
+    init_blur_destination(&out, pic, 1);
 
-    if (pthread_create(thread, NULL, (void *(*)(void *)) blur_and_free_col, inf) != 0) {
-        /* If an error is returned then free the structure and return false. */
-        free(inf);
-        return false;
+    // tile the whole picture so that tile edges fall on cache line boundaries of each row,
+    // and leave the boundary pixels out of each tile as it is blurred
+    struct transform_context tc = {pic, &out};
+    struct region area = whole_picture(pic);
+    parallel_traverse_tiles(&area, BLUR_TILE_WIDTH, blur_tile_height(BLUR_TILE_WIDTH), blur_tile, &tc);
+
+    replace_picture(pic, &out);
+}
+
+/* Source and destination pictures of blur_picture_n, and the number of blurs to fuse. */
+struct fused_blur_context {
+    struct picture *src;
+    struct picture *dst;
+    int iterations;
+};
+
+/* Applies one blur to rows [y_begin, y_end) and columns [x_begin, x_end) of a tile's scratch buffer,
+ * in local coordinates, where the picture's own boundary pixels are copied rather than blurred. */
+static void blur_scratch(const unsigned char *src, unsigned char *dst, int stride, struct region *valid,
+                         struct region *edges) {
+    for (int j = valid->y_begin; j < valid->y_end; j++) {
+        const unsigned char *row = src + (size_t) j * stride;
+        unsigned char *out = dst + (size_t) j * stride;
+        int begin = valid->x_begin * PIXEL_CHANNELS;
+        int end = valid->x_end * PIXEL_CHANNELS;
+
+        if (j <= edges->y_begin || j >= edges->y_end - 1) {
+            memcpy(out + begin, row + begin, end - begin);
+            continue;
+        }
+        if (valid->x_begin <= edges->x_begin) {
+            memcpy(out + begin, row + begin, PIXEL_CHANNELS);
+            begin += PIXEL_CHANNELS;
+        }
+        if (valid->x_end >= edges->x_end) {
+            end -= PIXEL_CHANNELS;
+            memcpy(out + end, row + end, PIXEL_CHANNELS);
+        }
+        blur_row(row - stride, row, row + stride, out, begin, end);
     }
-    return true;
 }
 
-/* Blurs the column and then frees the structure. */
-void blur_and_free_col(struct picture_information *inf) {
-    struct picture *tmp = inf->tmp;
+/* Blurs a tile iterations times from a copy of the tile and its halo, which shrinks by one pixel per
+ * blur on every side that is not an edge of the picture, so that the tile itself ends up exact. */
+static void fused_blur_tile(struct region *tile, void *ctx) {
+    struct fused_blur_context *fc = ctx;
+    int n = fc->iterations;
+
+    // the tile with its halo, clipped to the picture
+    struct region halo = {tile->x_begin - n, tile->y_begin - n, tile->x_end + n, tile->y_end + n};
+    if (halo.x_begin < 0) halo.x_begin = 0;
+    if (halo.y_begin < 0) halo.y_begin = 0;
+    if (halo.x_end > fc->src->width) halo.x_end = fc->src->width;
+    if (halo.y_end > fc->src->height) halo.y_end = fc->src->height;
+
+    // the two scratch buffers are swapped after each blur, and recycled from tile to tile
+    int stride = (halo.x_end - halo.x_begin) * PIXEL_CHANNELS;
+    size_t size = (size_t) stride * (halo.y_end - halo.y_begin);
+    unsigned char *cur = acquire_buffer(size);
+    unsigned char *next = acquire_buffer(size);
+    for (int j = halo.y_begin; j < halo.y_end; j++) {
+        memcpy(cur + (size_t) (j - halo.y_begin) * stride,
+               get_row(fc->src, j) + halo.x_begin * PIXEL_CHANNELS, stride);
+    }
 
-    /* Calls blur_pixel on every individual pixel in the column. */
-    for (int j = 1; j < tmp->height - 1; j++) {
-        inf->j = j;
-        blur_pixel(inf);
+    // picture edges and the part of the scratch buffer holding valid pixels, in local coordinates
+    struct region edges = {-halo.x_begin, -halo.y_begin,
+                           fc->src->width - halo.x_begin, fc->src->height - halo.y_begin};
+    struct region valid = {0, 0, halo.x_end - halo.x_begin, halo.y_end - halo.y_begin};
+
+    for (int i = 0; i < n; i++) {
+        if (valid.x_begin > edges.x_begin) valid.x_begin++;
+        if (valid.y_begin > edges.y_begin) valid.y_begin++;
+        if (valid.x_end < edges.x_end) valid.x_end--;
+        if (valid.y_end < edges.y_end) valid.y_end--;
+        blur_scratch(cur, next, stride, &valid, &edges);
+
+        unsigned char *swap = cur;
+        cur = next;
+        next = swap;
     }
-    free(inf);
+
+    // copy the tile itself out
+    int offset = (tile->x_begin - halo.x_begin) * PIXEL_CHANNELS;
+    for (int j = tile->y_begin; j < tile->y_end; j++) {
+        memcpy(get_row(fc->dst, j) + tile->x_begin * PIXEL_CHANNELS,
+               cur + (size_t) (j - halo.y_begin) * stride + offset,
+               (tile->x_end - tile->x_begin) * PIXEL_CHANNELS);
+    }
+
+    release_buffer(next);
+    release_buffer(cur);
 }
 
-/* Blurs the picture by creating a thread for every row. */
-void blur_picture_by_row(struct picture *pic) {
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-
-    /* Initialise new thread pool. */
-    struct thread_pool thread_pool;
-    initialise_thread_pool(&thread_pool);
-
-    /* Iterate over each pixel in the picture (ignoring boundary pixels). */
-    for (int j = 1; j < tmp.height - 1; j++) {
-        pthread_t thread;
-        /* Creates a new thread and will keep attempting to by calling try_join_threads which removes any terminated threads. */
-        while (!new_row_thread(&thread, pic, &tmp, j)) {
-            try_join_threads(&thread_pool);
-        }
-        add_to_thread_pool(&thread_pool, thread);
+/* Side of the square that both scratch buffers of a blur_picture_n tile with its halo can take up
+ * while filling about half of the L2 cache. */
+static int fused_buffer_side(void) {
+    long bytes = l2_cache_size() / 2 / (2 * PIXEL_CHANNELS);
+    int side = 0;
+    while ((long) (side + 1) * (side + 1) <= bytes) {
+        side++;
     }
-    join_threads(&thread_pool);
+    return side;
+}
 
-    /* Temporary picture clean-up. */
-    clear_picture(&tmp);
+/* Side of square blur_picture_n tiles such that their buffers, halo included, fit in that square. */
+static int fused_tile_size(int iterations) {
+    int side = fused_buffer_side() - 2 * iterations;
+    return side < MIN_FUSED_TILE_SIZE ? MIN_FUSED_TILE_SIZE : side;
 }
 
-/* Creates a new thread which then runs blur_and_free_row with the picture_information structure also created. */
-bool new_row_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int j) {
-    struct picture_information *inf = malloc(sizeof(struct picture_information));
-    inf->picture = pic;
-    inf->tmp = tmp;
-    inf->j = j;
+/* Blurs the picture iterations times in a single pass of fused tiles. */
+static void fused_blur_pass(struct picture *pic, int iterations) {
+    // every pixel of the destination is written by exactly one tile
+    struct picture out;
+    init_picture_for_overwrite(&out, pic->width, pic->height);
+
+    struct fused_blur_context fc = {pic, &out, iterations};
+    struct region area = whole_picture(pic);
+    int side = fused_tile_size(iterations);
+    parallel_traverse_tiles(&area, side, side, fused_blur_tile, &fc);
 
-    if (pthread_create(thread, NULL, (void *(*)(void *)) blur_and_free_row, inf) != 0) {
-        /* If an error is returned then free the structure and return false. */
-        free(inf);
-        return false;
+    replace_picture(pic, &out);
+}
+
+void blur_picture_n(struct picture *pic, int iterations) {
+    // long runs go in several passes, each fusing few enough blurs that the halo stays small
+    int most = fused_buffer_side() / FUSED_BLURS_PER_SIDE;
+    while (iterations > 0) {
+        int n = iterations < most ? iterations : most;
+        if (n <= 1) {
+            blur_picture(pic);
+            n = 1;
+        } else {
+            fused_blur_pass(pic, n);
+        }
+        iterations -= n;
     }
-    return true;
 }
 
-/* Blurs the row and then frees the structure. */
-void blur_and_free_row(struct picture_information *inf) {
+/* Takes in a picture_information structure and blurs the pixel at the given i and j coordinates. */
+void blur_pixel(struct picture_information *inf) {
     struct picture *tmp = inf->tmp;
-    /* Calls blur_pixel on each individual pixel in the row. */
-    for (int i = 1; i < tmp->width - 1; i++) {
-        inf->i = i;
-        blur_pixel(inf);
+    int j = inf->j;
+
+    const unsigned char *above = get_row(tmp, j - 1);
+    const unsigned char *row = get_row(tmp, j);
+    const unsigned char *below = get_row(tmp, j + 1);
+    unsigned char *dst = get_row(inf->picture, j);
+
+    /* set each channel of the pixel to its region average value */
+    for (int k = inf->i * PIXEL_CHANNELS; k < (inf->i + 1) * PIXEL_CHANNELS; k++) {
+        dst[k] = region_sum(above, row, below, k) / BLUR_REGION_SIZE;
     }
-    free(inf);
 }
 
-/* Blurs the picture by creating a thread for each of the four quarters. */
-void blur_picture_by_quarter(struct picture *pic) {
-    struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
+/* Blurs the interior pixels numbered lo to hi - 1, counting row by row from (1, 1). */
+static void blur_pixel_range(void *ctx, int lo, int hi) {
+    struct picture_information inf = *(struct picture_information *) ctx;
+    int interior_width = inf.tmp->width - 2;
 
-    /* Initialise new thread pool. */
-    struct thread_pool thread_pool;
-    initialise_thread_pool(&thread_pool);
+    for (int n = lo; n < hi; n++) {
+        inf.i = 1 + n % interior_width;
+        inf.j = 1 + n / interior_width;
+        blur_pixel(&inf);
+    }
+}
 
-    /* Midpoints of the picture. */
-    int mid_width = tmp.width / 2;
-    int mid_height = tmp.height / 2;
+/* Blurs the picture by running a job on the shared thread pool for every pixel. */
+void parallel_blur_picture(struct picture *pic) {
+    /* blur into a new picture that then replaces the original */
+    struct picture out;
+    init_blur_destination(&out, pic, 1);
+
+    /* hand out every pixel in the picture (ignoring boundary pixels) one at a time */
+    struct picture_information inf = {.picture = &out, .tmp = pic};
+    if (pic->width > 2 && pic->height > 2) {
+        parallel_for(0, (pic->width - 2) * (pic->height - 2), 1, blur_pixel_range, &inf);
+    }
 
-    /* Creates four arrays of each of the four quarters with their starting and ending i and j coordinates. */
-    int tl[4] = {0, 0, mid_width, mid_height};
-    int tr[4] = {mid_width, 1, tmp.width - 1, mid_height};
-    int bl[4] = {1, mid_height, mid_width, tmp.height - 1};
-    int br[4] = {mid_width, mid_height, tmp.width - 1, tmp.height - 1};
+    replace_picture(pic, &out);
+}
 
-    int* quarters[NO_quarterS] = {tl, tr, bl, br};
+/* Calls blur_pixel on every individual pixel in columns lo to hi - 1. */
+static void blur_col_range(void *ctx, int lo, int hi) {
+    struct picture_information inf = *(struct picture_information *) ctx;
 
-    /* Iterate over each pixel in the picture (ignoring boundary pixels). */
-    for (int i = 0; i < NO_quarterS; i++) {
-        pthread_t thread;
-        /* Creates a new thread and will keep attempting to by calling try_join_threads which removes any terminated threads. */
-        while (!new_quarter_thread(&thread, pic, &tmp, quarters[i])) {
-            try_join_threads(&thread_pool);
+    for (inf.i = lo; inf.i < hi; inf.i++) {
+        for (inf.j = 1; inf.j < inf.tmp->height - 1; inf.j++) {
+            blur_pixel(&inf);
         }
-        add_to_thread_pool(&thread_pool, thread);
     }
-    join_threads(&thread_pool);
-
-    /* Temporary picture clean-up. */
-    clear_picture(&tmp);
-}
-
-/* Creates a new thread which then runs blur_and_free_quarter with the picture_information structure also created. */
-bool new_quarter_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, const int quarter[]) {
-    struct picture_information *inf = malloc(sizeof(struct picture_information));
-    inf->picture = pic;
-    inf->tmp = tmp;
-    /* Sets the starting and ending i and j coordinates for the thread's picture_information. */
-    inf->starti = quarter[0];
-    inf->startj = quarter[1];
-    inf->endi = quarter[2];
-    inf->endj = quarter[3];
-
-    if (pthread_create(thread, NULL, (void *(*)(void *)) blur_and_free_quarter, inf) != 0) {
-        free(inf);
-        return false;
+}
+
+/* Blurs the picture by running a job on the shared thread pool for every column. */
+void blur_picture_by_col(struct picture *pic) {
+    struct picture out;
+    init_blur_destination(&out, pic, 1);
+
+    /* hand out each column in the picture (ignoring boundary pixels) one at a time */
+    struct picture_information inf = {.picture = &out, .tmp = pic};
+    parallel_for(1, pic->width - 1, 1, blur_col_range, &inf);
+
+    replace_picture(pic, &out);
+}
+
+/* Calls blur_pixel on each individual pixel in rows lo to hi - 1. */
+static void blur_row_range(void *ctx, int lo, int hi) {
+    struct picture_information inf = *(struct picture_information *) ctx;
+
+    for (inf.j = lo; inf.j < hi; inf.j++) {
+        for (inf.i = 1; inf.i < inf.tmp->width - 1; inf.i++) {
+            blur_pixel(&inf);
+        }
     }
-    return true;
 }
 
-/* Blurs the quarter and then frees the structure. */
-void blur_and_free_quarter(struct picture_information *inf) {
-    for (int i = inf->starti; i < inf->endi; i++) {
-        for (int j = inf->startj; j < inf->endj; j++) {
-            /* Calls blur_pixel on every individual pixel within the quarter. */
-            inf->i = i;
-            inf->j = j;
+/* Blurs the picture by running a job on the shared thread pool for every row. */
+void blur_picture_by_row(struct picture *pic) {
+    struct picture out;
+    init_blur_destination(&out, pic, 1);
+
+    /* hand out each row in the picture (ignoring boundary pixels) one at a time */
+    struct picture_information inf = {.picture = &out, .tmp = pic};
+    parallel_for(1, pic->height - 1, 1, blur_row_range, &inf);
+
+    replace_picture(pic, &out);
+}
+
+/* Calls blur_pixel on every individual pixel within the quarter. */
+static void blur_quarter(void *arg) {
+    struct picture_information *inf = arg;
+
+    for (inf->j = inf->startj; inf->j < inf->endj; inf->j++) {
+        for (inf->i = inf->starti; inf->i < inf->endi; inf->i++) {
             blur_pixel(inf);
         }
     }
-    free(inf);
-}
\ No newline at end of file
+}
+
+/* Blurs the picture by running a job on the shared thread pool for each of the four quarters. */
+void blur_picture_by_quarter(struct picture *pic) {
+    struct picture out;
+    init_blur_destination(&out, pic, 1);
+
+    /* Midpoints of the picture. */
+    int mid_width = pic->width / 2;
+    int mid_height = pic->height / 2;
+
+    /* Creates four arrays of each of the four quarters with their starting and ending i and j coordinates. */
+    int tl[4] = {1, 1, mid_width, mid_height};
+    int tr[4] = {mid_width, 1, pic->width - 1, mid_height};
+    int bl[4] = {1, mid_height, mid_width, pic->height - 1};
+    int br[4] = {mid_width, mid_height, pic->width - 1, pic->height - 1};
+
+    int* quarters[NO_quarterS] = {tl, tr, bl, br};
+
+    struct thread_pool *thread_pool = shared_thread_pool();
+    struct job_group group;
+    initialise_job_group(&group);
+
+    /* Submits a job for each quarter, whose picture_information lives until all of them are done. */
+    struct picture_information inf[NO_quarterS];
+    for (int q = 0; q < NO_quarterS; q++) {
+        inf[q].picture = &out;
+        inf[q].tmp = pic;
+        inf[q].starti = quarters[q][0];
+        inf[q].startj = quarters[q][1];
+        inf[q].endi = quarters[q][2];
+        inf[q].endj = quarters[q][3];
+        submit_job(thread_pool, &group, blur_quarter, &inf[q]);
+    }
+    wait_for_jobs(thread_pool, &group);
+
+    replace_picture(pic, &out);
+}
@@ -2,9 +2,10 @@
 #define PICLIB_H
 
 #include "Picture.h"
+#include "Traversal.h"
 #include "Utils.h"
 
-/* Structure used to pass additional information about the picture as an argument into pthread_create(). */
+/* Structure used to pass additional information about the picture to blur jobs on the thread pool. */
 struct picture_information {
   struct picture *picture;
   struct picture *tmp;
@@ -16,29 +17,35 @@ struct picture_information {
   int endj;                 /* End j coordinate for when blurring by quarter. */
 };
 
-// picture transformation routines
+// picture transformation routines; rotate and flip only update the picture's orientation, and every
+// other transform here is symmetric under rotations and flips, so works on the stored pixels as they are
 void invert_picture(struct picture *pic);
 void grayscale_picture(struct picture *pic);
 void rotate_picture(struct picture *pic, int angle);
 void flip_picture(struct picture *pic, char plane);
 void blur_picture(struct picture *pic);
 
+// reduce the picture to 1/factor of its width and height (rounding up), for a factor of 2, 4 or 8, with
+// each pixel the average of the factor x factor square of pixels it replaces
+void shrink_picture(struct picture *pic, int factor);
+
+// blur with the average of the (2 * radius + 1)^2 surrounding pixels, leaving pixels within radius of
+// the edge unchanged; radius 1 gives the same result as blur_picture
+void box_blur_picture(struct picture *pic, int radius);
+
+// blur the picture iterations times, with the same result as calling blur_picture that many times,
+// but fusing the blurs tile by tile so that each tile stays in cache between them; long runs of blurs
+// are fused a few dozen at a time
+void blur_picture_n(struct picture *pic, int iterations);
+
 void blur_pixel(struct picture_information *inf);
 
+// parallel blur strategies, run on the shared thread pool
 void parallel_blur_picture(struct picture *pic);
-bool new_individual_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int i, int j);
-void blur_and_free_pixel(struct picture_information *inf);
-
 void blur_picture_by_col(struct picture *pic);
-bool new_col_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int i);
-void blur_and_free_col(struct picture_information *inf);
-
 void blur_picture_by_row(struct picture *pic);
-bool new_row_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int j);
-void blur_and_free_row(struct picture_information *inf);
-
 void blur_picture_by_quarter(struct picture *pic);
-bool new_quarter_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, const int quarter[]);
-void blur_and_free_quarter(struct picture_information *inf);
-#endif
 
+// parallel blur over cache-sized tiles, balanced across the shared thread pool
+void blur_picture_tiled(struct picture *pic);
+#endif
@@ -0,0 +1,323 @@
+#include "PicStream.h"
+#include "BlurKernel.h"
+#include "BufferPool.h"
+#include "Orientation.h"
+#include "PicProcess.h"
+#include "ThreadPool.h"
+#include "sod_img_reader.h"
+#include "sod_img_writer.h"
+#include <pthread.h>
+#include <string.h>
+
+/* Most encoder bands handed to the thread pool at once, which bounds the ring to a few of them. */
+#define MAX_ENCODE_BANDS 8
+
+/* An op and how far down the picture it has got. */
+struct stream_filter {
+    enum stream_op op;
+    int done;               /* rows this op has finished */
+    unsigned char *above;   /* blur: the row above the next one, as it was before the blur */
+    unsigned char *row;     /* blur: copy of the row being blurred */
+};
+
+/* State shared by the decoding, transforming and encoding threads. Row y of the picture is stored in
+ * slot y % capacity of the ring, from when it is decoded until it has been encoded; the counters below
+ * say how many rows from the top each stage has finished, with encoded <= transformed <= decoded. */
+struct stream {
+    stbi_jpeg_stream *decoder;
+    stbi_write_jpg_stream encoder;
+    FILE *file;
+
+    int width;
+    int height;
+    int stride;
+    unsigned char *rows;
+    int capacity;
+
+    int decode_rows;        /* rows decoded at a time */
+    int encode_bands;       /* most encoder bands encoded at a time */
+
+    struct stream_filter *filters;
+    int no_filters;
+
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+    int decoded;
+    int transformed;
+    int encoded;
+    bool failed;
+};
+
+static unsigned char *ring_row(struct stream *st, int y) {
+    return st->rows + (size_t) (y % st->capacity) * st->stride;
+}
+
+static int gcd(int a, int b) {
+    while (b != 0) {
+        int r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/* Picks a ring big enough for the encoder to take encode_bands bands while the decoder and the ops
+ * work on the next ones, in whole decoder and encoder bands so that neither wraps around the end of
+ * the ring; a picture that fits in fewer rows is held whole. */
+static int ring_capacity(struct stream *st) {
+    int band_rows = st->encoder.band_rows;
+    int unit = st->decode_rows / gcd(st->decode_rows, band_rows) * band_rows;
+    int rows = 2 * st->encode_bands * band_rows + st->decode_rows + st->no_filters;
+    int whole = (st->height + st->decode_rows - 1) / st->decode_rows * st->decode_rows;
+    if (unit >= whole) {
+        return whole;
+    }
+    rows = (rows + unit - 1) / unit * unit;
+    return rows < whole ? rows : whole;
+}
+
+/* Blurs row y in place, from copies of it and of the row above as they were before the blur, with the
+ * row below still untouched; like blur_picture, the rows and columns on the edges keep their values. */
+static void blur_stream_row(struct stream *st, struct stream_filter *f, int y) {
+    unsigned char *row = ring_row(st, y);
+    int row_bytes = st->width * PIXEL_CHANNELS;
+    if (y == 0 || y == st->height - 1 || st->width < 3) {
+        memcpy(f->above, row, row_bytes);
+        return;
+    }
+    memcpy(f->row, row, row_bytes);
+    blur_row(f->above, f->row, ring_row(st, y + 1), row, PIXEL_CHANNELS, row_bytes - PIXEL_CHANNELS);
+
+    unsigned char *above = f->above;
+    f->above = f->row;
+    f->row = above;
+}
+
+/* Applies an op to rows y to y + rows - 1, which do not wrap around the ring. The per-pixel ops work
+ * on the band as a picture of its own, across the thread pool. */
+static void filter_band(struct stream *st, struct stream_filter *f, int y, int rows) {
+    struct picture band = {.data = ring_row(st, y), .width = st->width, .height = rows,
+                           .stride = st->stride, .orientation = ORIENT_IDENTITY};
+    switch (f->op) {
+    case STREAM_INVERT:
+        invert_picture(&band);
+        break;
+    case STREAM_GRAYSCALE:
+        grayscale_picture(&band);
+        break;
+    case STREAM_FLIP_H:
+        orient_picture(&band, ORIENT_FLIP_H);
+        materialise_picture(&band);
+        break;
+    case STREAM_BLUR:
+        for (int j = 0; j < rows; j++) {
+            blur_stream_row(st, f, y + j);
+        }
+        break;
+    }
+}
+
+/* Runs each op over the rows the one before it has finished, starting from the first decoded rows,
+ * and returns how many rows have been through them all. */
+static int run_filters(struct stream *st, int decoded) {
+    int ready = decoded;
+    for (int i = 0; i < st->no_filters; i++) {
+        struct stream_filter *f = &st->filters[i];
+        // a blur can only finish a row once the row below it is ready
+        int end = f->op == STREAM_BLUR && ready < st->height ? ready - 1 : ready;
+        while (f->done < end) {
+            int rows = end - f->done;
+            int to_wrap = st->capacity - f->done % st->capacity;
+            rows = rows < to_wrap ? rows : to_wrap;
+            filter_band(st, f, f->done, rows);
+            f->done += rows;
+        }
+        ready = f->done;
+    }
+    return ready;
+}
+
+/* Records that a stage has finished up to count rows, or has failed if count is negative, and wakes
+ * the other stages. Called with the lock held. */
+static void report_progress(struct stream *st, int *stage, int count) {
+    if (count < 0) {
+        st->failed = true;
+    } else {
+        *stage = count;
+    }
+    pthread_cond_broadcast(&st->progress);
+}
+
+static void *decode_thread(void *arg) {
+    struct stream *st = arg;
+    pthread_mutex_lock(&st->lock);
+    while (!st->failed && st->decoded < st->height) {
+        // the slots of the next band must have been encoded before they are reused
+        if (st->decoded + st->decode_rows > st->encoded + st->capacity) {
+            pthread_cond_wait(&st->progress, &st->lock);
+            continue;
+        }
+        int y = st->decoded;
+        pthread_mutex_unlock(&st->lock);
+        int rows = stbi_jpeg_stream_read(st->decoder, ring_row(st, y), st->stride);
+        pthread_mutex_lock(&st->lock);
+        report_progress(st, &st->decoded, rows > 0 ? y + rows : -1);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+static void *transform_thread(void *arg) {
+    struct stream *st = arg;
+    int decoded = 0;
+    pthread_mutex_lock(&st->lock);
+    while (!st->failed && st->transformed < st->height) {
+        if (st->decoded == decoded) {
+            pthread_cond_wait(&st->progress, &st->lock);
+            continue;
+        }
+        decoded = st->decoded;
+        pthread_mutex_unlock(&st->lock);
+        int transformed = run_filters(st, decoded);
+        pthread_mutex_lock(&st->lock);
+        report_progress(st, &st->transformed, transformed);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+/* Encodes the rows as they are transformed, in whole encoder bands but for the last one, returning
+ * false if any stage fails. */
+static bool encode_rows(struct stream *st) {
+    int band_rows = st->encoder.band_rows;
+    pthread_mutex_lock(&st->lock);
+    while (!st->failed && st->encoded < st->height) {
+        int y = st->encoded;
+        int rows = st->transformed - y;
+        bool last = st->transformed == st->height;
+        if (rows < band_rows && !last) {
+            pthread_cond_wait(&st->progress, &st->lock);
+            continue;
+        }
+        // up to encode_bands bands, without wrapping around the ring
+        int most = st->encode_bands * band_rows;
+        int to_wrap = st->capacity - y % st->capacity;
+        most = most < to_wrap ? most : to_wrap;
+        if (rows > most) {
+            rows = most;
+        } else if (!last) {
+            rows -= rows % band_rows;
+        }
+        pthread_mutex_unlock(&st->lock);
+        bool ok = stbi_write_jpg_stream_rows(&st->encoder, ring_row(st, y), st->stride, rows, run_in_parallel, NULL);
+        pthread_mutex_lock(&st->lock);
+        report_progress(st, &st->encoded, ok ? y + rows : -1);
+    }
+    bool ok = !st->failed;
+    pthread_mutex_unlock(&st->lock);
+    return ok;
+}
+
+static void write_to_file(void *context, void *data, int size) {
+    fwrite(data, 1, size, context);
+}
+
+/* Sets up the ops, with the two row copies each blur needs, returning false if out of memory. */
+static bool init_filters(struct stream *st, const enum stream_op *ops, int no_ops) {
+    st->filters = calloc(no_ops > 0 ? no_ops : 1, sizeof(struct stream_filter));
+    if (st->filters == NULL) {
+        return false;
+    }
+    st->no_filters = no_ops;
+    for (int i = 0; i < no_ops; i++) {
+        st->filters[i].op = ops[i];
+        if (ops[i] == STREAM_BLUR) {
+            // padded like a ring row, since blur_row may load past the end of a row
+            st->filters[i].above = acquire_buffer(st->stride + BUFFER_ALIGNMENT);
+            st->filters[i].row = acquire_buffer(st->stride + BUFFER_ALIGNMENT);
+            if (st->filters[i].above == NULL || st->filters[i].row == NULL) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void clear_filters(struct stream *st) {
+    for (int i = 0; st->filters != NULL && i < st->no_filters; i++) {
+        release_buffer(st->filters[i].above);
+        release_buffer(st->filters[i].row);
+    }
+    free(st->filters);
+}
+
+/* Runs the three stages until the picture has been encoded or one of them fails. */
+static bool run_stages(struct stream *st) {
+    pthread_t decoder, transformer;
+    bool decoding = pthread_create(&decoder, NULL, decode_thread, st) == 0;
+    bool transforming = decoding && pthread_create(&transformer, NULL, transform_thread, st) == 0;
+    if (!transforming) {
+        pthread_mutex_lock(&st->lock);
+        report_progress(st, NULL, -1);
+        pthread_mutex_unlock(&st->lock);
+    }
+
+    bool ok = transforming && encode_rows(st);
+
+    if (decoding) {
+        pthread_join(decoder, NULL);
+    }
+    if (transforming) {
+        pthread_join(transformer, NULL);
+    }
+    return ok;
+}
+
+bool stream_jpeg_file(const char *src_path, const char *dst_path, const enum stream_op *ops, int no_ops,
+                      const struct save_options *options) {
+    struct save_options defaults = DEFAULT_SAVE_OPTIONS;
+    if (options == NULL) {
+        options = &defaults;
+    }
+
+    struct stream st = {0};
+    st.decoder = stbi_jpeg_stream_open(src_path, PIXEL_CHANNELS, &st.width, &st.height, &st.decode_rows);
+    if (st.decoder == NULL) {
+        return false;
+    }
+    st.stride = (st.width * PIXEL_CHANNELS + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+
+    int workers = shared_thread_pool()->no_workers;
+    st.encode_bands = workers < 1 ? 1 : workers > MAX_ENCODE_BANDS ? MAX_ENCODE_BANDS : workers;
+
+    bool ok = init_filters(&st, ops, no_ops);
+    st.file = ok ? fopen(dst_path, "wb") : NULL;
+    ok = st.file != NULL &&
+         stbi_write_jpg_stream_begin(&st.encoder, write_to_file, st.file, st.width, st.height, PIXEL_CHANNELS,
+                                     options->quality, options->subsample_chroma);
+    if (ok) {
+        // the slack after the last slot covers loads past the end of a row, as in a picture
+        st.capacity = ring_capacity(&st);
+        st.rows = acquire_buffer((size_t) st.capacity * st.stride + BUFFER_ALIGNMENT);
+        ok = st.rows != NULL;
+    }
+    if (ok) {
+        pthread_mutex_init(&st.lock, NULL);
+        pthread_cond_init(&st.progress, NULL);
+        ok = run_stages(&st) && stbi_write_jpg_stream_end(&st.encoder);
+        pthread_cond_destroy(&st.progress);
+        pthread_mutex_destroy(&st.lock);
+    }
+
+    if (st.file != NULL) {
+        ok &= fflush(st.file) == 0 && !ferror(st.file);
+        ok &= fclose(st.file) == 0;
+        if (!ok) {
+            remove(dst_path);
+        }
+    }
+    release_buffer(st.rows);
+    clear_filters(&st);
+    stbi_jpeg_stream_close(st.decoder);
+    return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef PICSTREAM_H
+#define PICSTREAM_H
+
+#include "Picture.h"
+#include "Utils.h"
+
+/* Transforms that only need a few rows of the picture at a time, so can be applied as it streams
+ * past, each with the same result as the picture transform it is named after. */
+enum stream_op {
+    STREAM_INVERT,      /* invert_picture */
+    STREAM_GRAYSCALE,   /* grayscale_picture */
+    STREAM_FLIP_H,      /* flip_picture with plane 'H' */
+    STREAM_BLUR         /* blur_picture */
+};
+
+/* Decodes the JPEG file at src_path, applies ops to it in order and encodes the result to dst_path as
+ * the options say (DEFAULT_SAVE_OPTIONS if NULL), with the same output as loading the picture,
+ * transforming it and saving it. The rows go through a ring buffer of a few bands, so memory grows with
+ * the width of the picture but not with its height: one thread decodes bands into the ring, another
+ * runs the ops over them and the calling thread encodes them, each band as soon as it is ready.
+ * Returns false when src_path is not a single-scan JPEG, or when decoding or writing fails part way,
+ * in which case any partial output is removed and the caller has to go through a whole picture. */
+bool stream_jpeg_file(const char *src_path, const char *dst_path, const enum stream_op *ops, int no_ops,
+                      const struct save_options *options);
+
+#endif
@@ -1,56 +1,153 @@
 #include "Picture.h"
+#include "BufferPool.h"
+#include "Orientation.h"
+#include "RawPicture.h"
+#include <string.h>
 
-  bool init_picture_from_file(struct picture *pic, const char *path){
-    pic->img = load_image(path);
-    // check for picture initialisation error
-    if( pic->img.data == 0 ){
+  // rows are padded to a whole number of cache lines, so that threads writing
+  // to different rows never share a line, and the buffer is over-allocated by
+  // the same amount so wide loads can run past the end of the last row
+  #define ROW_ALIGNMENT BUFFER_ALIGNMENT
+
+  // take an uninitialised pixel buffer for a picture of the given size from
+  // the buffer pool, so that the buffers of cleared pictures are reused
+  static bool alloc_pixels(struct picture *pic, int width, int height){
+    pic->width = width;
+    pic->height = height;
+    pic->orientation = ORIENT_IDENTITY;
+    pic->mapping = NULL;
+    pic->mapping_size = 0;
+    pic->stride = (width * PIXEL_CHANNELS + ROW_ALIGNMENT - 1) & ~(ROW_ALIGNMENT - 1);
+    pic->data = acquire_buffer((size_t) pic->stride * height + ROW_ALIGNMENT);
+    return pic->data != NULL;
+  }
+
+  // decoder callback handing out the picture's own pixel buffer, so that the
+  // file is decoded straight into it; the slack after the last row covers the
+  // byte the decoder may write past the end of a row
+  static unsigned char *pixels_for_decode(void *user, int width, int height, int channels, int *stride){
+    struct picture *pic = user;
+    if( channels != PIXEL_CHANNELS || !alloc_pixels(pic, width, height) ){
+      return NULL;
+    }
+    *stride = pic->stride;
+    return pic->data;
+  }
+
+  bool init_picture_from_file(struct picture *pic, const char *path, int scale){
+    pic->data = NULL;
+    pic->mapping = NULL;
+    if( is_raw_picture_path(path) ){
+      if( scale != 1 ){
+        printf("[!] raw pictures can't be loaded at scale 1/%i\n", scale);
+        return false;
+      }
+      return load_raw_picture(pic, path);
+    }
+    if( !load_pixels(path, scale, pixels_for_decode, pic) ){
+      // the buffer may have been handed out before decoding failed
+      clear_picture(pic);
       return false;
-    }    
-    pic->width = get_image_width(pic->img);
-    pic->height = get_image_height(pic->img);
+    }
     return true;
   }
 
   bool init_picture_from_size(struct picture *pic, int width, int height){
-    pic->img = create_image(width, height);
-    // check for picture initialisation error
-    if ( pic->img.data == 0 ){
+    if( !alloc_pixels(pic, width, height) ){
       return false;
     }
-    pic->width = width;
-    pic->height = height;
+    memset(pic->data, 0, (size_t) pic->stride * height);
+    return true;
+  }
+
+  bool init_picture_for_overwrite(struct picture *pic, int width, int height){
+    return alloc_pixels(pic, width, height);
+  }
+
+  bool init_picture_from_copy(struct picture *pic, struct picture *src){
+    if( !alloc_pixels(pic, src->width, src->height) ){
+      return false;
+    }
+    memcpy(pic->data, src->data, (size_t) src->stride * src->height);
+    pic->orientation = src->orientation;
     return true;
   }
 
-  bool save_picture_to_file(struct picture *pic, const char *path){
-    return save_image(pic->img, path);   
+  bool save_picture_to_file(struct picture *pic, const char *path, const struct save_options *options){
+    materialise_picture(pic);
+    if( is_raw_picture_path(path) ){
+      return save_raw_picture(pic, path);
+    }
+    // the encoder reads the stored rows directly
+    return save_pixels(pic->data, pic->width, pic->height, pic->stride, path, options);
   }
 
   // enum mapping to support get/set pixel functions
   enum RGB {RED, GREEN, BLUE};
 
+  // find where pixel (x, y) of the oriented picture is stored
+  static unsigned char *stored_pixel(struct picture *pic, int x, int y){
+    int u = pic->orientation & ORIENT_TRANSPOSE ? y : x;
+    int v = pic->orientation & ORIENT_TRANSPOSE ? x : y;
+    if( pic->orientation & ORIENT_MIRROR_X ) u = pic->width - 1 - u;
+    if( pic->orientation & ORIENT_MIRROR_Y ) v = pic->height - 1 - v;
+    return get_row(pic, v) + u * PIXEL_CHANNELS;
+  }
+
   struct pixel get_pixel(struct picture *pic, int x, int y){
     // Beware: pixels are stored in a (x,y) vector from the top left of the image.
+    // Coordinates outside the picture are clamped to its nearest edge.
+    int width = oriented_width(pic);
+    int height = oriented_height(pic);
+    if( x < 0 ) x = 0;
+    if( x >= width ) x = width - 1;
+    if( y < 0 ) y = 0;
+    if( y >= height ) y = height - 1;
+
+    const unsigned char *p = stored_pixel(pic, x, y);
     struct pixel pix;
-    
-    pix.red = get_pixel_value(pic->img, RED, x, y);
-    pix.green = get_pixel_value(pic->img, GREEN, x, y);
-    pix.blue = get_pixel_value(pic->img, BLUE, x, y);
-    
+
+    pix.red = p[RED];
+    pix.green = p[GREEN];
+    pix.blue = p[BLUE];
+
     return pix;
   }
 
   void set_pixel(struct picture *pic, int x, int y, struct pixel *rgb){
     // Beware: pixels are stored in a (x,y) vector from the top left of the image.
-    set_pixel_value(pic->img, RED, x, y, rgb->red);
-    set_pixel_value(pic->img, GREEN, x, y, rgb->green);
-    set_pixel_value(pic->img, BLUE, x, y, rgb->blue);
+    if( !contains_point(pic, x, y) ){
+      return;
+    }
+    unsigned char *p = stored_pixel(pic, x, y);
+
+    p[RED] = rgb->red;
+    p[GREEN] = rgb->green;
+    p[BLUE] = rgb->blue;
+  }
+
+  unsigned char *get_row(struct picture *pic, int y){
+    return pic->data + (size_t) y * pic->stride;
+  }
+
+  void read_row(struct picture *pic, int y, unsigned char *buf){
+    memcpy(buf, get_row(pic, y), pic->width * PIXEL_CHANNELS);
+  }
+
+  void write_row(struct picture *pic, int y, const unsigned char *buf){
+    memcpy(get_row(pic, y), buf, pic->width * PIXEL_CHANNELS);
   }
 
   bool contains_point(struct picture *pic, int x, int y){
-      return x >= 0 && x < pic->width && y >= 0 && y < pic->height;
+      return x >= 0 && x < oriented_width(pic) && y >= 0 && y < oriented_height(pic);
   }
-  
+
   void clear_picture(struct picture *pic){
-    free_image(pic->img); 
-  }  
+    if( pic->mapping != NULL ){
+      sod_vfs_unmap(pic->mapping, pic->mapping_size);
+      pic->mapping = NULL;
+    } else {
+      release_buffer(pic->data);
+    }
+    pic->data = NULL;
+  }
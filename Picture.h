@@ -4,6 +4,9 @@
 #include "Utils.h"
 #include <stdbool.h>
 
+  // number of interleaved colour channels stored per pixel (R, G, B)
+  #define PIXEL_CHANNELS 3
+
   // The pixel struct is used to represent a pixel of an image in RGB format
   struct pixel {
     int red;
@@ -11,34 +14,92 @@
     int blue;
   };
 
-  // The picture struct provides a wrapper for image manipulation 
-  // via the SOD library (https://sod.pixlab.io/intro.html)
-  struct picture {    
-    // sod representation of an image
-    sod_img img;
+  // An orientation is one of the 8 symmetries of a rectangle, describing
+  // where each pixel of a picture is stored: pixel (x, y) of the picture is
+  // found by swapping x and y if ORIENT_TRANSPOSE is set, then mirroring
+  // that position left to right in the stored pixels if ORIENT_MIRROR_X is
+  // set and top to bottom if ORIENT_MIRROR_Y is set.
+  enum orientation {
+    ORIENT_IDENTITY = 0,
+    ORIENT_TRANSPOSE = 1,
+    ORIENT_MIRROR_X = 2,
+    ORIENT_MIRROR_Y = 4,
+    // named symmetries, as applied by rotate_picture and flip_picture
+    ORIENT_FLIP_H = ORIENT_MIRROR_X,
+    ORIENT_FLIP_V = ORIENT_MIRROR_Y,
+    ORIENT_ROTATE_90 = ORIENT_TRANSPOSE | ORIENT_MIRROR_Y,
+    ORIENT_ROTATE_180 = ORIENT_MIRROR_X | ORIENT_MIRROR_Y,
+    ORIENT_ROTATE_270 = ORIENT_TRANSPOSE | ORIENT_MIRROR_X,
+    ORIENT_TRANSVERSE = ORIENT_TRANSPOSE | ORIENT_MIRROR_X | ORIENT_MIRROR_Y
+  };
+
+  // The picture struct stores an image as a contiguous, row-major buffer of
+  // interleaved 8-bit RGB pixels. The SOD library (https://sod.pixlab.io/intro.html)
+  // is only used to decode and encode image files.
+  struct picture {
+    // pixel data, starting from the top left of the stored image
+    unsigned char *data;
+    // size of the stored image, which is transposed if orientation says so
     int width;
     int height;
-  };    
-      
-  // initialise picture struct with image from a provided file
-  bool init_picture_from_file(struct picture *pic, const char *path);
+    // distance in bytes between the starts of two consecutive rows
+    int stride;
+    // pending rotation or flip of the stored pixels, applied only when the
+    // pixels are needed in picture order (see Orientation.h)
+    enum orientation orientation;
+    // memory map of the raw picture file that data points into, when the
+    // picture was loaded from one without copying (see RawPicture.h), or
+    // NULL when data is a buffer taken from the buffer pool
+    void *mapping;
+    size_t mapping_size;
+  };
+
+  // initialise picture struct with image from a provided file, reduced to
+  // 1/scale of its width and height (scale being 1, 2, 4 or 8); a raw
+  // picture file is mapped into memory rather than read, and can only be
+  // loaded at scale 1
+  bool init_picture_from_file(struct picture *pic, const char *path, int scale);
+
+  // initialise picture struct of the specified size
+  bool init_picture_from_size(struct picture *pic, int width, int height);
 
-  // initialise picture struct of the specified size 
-  bool init_picture_from_size(struct picture *pic, int width, int height); 
+  // initialise picture struct of the specified size without clearing it, for
+  // callers that are about to overwrite every pixel
+  bool init_picture_for_overwrite(struct picture *pic, int width, int height);
 
-  // save picture to specified file
-  bool save_picture_to_file(struct picture *pic, const char *path);
+  // initialise picture struct as a copy of another picture
+  bool init_picture_from_copy(struct picture *pic, struct picture *src);
 
-  // extract a single pixel from the image as a colour struct
+  // save picture to specified file, applying its orientation first; a path
+  // ending in RAW_PICTURE_EXTENSION gets a raw picture file, and any other a
+  // file in the format of its extension (see image_format_for_path) encoded
+  // as the options say (DEFAULT_SAVE_OPTIONS if NULL)
+  bool save_picture_to_file(struct picture *pic, const char *path, const struct save_options *options);
+
+  // extract a single pixel from the image as a colour struct, taking the
+  // picture's orientation into account
   struct pixel get_pixel(struct picture *pic, int x, int y);
 
-  // set a single pixel in the image from a colour struct
+  // set a single pixel in the image from a colour struct, taking the
+  // picture's orientation into account
   void set_pixel(struct picture *pic, int x, int y, struct pixel *rgb);
 
-  // check if coordinates are within bounds of the stored image
+  // get a pointer to the first pixel of stored row y, which is followed by
+  // the rest of the row as width * PIXEL_CHANNELS interleaved bytes; the row
+  // functions work on the stored pixels, whatever the picture's orientation
+  unsigned char *get_row(struct picture *pic, int y);
+
+  // copy row y of the picture into a buffer of width * PIXEL_CHANNELS bytes
+  void read_row(struct picture *pic, int y, unsigned char *buf);
+
+  // overwrite row y of the picture from a buffer of width * PIXEL_CHANNELS bytes
+  void write_row(struct picture *pic, int y, const unsigned char *buf);
+
+  // check if coordinates are within bounds of the (oriented) image
   bool contains_point(struct picture *pic, int x, int y);
-  
-  // clean up the underlying image representation
+
+  // clean up the underlying image representation, returning its pixel buffer
+  // to the buffer pool for reuse by later pictures (or unmapping its file)
   void clear_picture(struct picture *pic);
 
 #endif
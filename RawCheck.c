@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include "Utils.h"
+#include "Picture.h"
+#include "RawPicture.h"
+
+  int main(int argc, char ** argv){
+
+    if(argc != 2){
+      printf("usage: ./raw_picture_check <raw_file_path>\n");
+      return 1;
+    }
+
+    const char * filename = argv[1];
+
+    printf("check %s is loaded in place:\n", filename);
+
+    struct picture pic;
+    if(!load_raw_picture(&pic, filename)){
+      return 1;
+    }
+
+    // a raw picture loaded in place reads its pixels straight from the mapped
+    // file, rather than from a copy of them
+    bool mapped = pic.mapping != NULL;
+    clear_picture(&pic);
+
+    if(!mapped){
+      printf("[!] fail - pixels were copied out of the file\n");
+      return 1;
+    }
+
+    printf("success - pixels are mapped from the file!\n");
+    return 0;
+
+  }
@@ -0,0 +1,144 @@
+#include "RawPicture.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Offsets of the header fields (see RawPicture.h). */
+#define MAGIC_SIZE 8
+#define FIELD_DATA_OFFSET 8
+#define FIELD_WIDTH 12
+#define FIELD_HEIGHT 16
+#define FIELD_CHANNELS 20
+#define FIELD_STRIDE 24
+#define FIELD_PIXEL_TYPE 28
+
+/* Appended to the path of a raw picture file while it is being written. */
+#define RAW_TMP_SUFFIX ".tmp"
+
+static void put_field(unsigned char *header, int offset, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        header[offset + i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static uint32_t get_field(const unsigned char *header, int offset) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t) header[offset + i] << (8 * i);
+    }
+    return value;
+}
+
+bool is_raw_picture_path(const char *path) {
+    return has_extension(path, RAW_PICTURE_EXTENSION);
+}
+
+bool save_raw_picture(struct picture *pic, const char *path) {
+    int row_bytes = pic->width * PIXEL_CHANNELS;
+    int stride = (row_bytes + RAW_ALIGNMENT - 1) & ~(RAW_ALIGNMENT - 1);
+
+    unsigned char header[RAW_HEADER_SIZE] = {0};
+    memcpy(header, RAW_MAGIC, MAGIC_SIZE);
+    put_field(header, FIELD_DATA_OFFSET, RAW_HEADER_SIZE);
+    put_field(header, FIELD_WIDTH, pic->width);
+    put_field(header, FIELD_HEIGHT, pic->height);
+    put_field(header, FIELD_CHANNELS, PIXEL_CHANNELS);
+    put_field(header, FIELD_STRIDE, stride);
+    put_field(header, FIELD_PIXEL_TYPE, RAW_PIXEL_U8);
+
+    // the file is written under a name of its own and only then moved over the path, since the picture
+    // may still be reading its pixels from a mapping of the file it replaces
+    char *tmp_path = malloc(strlen(path) + sizeof RAW_TMP_SUFFIX);
+    FILE *file = NULL;
+    if (tmp_path != NULL) {
+        strcat(strcpy(tmp_path, path), RAW_TMP_SUFFIX);
+        file = fopen(tmp_path, "wb");
+    }
+    if (file == NULL) {
+        printf("[!] error saving file to %s\n", path);
+        free(tmp_path);
+        return false;
+    }
+
+    // the padding of each row, and the slack after the last one, are written as zeros rather than
+    // whatever the picture's buffer holds there
+    static const unsigned char zeros[RAW_ALIGNMENT] = {0};
+    bool ok = fwrite(header, 1, RAW_HEADER_SIZE, file) == RAW_HEADER_SIZE;
+    for (int y = 0; ok && y < pic->height; y++) {
+        ok = fwrite(get_row(pic, y), 1, row_bytes, file) == (size_t) row_bytes &&
+             fwrite(zeros, 1, stride - row_bytes, file) == (size_t) (stride - row_bytes);
+    }
+    ok = ok && fwrite(zeros, 1, RAW_ALIGNMENT, file) == RAW_ALIGNMENT;
+    ok &= fclose(file) == 0;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        printf("[!] error saving file to %s\n", path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    return ok;
+}
+
+/* Copies the rows of a mapped raw picture file that can't be used in place into a new picture. */
+static bool copy_raw_pixels(struct picture *pic, const unsigned char *pixels, int width, int height, size_t stride) {
+    if (!init_picture_for_overwrite(pic, width, height)) {
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        write_row(pic, y, pixels + y * stride);
+    }
+    return true;
+}
+
+bool load_raw_picture(struct picture *pic, const char *path) {
+    void *map;
+    size_t size;
+    pic->data = NULL;
+    pic->mapping = NULL;
+    if (sod_vfs_mmap(path, &map, &size) != SOD_OK) {
+        printf("[!] error reading from file %s (check it exists)\n", path);
+        return false;
+    }
+
+    const unsigned char *header = map;
+    size_t offset = 0, stride = 0, width = 0, height = 0;
+    bool valid = size >= RAW_HEADER_SIZE && memcmp(header, RAW_MAGIC, MAGIC_SIZE) == 0;
+    if (valid) {
+        offset = get_field(header, FIELD_DATA_OFFSET);
+        width = get_field(header, FIELD_WIDTH);
+        height = get_field(header, FIELD_HEIGHT);
+        stride = get_field(header, FIELD_STRIDE);
+        valid = get_field(header, FIELD_CHANNELS) == PIXEL_CHANNELS &&
+                get_field(header, FIELD_PIXEL_TYPE) == RAW_PIXEL_U8 &&
+                width > 0 && height > 0 && width <= INT32_MAX / PIXEL_CHANNELS && height <= INT32_MAX &&
+                stride >= width * PIXEL_CHANNELS && stride <= INT32_MAX && offset >= RAW_HEADER_SIZE &&
+                offset <= size && size - offset >= width * PIXEL_CHANNELS &&
+                (size - offset - width * PIXEL_CHANNELS) / stride >= height - 1;
+    }
+    if (!valid) {
+        printf("[!] %s is not a raw picture file of 8-bit RGB pixels\n", path);
+        sod_vfs_unmap(map, size);
+        return false;
+    }
+
+    // the picture can use the mapped pixels as they are when they are laid out as in its own buffer,
+    // with the slack after the last row for loads running past its end
+    const unsigned char *pixels = header + offset;
+    if (offset % RAW_ALIGNMENT == 0 && stride % RAW_ALIGNMENT == 0 &&
+        size - offset >= height * stride + RAW_ALIGNMENT) {
+        pic->data = (unsigned char *) pixels;
+        pic->width = width;
+        pic->height = height;
+        pic->stride = stride;
+        pic->orientation = ORIENT_IDENTITY;
+        pic->mapping = map;
+        pic->mapping_size = size;
+        return true;
+    }
+
+    bool copied = copy_raw_pixels(pic, pixels, width, height, stride);
+    sod_vfs_unmap(map, size);
+    if (!copied) {
+        printf("[!] out of memory loading %s\n", path);
+    }
+    return copied;
+}
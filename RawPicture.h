@@ -0,0 +1,43 @@
+#ifndef RAWPICTURE_H
+#define RAWPICTURE_H
+
+#include "Picture.h"
+
+/* Raw picture files hold the stored pixels of a picture uncompressed, laid out as in memory, so that
+ * intermediate pictures can be passed between runs without the cost and loss of a JPEG encode and
+ * decode. A file is a RAW_HEADER_SIZE byte header of little-endian 32-bit fields:
+ *
+ *     offset  field
+ *     0       magic, the 8 bytes of RAW_MAGIC
+ *     8       offset of the pixels from the start of the file
+ *     12      width
+ *     16      height
+ *     20      channels per pixel (PIXEL_CHANNELS)
+ *     24      stride, the distance in bytes between the starts of two rows
+ *     28      pixel type (RAW_PIXEL_U8, one unsigned byte per channel)
+ *
+ * padded with zeros up to the pixels, which are followed by RAW_ALIGNMENT bytes of slack. The pixels
+ * and each row start on a multiple of RAW_ALIGNMENT from the start of the file, as they would in a
+ * picture's own buffer. */
+#define RAW_PICTURE_EXTENSION ".tcraw"
+#define RAW_MAGIC "TCRAW\0\0\1"
+#define RAW_HEADER_SIZE 64
+#define RAW_ALIGNMENT 64
+#define RAW_PIXEL_U8 1
+
+/* Checks whether a path names a raw picture file, by its extension. */
+bool is_raw_picture_path(const char *path);
+
+/* Writes the stored pixels of a picture, whose orientation must have been applied, to a raw picture
+ * file. The file replaces any at the path only once it is complete, so a picture can be saved over
+ * the file it was loaded from. Returns false, after reporting it, if the file can't be written. */
+bool save_raw_picture(struct picture *pic, const char *path);
+
+/* Initialises a picture from a raw picture file without reading it: the file is mapped into memory
+ * copy-on-write and the picture's pixels point into the mapping, so pages are only read when first
+ * touched and changes to the picture never reach the file. A file whose rows are not aligned as a
+ * picture's would be is copied into a new picture instead. Returns false, after reporting it, if the
+ * file can't be mapped or is not a raw picture of 8-bit RGB pixels. */
+bool load_raw_picture(struct picture *pic, const char *path);
+
+#endif
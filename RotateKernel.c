@@ -0,0 +1,276 @@
+#include "RotateKernel.h"
+#include "CpuFeatures.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROTATE_X86
+#include <immintrin.h>
+#endif
+
+// bytes per interleaved RGB pixel
+#define PIXEL_STEP 3
+
+// pixels reversed at once by the vector kernel: 48 bytes, three vectors
+#define BLOCK_PIXELS 16
+
+typedef void (*reverse_swap_fn)(unsigned char *a, unsigned char *b, int width);
+typedef void (*transpose_fn)(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                             ptrdiff_t dst_stride, int width, int height);
+
+// exchange pixel x of a with pixel width - 1 - x of b, for x in [begin, end)
+static void reverse_swap_range(unsigned char *a, unsigned char *b, int width, int begin, int end){
+  for(int x = begin; x < end; x++){
+    unsigned char *p = a + x * PIXEL_STEP;
+    unsigned char *q = b + (width - 1 - x) * PIXEL_STEP;
+    unsigned char tmp[PIXEL_STEP];
+    memcpy(tmp, p, PIXEL_STEP);
+    memcpy(p, q, PIXEL_STEP);
+    memcpy(q, tmp, PIXEL_STEP);
+  }
+}
+
+// within one row only the first half of the pixels is exchanged with the second
+static int pixels_to_swap(unsigned char *a, unsigned char *b, int width){
+  return a == b ? width / 2 : width;
+}
+
+static void reverse_swap_scalar(unsigned char *a, unsigned char *b, int width){
+  reverse_swap_range(a, b, width, 0, pixels_to_swap(a, b, width));
+}
+
+// transpose the source pixels in columns [x_begin, x_end) of rows [y_begin, y_end)
+static void transpose_range(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                            ptrdiff_t dst_stride, int x_begin, int x_end, int y_begin, int y_end){
+  for(int y = y_begin; y < y_end; y++){
+    const unsigned char *row = src + y * src_stride;
+    for(int x = x_begin; x < x_end; x++){
+      memcpy(dst + x * dst_stride + y * PIXEL_STEP, row + x * PIXEL_STEP, PIXEL_STEP);
+    }
+  }
+}
+
+// transpose the pixels left over around the whole blocks in the top left
+// width_in_blocks x height_in_blocks pixels of the source
+static void transpose_edges(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                            ptrdiff_t dst_stride, int width, int height,
+                            int width_in_blocks, int height_in_blocks){
+  transpose_range(src, src_stride, dst, dst_stride, width_in_blocks, width, 0, height);
+  transpose_range(src, src_stride, dst, dst_stride, 0, width_in_blocks, height_in_blocks, height);
+}
+
+static void transpose_scalar(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                             ptrdiff_t dst_stride, int width, int height){
+  transpose_range(src, src_stride, dst, dst_stride, 0, width, 0, height);
+}
+
+#ifdef ROTATE_X86
+
+// Reverse the order of the 16 pixels in the 48 bytes at src into dst. Each
+// output vector gathers its bytes from two overlapping loads inside the
+// block, so that pixels never straddle a store and nothing outside the
+// block is read or written.
+__attribute__((target("ssse3")))
+static inline void reverse_block_ssse3(const unsigned char *src, __m128i *out){
+  const __m128i lo0 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14);
+  const __m128i hi0 = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, -1);
+  const __m128i lo1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14, 15);
+  const __m128i hi1 = _mm_setr_epi8(14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, -1, -1);
+  const __m128i lo2 = _mm_setr_epi8(-1, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2);
+  const __m128i hi2 = _mm_setr_epi8(15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+  out[0] = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 16)), lo0),
+                        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 32)), hi0));
+  out[1] = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 1)), lo1),
+                        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 17)), hi1));
+  out[2] = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), lo2),
+                        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 2)), hi2));
+}
+
+__attribute__((target("ssse3")))
+static void reverse_swap_ssse3(unsigned char *a, unsigned char *b, int width){
+  int n = pixels_to_swap(a, b, width);
+  int x = 0;
+  for(; x + BLOCK_PIXELS <= n; x += BLOCK_PIXELS){
+    unsigned char *p = a + x * PIXEL_STEP;
+    unsigned char *q = b + (width - x - BLOCK_PIXELS) * PIXEL_STEP;
+    // both blocks are read before either is written
+    __m128i from_p[3], from_q[3];
+    reverse_block_ssse3(p, from_p);
+    reverse_block_ssse3(q, from_q);
+    for(int v = 0; v < 3; v++){
+      _mm_storeu_si128((__m128i *) (p + 16 * v), from_q[v]);
+      _mm_storeu_si128((__m128i *) (q + 16 * v), from_p[v]);
+    }
+  }
+  reverse_swap_range(a, b, width, x, n);
+}
+
+// Widen 4 pixels (12 bytes, read as 16) to one pixel per 32-bit lane, and back.
+__attribute__((target("ssse3")))
+static inline __m128i load_pixels_ssse3(const unsigned char *p){
+  const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p), widen);
+}
+
+__attribute__((target("ssse3")))
+static inline void store_pixels_ssse3(unsigned char *p, __m128i v){
+  const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  __m128i packed = _mm_shuffle_epi8(v, narrow);
+  int last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+  _mm_storel_epi64((__m128i *) p, packed);
+  memcpy(p + 8, &last, 4);
+}
+
+__attribute__((target("ssse3")))
+static void transpose_ssse3(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                            ptrdiff_t dst_stride, int width, int height){
+  int width_in_blocks = width & ~3;
+  int height_in_blocks = height & ~3;
+  for(int y = 0; y < height_in_blocks; y += 4){
+    for(int x = 0; x < width_in_blocks; x += 4){
+      const unsigned char *s = src + y * src_stride + x * PIXEL_STEP;
+      __m128i r0 = load_pixels_ssse3(s);
+      __m128i r1 = load_pixels_ssse3(s + src_stride);
+      __m128i r2 = load_pixels_ssse3(s + 2 * src_stride);
+      __m128i r3 = load_pixels_ssse3(s + 3 * src_stride);
+
+      // 4x4 transpose of 32-bit lanes
+      __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+      __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+      __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+      __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+      unsigned char *d = dst + x * dst_stride + y * PIXEL_STEP;
+      store_pixels_ssse3(d, _mm_unpacklo_epi64(t0, t2));
+      store_pixels_ssse3(d + dst_stride, _mm_unpackhi_epi64(t0, t2));
+      store_pixels_ssse3(d + 2 * dst_stride, _mm_unpacklo_epi64(t1, t3));
+      store_pixels_ssse3(d + 3 * dst_stride, _mm_unpackhi_epi64(t1, t3));
+    }
+  }
+  transpose_edges(src, src_stride, dst, dst_stride, width, height, width_in_blocks, height_in_blocks);
+}
+
+// Widen 8 pixels (24 bytes, read as 32) to one pixel per 32-bit lane, and
+// back: the first 4 pixels go to the low 128-bit lane and the rest to the
+// high one, since byte shuffles cannot cross lanes.
+__attribute__((target("avx2")))
+static inline __m256i load_pixels_avx2(const unsigned char *p){
+  const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+  const __m256i widen = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                         0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  __m256i v = _mm256_loadu_si256((const __m256i *) p);
+  return _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(v, spread), widen);
+}
+
+__attribute__((target("avx2")))
+static inline void store_pixels_avx2(unsigned char *p, __m256i v){
+  const __m256i narrow = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, narrow), gather);
+  _mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(packed));
+  _mm_storel_epi64((__m128i *) (p + 16), _mm256_extracti128_si256(packed, 1));
+}
+
+__attribute__((target("avx2")))
+static void transpose_avx2(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                           ptrdiff_t dst_stride, int width, int height){
+  int width_in_blocks = width & ~7;
+  int height_in_blocks = height & ~7;
+  for(int y = 0; y < height_in_blocks; y += 8){
+    for(int x = 0; x < width_in_blocks; x += 8){
+      const unsigned char *s = src + y * src_stride + x * PIXEL_STEP;
+      __m256i r[8];
+      for(int i = 0; i < 8; i++){
+        r[i] = load_pixels_avx2(s + i * src_stride);
+      }
+
+      // 8x8 transpose of 32-bit lanes: 4x4 within each 128-bit lane, then swap the off-diagonal halves
+      __m256i t[8], u[8];
+      for(int i = 0; i < 8; i += 2){
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+      }
+      for(int i = 0; i < 8; i += 4){
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+      }
+
+      unsigned char *d = dst + x * dst_stride + y * PIXEL_STEP;
+      for(int i = 0; i < 4; i++){
+        store_pixels_avx2(d + i * dst_stride, _mm256_permute2x128_si256(u[i], u[i + 4], 0x20));
+        store_pixels_avx2(d + (i + 4) * dst_stride, _mm256_permute2x128_si256(u[i], u[i + 4], 0x31));
+      }
+    }
+  }
+  transpose_edges(src, src_stride, dst, dst_stride, width, height, width_in_blocks, height_in_blocks);
+}
+
+#endif
+
+// implementations from fastest to slowest; the AVX2 one reverses rows with SSSE3
+static const struct {
+  const char *name;
+  reverse_swap_fn reverse_swap;
+  transpose_fn transpose;
+} kernels[] = {
+#ifdef ROTATE_X86
+  {"avx2", reverse_swap_ssse3, transpose_avx2},
+  {"ssse3", reverse_swap_ssse3, transpose_ssse3},
+#endif
+  {"scalar", reverse_swap_scalar, transpose_scalar}
+};
+
+static int no_of_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static int kernel_index;
+
+static bool kernel_supported(int index){
+#ifdef ROTATE_X86
+  if(kernels[index].transpose == transpose_avx2){
+    return cpu_has_avx2();
+  }
+  if(kernels[index].transpose == transpose_ssse3){
+    return cpu_has_ssse3();
+  }
+#endif
+  return true;
+}
+
+static void select_kernel(void){
+  kernel_index = 0;
+  while(!kernel_supported(kernel_index)){
+    kernel_index++;
+  }
+}
+
+void reverse_swap_pixels(unsigned char *a, unsigned char *b, int width){
+  pthread_once(&kernel_once, select_kernel);
+  kernels[kernel_index].reverse_swap(a, b, width);
+}
+
+void transpose_pixels(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                      ptrdiff_t dst_stride, int width, int height){
+  pthread_once(&kernel_once, select_kernel);
+  kernels[kernel_index].transpose(src, src_stride, dst, dst_stride, width, height);
+}
+
+const char *rotate_kernel_name(void){
+  pthread_once(&kernel_once, select_kernel);
+  return kernels[kernel_index].name;
+}
+
+bool use_rotate_kernel(const char *name){
+  pthread_once(&kernel_once, select_kernel);
+  for(int i = 0; i < no_of_kernels; i++){
+    if(strcmp(kernels[i].name, name) == 0 && kernel_supported(i)){
+      kernel_index = i;
+      return true;
+    }
+  }
+  return false;
+}
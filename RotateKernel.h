@@ -0,0 +1,31 @@
+#ifndef ROTATEKERNEL_H
+#define ROTATEKERNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+  // Exchange the pixels of two rows of width interleaved RGB pixels end for
+  // end, so that a ends up holding b reversed and b holding a reversed. When
+  // a and b are the same row it is reversed in place. The implementation
+  // (SSSE3 or scalar) is chosen on first use from the CPU features reported
+  // by cpuid.
+  void reverse_swap_pixels(unsigned char *a, unsigned char *b, int width);
+
+  // Transpose a block of interleaved RGB pixels, height rows of width pixels,
+  // so that pixel x of source row y becomes pixel y of destination row x.
+  // Either stride may be negative to walk its rows upwards, which turns the
+  // transpose into a rotation. Up to 8 bytes past the end of each source
+  // row may be read (but not used), as the picture buffers allow. The
+  // implementation (AVX2 8x8, SSSE3 4x4 or scalar) is chosen along with
+  // that of reverse_swap_pixels.
+  void transpose_pixels(const unsigned char *src, ptrdiff_t src_stride, unsigned char *dst,
+                        ptrdiff_t dst_stride, int width, int height);
+
+  // name of the implementation used by reverse_swap_pixels and transpose_pixels
+  const char *rotate_kernel_name(void);
+
+  // make both functions use the named implementation ("avx2", "ssse3" or
+  // "scalar") instead, returning false if this CPU does not support it
+  bool use_rotate_kernel(const char *name);
+
+#endif
@@ -4,6 +4,13 @@
 #include "Utils.h"
 #include "Picture.h"
 #include "PicProcess.h"
+#include "Orientation.h"
+#include "JpegTransform.h"
+#include "PicStream.h"
+#include "RawPicture.h"
+
+  // largest radius accepted by blur (keeps the box sums well within an int)
+  #define MAX_BLUR_RADIUS 1000
 
   // list of all possible picture transformations
   static char *cmd_strings[] = { 
@@ -12,7 +19,9 @@
     "rotate",
     "flip",
     "blur",
-    "parallel-blur"
+    "parallel-blur",
+    "tiled-blur",
+    "shrink"
   };
 
 // -------------- picture transformation function wrappers -------------- \\
@@ -39,9 +48,19 @@
     flip_picture(pic, plane);
   }
 
-  void blur_picture_wrapper(struct picture *pic, const char *unused){
-    printf("calling blur\n");
-    blur_picture(pic);
+  void blur_picture_wrapper(struct picture *pic, const char *extra_arg){
+    if(extra_arg == NULL){
+      printf("calling blur\n");
+      blur_picture(pic);
+      return;
+    }
+    int radius = atoi(extra_arg);
+    if(radius < 1 || radius > MAX_BLUR_RADIUS){
+      printf("[!] blur is undefined for radius %s (must be between 1 and %i)\n", extra_arg, MAX_BLUR_RADIUS);
+      exit(IO_ERROR);
+    }
+    printf("calling blur (%i)\n", radius);
+    box_blur_picture(pic, radius);
   }
   
   void parallel_blur_wrapper(struct picture *pic, const char *unused){
@@ -49,6 +68,17 @@
     parallel_blur_picture(pic);
   }
 
+  void tiled_blur_wrapper(struct picture *pic, const char *unused){
+    printf("calling tiled blur\n");
+    blur_picture_tiled(pic);
+  }
+
+  void shrink_picture_wrapper(struct picture *pic, const char *extra_arg){
+    int factor = atoi(extra_arg);
+    printf("calling shrink (%i)\n", factor);
+    shrink_picture(pic, factor);
+  }
+
 // ------------------------------------------------------------------------ \\
 
   // function pointer look-up table for picture transformation functions
@@ -58,12 +88,191 @@
     rotate_picture_wrapper,
     flip_picture_wrapper,
     blur_picture_wrapper,
-    parallel_blur_wrapper
+    parallel_blur_wrapper,
+    tiled_blur_wrapper,
+    shrink_picture_wrapper
   };
 
   // size of look-up table (for safe IO error reporting)
   static int no_of_cmds = sizeof(cmds) / sizeof(cmds[0]);
 
+  // kinds of argument taken by each picture transformation (same order as cmd_strings)
+  enum arg_kind {NO_ARG, REQUIRED_ARG, OPTIONAL_NUMBER_ARG};
+  static const enum arg_kind cmd_args[] = {
+    NO_ARG,
+    NO_ARG,
+    REQUIRED_ARG,
+    REQUIRED_ARG,
+    OPTIONAL_NUMBER_ARG,
+    NO_ARG,
+    NO_ARG,
+    REQUIRED_ARG
+  };
+
+  // indices of the transformations that only need a few rows at a time (besides flip and blur)
+  #define INVERT_CMD 0
+  #define GRAYSCALE_CMD 1
+  #define PARALLEL_BLUR_CMD 5
+  #define TILED_BLUR_CMD 6
+
+  // indices of rotate and flip in the look-up tables (these only reorient the picture)
+  #define ROTATE_CMD 2
+  #define FLIP_CMD 3
+
+  // index of blur in the look-up tables (consecutive plain blurs are fused)
+  #define BLUR_CMD 4
+
+  // index of shrink in the look-up tables (with --fast-shrink, leading shrinks are applied while loading)
+  #define SHRINK_CMD 7
+
+  // largest reduction the decoder can apply while loading a picture
+  #define MAX_LOAD_SCALE 8
+
+  // a picture transformation requested on the command line
+  struct command {
+    int cmd_no;
+    const char *arg;
+  };
+
+  // check whether a command line argument is a (possibly negative) integer
+  static bool is_number(const char *arg){
+    if(*arg == '-'){
+      arg++;
+    }
+    if(*arg == '\0'){
+      return false;
+    }
+    while(*arg >= '0' && *arg <= '9'){
+      arg++;
+    }
+    return *arg == '\0';
+  }
+
+  // identify the sequence of picture transformations in argv[first..argc),
+  // returning how many were found; the save options (--quality <1-100>,
+  // --subsample and --fast-png), --stream and --fast-shrink may appear
+  // anywhere among them
+  static int parse_commands(int argc, char **argv, int first, struct command *commands,
+                            struct save_options *options, bool *stream, bool *fast_shrink){
+    int no_of_commands = 0;
+    int i = first;
+    while(i < argc){
+      const char *process = argv[i++];
+
+      if(!strcmp(process, "--quality")){
+        int quality = i < argc && is_number(argv[i]) ? atoi(argv[i]) : 0;
+        if(quality < MIN_SAVE_QUALITY || quality > MAX_SAVE_QUALITY){
+          printf("[!] --quality requires a number between %i and %i\n    aborting...\n",
+                 MIN_SAVE_QUALITY, MAX_SAVE_QUALITY);
+          exit(IO_ERROR);
+        }
+        options->quality = quality;
+        i++;
+        continue;
+      }
+      if(!strcmp(process, "--subsample")){
+        options->subsample_chroma = true;
+        continue;
+      }
+      if(!strcmp(process, "--fast-png")){
+        options->png_level = FAST_PNG_LEVEL;
+        options->png_filter = PNG_UP_FILTER;
+        continue;
+      }
+      if(!strcmp(process, "--stream")){
+        *stream = true;
+        continue;
+      }
+      if(!strcmp(process, "--fast-shrink")){
+        *fast_shrink = true;
+        continue;
+      }
+
+      int cmd_no = 0;
+      while(cmd_no < no_of_cmds && strcmp(process, cmd_strings[cmd_no])){
+        cmd_no++;
+      }
+  
+      // IO error check
+      if(cmd_no == no_of_cmds){
+        printf("[!] invalid process requested: %s is not defined\n    aborting...\n", process);  
+        exit(IO_ERROR);   
+      }
+
+      // take this process's argument, if it has one
+      const char *arg = NULL;
+      if(cmd_args[cmd_no] == REQUIRED_ARG){
+        if(i == argc){
+          printf("[!] %s requires an extra argument\n    aborting...\n", process);
+          exit(IO_ERROR);
+        }
+        arg = argv[i++];
+      } else if(cmd_args[cmd_no] == OPTIONAL_NUMBER_ARG && i < argc && is_number(argv[i])){
+        arg = argv[i++];
+      }
+
+      commands[no_of_commands].cmd_no = cmd_no;
+      commands[no_of_commands].arg = arg;
+      no_of_commands++;
+    }
+    return no_of_commands;
+  }
+
+  // check whether a picture saved to the path is encoded as a JPEG file
+  static bool saves_as_jpeg(const char *path){
+    return !is_raw_picture_path(path) && image_format_for_path(path) == FORMAT_JPEG;
+  }
+
+  // check whether every command only rotates or flips the picture
+  static bool only_reorients(struct command *commands, int no_of_commands){
+    for(int c = 0; c < no_of_commands; c++){
+      if(commands[c].cmd_no != ROTATE_CMD && commands[c].cmd_no != FLIP_CMD){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // check whether a command is a blur without a radius
+  static bool is_plain_blur(struct command *command){
+    return command->cmd_no == BLUR_CMD && command->arg == NULL;
+  }
+
+  // find the op applying each command to a picture as it streams past, returning false if
+  // any of them needs more of the picture than a few rows at a time
+  static bool find_stream_ops(struct command *commands, int no_of_commands, enum stream_op *ops){
+    for(int c = 0; c < no_of_commands; c++){
+      const char *arg = commands[c].arg;
+      switch(commands[c].cmd_no){
+        case INVERT_CMD:
+          ops[c] = STREAM_INVERT;
+          break;
+        case GRAYSCALE_CMD:
+          ops[c] = STREAM_GRAYSCALE;
+          break;
+        case FLIP_CMD:
+          if(arg[0] != 'H'){
+            return false;
+          }
+          ops[c] = STREAM_FLIP_H;
+          break;
+        case BLUR_CMD:
+          // a blur of radius 1 is the plain blur
+          if(arg != NULL && atoi(arg) != 1){
+            return false;
+          }
+          ops[c] = STREAM_BLUR;
+          break;
+        case PARALLEL_BLUR_CMD:
+        case TILED_BLUR_CMD:
+          ops[c] = STREAM_BLUR;
+          break;
+        default:
+          return false;
+      }
+    }
+    return true;
+  }
 
 // ---------- MAIN PROGRAM ---------- \\
 
@@ -74,44 +283,114 @@
     // capture and check command line arguments
     const char * filename = argv[1];
     const char * target_file = argv[2];
-    const char * process = argv[3];
-    const char * extra_arg = argv[4];
     
-    if(filename == NULL || target_file == NULL || process == NULL){
+    if(filename == NULL || target_file == NULL || argc < 4){
       printf("[!] insufficient command line arguments provided\n");
       exit(IO_ERROR);
     }        
   
     printf("  filename  = %s\n", filename);
     printf("  target    = %s\n", target_file);
-    printf("  process   = %s\n", process);
-    printf("  extra arg = %s\n", extra_arg);
+
+    // identify the picture transformations to run, in order, and how to save the result
+    struct command commands[argc - 3];
+    struct save_options options = DEFAULT_SAVE_OPTIONS;
+    bool stream = false;
+    bool fast_shrink = false;
+    int no_of_commands = parse_commands(argc, argv, 3, commands, &options, &stream, &fast_shrink);
+    for(int c = 0; c < no_of_commands; c++){
+      printf("  process   = %s\n", cmd_strings[commands[c].cmd_no]);
+      printf("  extra arg = %s\n", commands[c].arg);
+    }
+    printf("  quality   = %i%s\n", options.quality, options.subsample_chroma ? ", 4:2:0 chroma" : "");
+    printf("  png       = %s\n", options.png_level == FAST_PNG_LEVEL ? "fast" : "small");
+    printf("  streaming = %s\n", stream ? "on" : "off");
+    printf("  shrink    = %s\n", fast_shrink ? "fast" : "exact");
   
     printf("\n");
+
+    // rotations and flips only record the picture's orientation, so when they are all that
+    // is asked for, work out that orientation without any pixels and apply it to the JPEG
+    // coefficients directly, which loses no quality (falling back to the pixels if it can't);
+    // other save options, and other file formats, need the picture to be encoded again
+    struct picture pic = { .orientation = ORIENT_IDENTITY };
+    struct save_options defaults = DEFAULT_SAVE_OPTIONS;
+    bool default_save = options.quality == defaults.quality && !options.subsample_chroma
+                        && saves_as_jpeg(target_file);
+    bool reorient_only = only_reorients(commands, no_of_commands);
+    if(reorient_only){
+      for(int c = 0; c < no_of_commands; c++){
+        cmds[commands[c].cmd_no](&pic, commands[c].arg);
+      }
+      if(default_save && transform_jpeg_file(filename, target_file, pic.orientation)){
+        printf("-- picture processing complete --\n");
+        return 0;
+      }
+    }
+    enum orientation orientation = pic.orientation;
+
+    // with --stream, when every transformation only needs a few rows at a time, apply them
+    // to a JPEG as it is decoded and encode the rows as they are done, so that the whole
+    // picture is never held in memory (falling back to the whole picture if it can't)
+    enum stream_op ops[argc - 3];
+    if(stream && saves_as_jpeg(target_file) && find_stream_ops(commands, no_of_commands, ops)
+       && stream_jpeg_file(filename, target_file, ops, no_of_commands, &options)){
+      for(int c = 0; c < no_of_commands; c++){
+        printf("calling %s while streaming\n", cmd_strings[commands[c].cmd_no]);
+      }
+      printf("-- picture processing complete --\n");
+      return 0;
+    }
+
+    // with --fast-shrink, shrinks at the start are folded into loading the picture at a
+    // reduced scale, which for a JPEG skips most of the decoding work; a JPEG decoded at a
+    // reduced scale is close to, but not the same as, one box-averaged after a full decode,
+    // so without it every shrink averages the pixels wherever it comes in the list
+    // (raw pictures are mapped as they are)
+    int first = reorient_only ? no_of_commands : 0;
+    int scale = 1;
+    int max_scale = is_raw_picture_path(filename) ? 1 : MAX_LOAD_SCALE;
+    while(fast_shrink && first < no_of_commands && commands[first].cmd_no == SHRINK_CMD){
+      int factor = atoi(commands[first].arg);
+      if(factor < 2 || max_scale % (scale * factor) != 0){
+        break;
+      }
+      printf("calling shrink (%i) while loading\n", factor);
+      scale *= factor;
+      first++;
+    }
   
     // create original image object
-    struct picture pic;
-    if(!init_picture_from_file(&pic, filename)){
+    if(!init_picture_from_file(&pic, filename, scale)){
       exit(IO_ERROR);   
     }    
   
-    // identify the picture transformation to run
-    int cmd_no = 0;
-    while(cmd_no < no_of_cmds && strcmp(process, cmd_strings[cmd_no])){
-      cmd_no++;
+    // dispatch to appropriate picture transformation functions, fusing each run
+    // of consecutive plain blurs into a single pass over the picture (rotations
+    // and flips that were already run above only need their orientation restored)
+    if(reorient_only){
+      orient_picture(&pic, orientation);
     }
-  
-    // IO error check
-    if(cmd_no == no_of_cmds){
-      printf("[!] invalid process requested: %s is not defined\n    aborting...\n", process);  
-      exit(IO_ERROR);   
+    int c = first;
+    while(c < no_of_commands){
+      int run = 0;
+      while(c + run < no_of_commands && is_plain_blur(&commands[c + run])){
+        run++;
+      }
+      if(run > 1){
+        printf("calling blur (x%i)\n", run);
+        blur_picture_n(&pic, run);
+        c += run;
+        continue;
+      }
+      cmds[commands[c].cmd_no](&pic, commands[c].arg);
+      c++;
     }
-  
-    // dispatch to appropriate picture transformation function
-    cmds[cmd_no](&pic, extra_arg);
 
     // save resulting picture and report success
-    save_picture_to_file(&pic, target_file);
+    if(!save_picture_to_file(&pic, target_file, &options)){
+      exit(IO_ERROR);
+    }
     printf("-- picture processing complete --\n");
     
     clear_picture(&pic);
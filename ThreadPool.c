@@ -1,86 +1,430 @@
-#define _GNU_SOURCE
-#define __USE_GNU
-#include <malloc.h>
-#include <pthread.h>
-#include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "ThreadPool.h"
 
-/* Initialise the thread pool. */
-bool initialise_thread_pool(struct thread_pool *thread_pool)
+/* Number of rounds of failed steal attempts before an idle worker goes to sleep. */
+#define IDLE_ROUNDS 64
+
+/* Longest time an idle worker sleeps before looking for work again. */
+#define IDLE_SLEEP_NS 1000000
+
+/* The worker running on this thread, or NULL for threads outside every pool. */
+static __thread struct worker *current_worker = NULL;
+
+static pthread_once_t shared_pool_once = PTHREAD_ONCE_INIT;
+static struct thread_pool shared_pool;
+
+/* ---------- Chase-Lev deque (Le, Pop, Cohen and Zappa Nardelli, PPoPP 2013) ---------- */
+
+static void initialise_deque(struct deque *deque)
+{
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+}
+
+/* Owner only: add a task at the bottom, returning false if the deque is full. */
+static bool push_task(struct deque *deque, struct task *task)
 {
-    thread_pool->head = malloc(sizeof(struct node));
-    thread_pool->tail = malloc(sizeof(struct node));
-    if (thread_pool->head == NULL || thread_pool->tail == NULL)
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= DEQUE_CAPACITY)
         return false;
+    atomic_store_explicit(&deque->tasks[bottom % DEQUE_CAPACITY], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
 
-    thread_pool->head->prev = NULL;
-    thread_pool->head->next = thread_pool->tail;
-    thread_pool->tail->prev = thread_pool->head;
-    thread_pool->tail->next = NULL;
+/* Owner only: remove the most recently pushed task, or return NULL if there is none left. */
+static struct task *take_task(struct deque *deque)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
 
-    return true;
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    struct task *task = atomic_load_explicit(&deque->tasks[bottom % DEQUE_CAPACITY], memory_order_relaxed);
+    if (top == bottom) {
+        /* Last task: race any thief for it. */
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            task = NULL;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
 }
 
-/* Create a new node and set the thread field to the passed in thread. */
-struct node *new_node(pthread_t thread) 
+/* Any thread: remove the oldest task, or return NULL if there is none or another thread won it. */
+static struct task *steal_task(struct deque *deque)
 {
-    struct node *node = malloc(sizeof(struct node));
-    if (node == NULL)
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
         return NULL;
 
-    node->thread = thread;
-    return node;
+    struct task *task = atomic_load_explicit(&deque->tasks[top % DEQUE_CAPACITY], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return task;
 }
 
-/* Add a new node to the back of the thread pool. */
-bool add_to_thread_pool(struct thread_pool *thread_pool, pthread_t thread)
+/* ---------- scheduling ---------- */
+
+/* Record that a job has completed, waking its submitter if it was the last of its group. */
+static void finish_job(struct thread_pool *thread_pool, struct job_group *group)
 {
-    struct node *node = new_node(thread);
-    if (node == NULL)
-        return false;
-    
-    thread_pool->tail->prev->next = node;
-    node->prev = thread_pool->tail->prev;
-    node->next = thread_pool->tail;
-    thread_pool->tail->prev = node;
-    return true;
+    if (atomic_fetch_sub_explicit(&group->pending, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_lock(&thread_pool->lock);
+        pthread_cond_broadcast(&thread_pool->finished);
+        pthread_mutex_unlock(&thread_pool->lock);
+    }
+}
+
+/* Take the job at the front of the submission queue, if any. */
+static bool pop_job(struct thread_pool *thread_pool, struct job *job)
+{
+    bool found = false;
+    pthread_mutex_lock(&thread_pool->lock);
+    if (thread_pool->count > 0) {
+        *job = thread_pool->queue[thread_pool->head];
+        thread_pool->head = (thread_pool->head + 1) % JOB_QUEUE_CAPACITY;
+        thread_pool->count--;
+        pthread_cond_signal(&thread_pool->not_full);
+        found = true;
+    }
+    pthread_mutex_unlock(&thread_pool->lock);
+    return found;
+}
+
+static void run_task(struct worker *worker, struct task *task)
+{
+    task->execute(worker, task);
+    atomic_store_explicit(&task->done, 1, memory_order_release);
+}
+
+/* Run one piece of work: the worker's newest own task, else a submitted job, else a task stolen
+ * from a randomly chosen worker. Returns false if no work was found anywhere. */
+static bool run_available_work(struct worker *worker)
+{
+    struct thread_pool *thread_pool = worker->thread_pool;
+
+    struct task *task = take_task(&worker->deque);
+    if (task != NULL) {
+        run_task(worker, task);
+        return true;
+    }
+
+    struct job job;
+    if (atomic_load_explicit(&thread_pool->count, memory_order_relaxed) > 0
+        && pop_job(thread_pool, &job)) {
+        job.fn(job.arg);
+        finish_job(thread_pool, job.group);
+        return true;
+    }
+
+    int no_workers = thread_pool->no_workers;
+    for (int attempt = 0; attempt < no_workers; attempt++) {
+        struct worker *victim = &thread_pool->workers[rand_r(&worker->seed) % no_workers];
+        if (victim == worker)
+            continue;
+        task = steal_task(&victim->deque);
+        if (task != NULL) {
+            run_task(worker, task);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Wake one sleeping worker, if any, after making new work visible. */
+static void wake_worker(struct thread_pool *thread_pool)
+{
+    if (atomic_load_explicit(&thread_pool->sleeping, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&thread_pool->lock);
+        pthread_cond_signal(&thread_pool->wake);
+        pthread_mutex_unlock(&thread_pool->lock);
+    }
+}
+
+/* Sleep until woken or for at most IDLE_SLEEP_NS, unless jobs are already queued. The timeout
+ * covers tasks pushed onto a deque between the last steal attempt and going to sleep. */
+static void sleep_while_idle(struct thread_pool *thread_pool)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += IDLE_SLEEP_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&thread_pool->lock);
+    atomic_fetch_add(&thread_pool->sleeping, 1);
+    if (thread_pool->count == 0 && !atomic_load(&thread_pool->shutting_down))
+        pthread_cond_timedwait(&thread_pool->wake, &thread_pool->lock, &deadline);
+    atomic_fetch_sub(&thread_pool->sleeping, 1);
+    pthread_mutex_unlock(&thread_pool->lock);
+}
+
+/* Main loop of every worker: run available work until the pool is shut down and drained. */
+static void *worker_loop(void *arg)
+{
+    struct worker *worker = arg;
+    struct thread_pool *thread_pool = worker->thread_pool;
+    current_worker = worker;
+
+    int idle_rounds = 0;
+    while (true) {
+        if (run_available_work(worker)) {
+            idle_rounds = 0;
+            continue;
+        }
+        if (atomic_load(&thread_pool->shutting_down))
+            break;
+        if (++idle_rounds < IDLE_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+        sleep_while_idle(thread_pool);
+        idle_rounds = 0;
+    }
+    return NULL;
 }
 
-/* Remove a node from the thread pool. */
-void remove_node(struct node *node) 
+/* Fork-join: run other work until the forked task has been completed by whoever took it. */
+static void join_task(struct worker *worker, struct task *task)
 {
-    node->prev->next = node->next;
-    node->next->prev = node->prev;
+    /* The task is at the bottom of our deque unless it (and everything above it) was stolen. */
+    struct task *taken = take_task(&worker->deque);
+    if (taken == task) {
+        run_task(worker, task);
+        return;
+    }
+    while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+        if (!run_available_work(worker))
+            sched_yield();
+    }
 }
 
-/* Iterate through all threads in the thread pool and join them back to main. */
-void join_threads(struct thread_pool *thread_pool)
+/* ---------- thread pool ---------- */
+
+/* Initialise the thread pool and start its workers. */
+bool initialise_thread_pool(struct thread_pool *thread_pool, int no_workers)
 {
-    struct node *prev = NULL;
-    struct node *curr = thread_pool->head;
-    while (curr != NULL) {
-        prev = curr;
-        curr = curr->next;
-        if (prev != thread_pool->head && prev != thread_pool->tail) {
-            pthread_join(prev->thread, NULL);
+    pthread_mutex_init(&thread_pool->lock, NULL);
+    pthread_cond_init(&thread_pool->wake, NULL);
+    pthread_cond_init(&thread_pool->not_full, NULL);
+    pthread_cond_init(&thread_pool->finished, NULL);
+    thread_pool->head = 0;
+    atomic_init(&thread_pool->count, 0);
+    atomic_init(&thread_pool->sleeping, 0);
+    atomic_init(&thread_pool->shutting_down, false);
+    thread_pool->no_workers = no_workers;
+    thread_pool->workers = aligned_alloc(CACHE_LINE_SIZE, no_workers * sizeof(struct worker));
+    if (thread_pool->workers == NULL) {
+        /* No worker will ever run, so jobs must not be queued for them. */
+        thread_pool->no_workers = 0;
+        return false;
+    }
+
+    /* Every deque is ready before any worker starts looking for tasks to steal. */
+    for (int i = 0; i < no_workers; i++) {
+        initialise_deque(&thread_pool->workers[i].deque);
+        thread_pool->workers[i].thread_pool = thread_pool;
+        thread_pool->workers[i].seed = i + 1;
+    }
+    for (int i = 0; i < no_workers; i++) {
+        if (pthread_create(&thread_pool->workers[i].thread, NULL, worker_loop, &thread_pool->workers[i]) != 0) {
+            /* Carry on with the workers already started; the rest never receive tasks. */
+            thread_pool->no_workers = i;
+            break;
         }
-        free(prev);
     }
-        
+    return thread_pool->no_workers > 0;
+}
+
+/* Let the workers finish all outstanding work, then join them back to main. */
+void destroy_thread_pool(struct thread_pool *thread_pool)
+{
+    pthread_mutex_lock(&thread_pool->lock);
+    atomic_store(&thread_pool->shutting_down, true);
+    pthread_cond_broadcast(&thread_pool->wake);
+    pthread_mutex_unlock(&thread_pool->lock);
+
+    for (int i = 0; i < thread_pool->no_workers; i++)
+        pthread_join(thread_pool->workers[i].thread, NULL);
+    free(thread_pool->workers);
+
+    pthread_cond_destroy(&thread_pool->finished);
+    pthread_cond_destroy(&thread_pool->not_full);
+    pthread_cond_destroy(&thread_pool->wake);
+    pthread_mutex_destroy(&thread_pool->lock);
+}
+
+static void initialise_shared_pool(void)
+{
+    long no_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    initialise_thread_pool(&shared_pool, no_cpus > 0 ? no_cpus : 1);
+}
+
+/* The process-wide thread pool, with one worker per online CPU, started on first use. */
+struct thread_pool *shared_thread_pool(void)
+{
+    pthread_once(&shared_pool_once, initialise_shared_pool);
+    return &shared_pool;
+}
+
+void initialise_job_group(struct job_group *group)
+{
+    atomic_init(&group->pending, 0);
+}
+
+/* Queue fn(arg) as part of the group. When the queue is full, the submitter waits for space, except
+ * for workers of the pool, which run the job themselves instead so that they can never deadlock. */
+void submit_job(struct thread_pool *thread_pool, struct job_group *group, void (*fn)(void *arg), void *arg)
+{
+    struct job job = {fn, arg, group};
+    atomic_fetch_add(&group->pending, 1);
+
+    /* Without any running worker there is nobody to hand the job to. */
+    if (thread_pool->no_workers == 0) {
+        fn(arg);
+        finish_job(thread_pool, group);
+        return;
+    }
+
+    pthread_mutex_lock(&thread_pool->lock);
+    if (thread_pool->count == JOB_QUEUE_CAPACITY && current_worker != NULL
+        && current_worker->thread_pool == thread_pool) {
+        pthread_mutex_unlock(&thread_pool->lock);
+        fn(arg);
+        finish_job(thread_pool, group);
+        return;
+    }
+    while (thread_pool->count == JOB_QUEUE_CAPACITY)
+        pthread_cond_wait(&thread_pool->not_full, &thread_pool->lock);
+
+    thread_pool->queue[(thread_pool->head + thread_pool->count) % JOB_QUEUE_CAPACITY] = job;
+    thread_pool->count++;
+    pthread_cond_signal(&thread_pool->wake);
+    pthread_mutex_unlock(&thread_pool->lock);
 }
 
-/* Iterate through all threads in the thread pool and if any have terminated, join them to main, remove
- * from the linked list and free the structure. This allows for more threads to then be created. */
-void try_join_threads(struct thread_pool *thread_pool) 
+/* Block until every job of the group has completed. Workers of the pool keep running other work
+ * in the meantime; other threads sleep. */
+void wait_for_jobs(struct thread_pool *thread_pool, struct job_group *group)
 {
-    struct node *prev = NULL;
-    struct node *curr = thread_pool->head->next;
-    while (curr != thread_pool->tail) {
-        prev = curr;
-        curr = curr->next;
-        if (pthread_tryjoin_np(prev->thread, NULL) == 0) {
-            remove_node(prev);
-            free(prev);
+    struct worker *worker = current_worker;
+    if (worker != NULL && worker->thread_pool == thread_pool) {
+        while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+            if (!run_available_work(worker))
+                sched_yield();
         }
+        return;
+    }
+
+    pthread_mutex_lock(&thread_pool->lock);
+    while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0)
+        pthread_cond_wait(&thread_pool->finished, &thread_pool->lock);
+    pthread_mutex_unlock(&thread_pool->lock);
+}
+
+/* ---------- parallel_for ---------- */
+
+/* The loop body and range of a parallel_for. */
+struct parallel_range
+{
+    int begin;
+    int end;
+    int grain;
+    void (*fn)(void *ctx, int lo, int hi);
+    void *ctx;
+};
+
+/* The right half of a split range, left in the deque for an idle worker to steal. */
+struct range_task
+{
+    struct task task;
+    struct parallel_range *range;
+    int lo;
+    int hi;
+};
+
+static void run_range(struct worker *worker, struct parallel_range *range, int lo, int hi);
+
+static void execute_range_task(struct worker *worker, struct task *task)
+{
+    struct range_task *range_task = (struct range_task *) task;
+    run_range(worker, range_task->range, range_task->lo, range_task->hi);
+}
+
+/* Recursively fork off the right half of the range until it is at most one grain, then run it. */
+static void run_range(struct worker *worker, struct parallel_range *range, int lo, int hi)
+{
+    while (hi - lo > range->grain) {
+        int mid = lo + (hi - lo) / 2;
+        struct range_task right;
+        right.task.execute = execute_range_task;
+        atomic_init(&right.task.done, 0);
+        right.range = range;
+        right.lo = mid;
+        right.hi = hi;
+        if (!push_task(&worker->deque, &right.task))
+            break;
+        wake_worker(worker->thread_pool);
+
+        run_range(worker, range, lo, mid);
+        join_task(worker, &right.task);
+        return;
+    }
+
+    /* Too small to split, or no room left in the deque: run the chunks here. */
+    for (int chunk = lo; chunk < hi; chunk += range->grain) {
+        range->fn(range->ctx, chunk, chunk + range->grain < hi ? chunk + range->grain : hi);
+    }
+}
+
+/* Job submitted by threads outside the pool: the worker that picks it up starts the splitting. */
+static void run_root_range(void *arg)
+{
+    struct parallel_range *range = arg;
+    run_range(current_worker, range, range->begin, range->end);
+}
+
+void parallel_for(int begin, int end, int grain, void (*fn)(void *ctx, int lo, int hi), void *ctx)
+{
+    if (begin >= end)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    struct thread_pool *thread_pool = shared_thread_pool();
+    struct parallel_range range = {begin, end, grain, fn, ctx};
+
+    struct worker *worker = current_worker;
+    if (worker != NULL && worker->thread_pool == thread_pool) {
+        run_range(worker, &range, begin, end);
+        return;
     }
-}
\ No newline at end of file
+
+    /* Without any running worker the range can't be split into tasks; run its chunks here. */
+    if (thread_pool->no_workers == 0) {
+        for (int chunk = begin; chunk < end; chunk += grain)
+            fn(ctx, chunk, chunk + grain < end ? chunk + grain : end);
+        return;
+    }
+
+    struct job_group group;
+    initialise_job_group(&group);
+    submit_job(thread_pool, &group, run_root_range, &range);
+    wait_for_jobs(thread_pool, &group);
+}
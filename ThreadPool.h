@@ -1,27 +1,87 @@
-#define _GNU_SOURCE
-#define __USE_GNU
-#include <malloc.h>
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 
-/* Linked List structure for the thread pool. */
-struct thread_pool 
+/* Maximum number of jobs waiting in the shared submission queue of a thread pool. */
+#define JOB_QUEUE_CAPACITY 256
+
+/* Maximum number of tasks waiting in the deque of a single worker. */
+#define DEQUE_CAPACITY 1024
+
+/* Size of a cache line, used to keep data written by different threads apart. */
+#define CACHE_LINE_SIZE 64
+
+/* Counter of the unfinished jobs submitted together, so that their submitter can wait for them. */
+struct job_group
+{
+    atomic_int pending;
+};
+
+/* A function submitted from outside the fork-join code, run by one of the workers of a thread pool. */
+struct job
+{
+    void (*fn)(void *arg);
+    void *arg;
+    struct job_group *group;
+};
+
+struct worker;
+
+/* A piece of forked work that may be stolen. Tasks live in the stack frame of the code that forked them. */
+struct task
 {
-    struct node *head;
-    struct node *tail;
+    void (*execute)(struct worker *worker, struct task *task);
+    atomic_int done;
 };
 
-/* Node structure for the thread pool. */
-struct node 
+/* Chase-Lev work-stealing deque: its owner pushes and takes at the bottom, thieves steal from the top. */
+struct deque
 {
-    struct node *prev;
-    struct node *next;
+    _Alignas(CACHE_LINE_SIZE) atomic_long top;
+    _Alignas(CACHE_LINE_SIZE) atomic_long bottom;
+    _Alignas(CACHE_LINE_SIZE) _Atomic(struct task *) tasks[DEQUE_CAPACITY];
+};
+
+/* A long-lived thread of a thread pool, with its own deque of forked tasks. */
+struct worker
+{
+    struct deque deque;
+    struct thread_pool *thread_pool;
+    unsigned int seed;          /* State of the random choice of victims to steal from. */
     pthread_t thread;
 };
 
-bool initialise_thread_pool(struct thread_pool *thread_pool);
-struct node *new_node(pthread_t thread);
-bool add_to_thread_pool(struct thread_pool *thread_pool, pthread_t thread);
-void remove_node(struct node *node);
-void join_threads(struct thread_pool *thread_pool);
-void try_join_threads(struct thread_pool *thread_pool);
\ No newline at end of file
+/* Fixed set of workers that balance forked tasks between themselves by randomised stealing, plus a
+ * bounded queue through which other threads submit jobs. */
+struct thread_pool
+{
+    pthread_mutex_t lock;       /* Protects the submission queue and idle workers going to sleep. */
+    pthread_cond_t wake;        /* Signalled when new work is available to sleeping workers. */
+    pthread_cond_t not_full;    /* Signalled when a job is taken from the submission queue. */
+    pthread_cond_t finished;    /* Signalled when the last job of a group completes. */
+    struct job queue[JOB_QUEUE_CAPACITY];
+    int head;
+    atomic_int count;           /* Written under the lock, but also read without it as a hint. */
+    atomic_int sleeping;
+    atomic_bool shutting_down;
+    struct worker *workers;
+    int no_workers;
+};
+
+bool initialise_thread_pool(struct thread_pool *thread_pool, int no_workers);
+void destroy_thread_pool(struct thread_pool *thread_pool);
+struct thread_pool *shared_thread_pool(void);
+
+void initialise_job_group(struct job_group *group);
+void submit_job(struct thread_pool *thread_pool, struct job_group *group, void (*fn)(void *arg), void *arg);
+void wait_for_jobs(struct thread_pool *thread_pool, struct job_group *group);
+
+/* Runs fn(ctx, lo, hi) over chunks of at most grain indices covering [begin, end) on the shared thread
+ * pool, splitting the range in halves so that idle workers can steal the larger pieces, and returns
+ * once every chunk is done. May be called from inside fn. */
+void parallel_for(int begin, int end, int grain, void (*fn)(void *ctx, int lo, int hi), void *ctx);
+
+#endif
@@ -0,0 +1,79 @@
+#include "Traversal.h"
+#include "ThreadPool.h"
+
+  struct region whole_picture(struct picture *pic){
+    struct region area = {0, 0, pic->width, pic->height};
+    return area;
+  }
+
+  void traverse_rows(struct region *area, region_fn fn, void *ctx){
+    struct region row = *area;
+    for(int y = area->y_begin; y < area->y_end; y++){
+      row.y_begin = y;
+      row.y_end = y + 1;
+      fn(&row, ctx);
+    }
+  }
+
+  // set the tile of the given column and row of the tiling of the area
+  static void set_tile(struct region *tile, struct region *area, int tile_width, int tile_height,
+                       int column, int row){
+    tile->x_begin = area->x_begin + column * tile_width;
+    tile->y_begin = area->y_begin + row * tile_height;
+    tile->x_end = tile->x_begin + tile_width < area->x_end ? tile->x_begin + tile_width : area->x_end;
+    tile->y_end = tile->y_begin + tile_height < area->y_end ? tile->y_begin + tile_height : area->y_end;
+  }
+
+  void traverse_tiles(struct region *area, int tile_width, int tile_height, region_fn fn, void *ctx){
+    struct region tile;
+    int columns = (area->x_end - area->x_begin + tile_width - 1) / tile_width;
+    int rows = (area->y_end - area->y_begin + tile_height - 1) / tile_height;
+    for(int row = 0; row < rows; row++){
+      for(int column = 0; column < columns; column++){
+        set_tile(&tile, area, tile_width, tile_height, column, row);
+        fn(&tile, ctx);
+      }
+    }
+  }
+
+  // the callback, context and tiling of a parallel traversal
+  struct traversal {
+    struct region *area;
+    int tile_width;
+    int tile_height;
+    int columns;
+    region_fn fn;
+    void *ctx;
+  };
+
+  static void traverse_row_band(void *arg, int lo, int hi){
+    struct traversal *t = arg;
+    struct region band = {t->area->x_begin, lo, t->area->x_end, hi};
+    t->fn(&band, t->ctx);
+  }
+
+  void parallel_traverse_rows(struct region *area, region_fn fn, void *ctx){
+    struct traversal t = {area, 0, 0, 0, fn, ctx};
+    int row_bytes = (area->x_end - area->x_begin) * PIXEL_CHANNELS;
+    int grain = row_bytes > 0 && row_bytes < BAND_BYTES ? BAND_BYTES / row_bytes : 1;
+    parallel_for(area->y_begin, area->y_end, grain, traverse_row_band, &t);
+  }
+
+  // visit tiles lo to hi - 1, numbered in row-major tile order
+  static void traverse_tile_range(void *arg, int lo, int hi){
+    struct traversal *t = arg;
+    struct region tile;
+    for(int n = lo; n < hi; n++){
+      set_tile(&tile, t->area, t->tile_width, t->tile_height, n % t->columns, n / t->columns);
+      t->fn(&tile, t->ctx);
+    }
+  }
+
+  void parallel_traverse_tiles(struct region *area, int tile_width, int tile_height, region_fn fn, void *ctx){
+    int columns = (area->x_end - area->x_begin + tile_width - 1) / tile_width;
+    int rows = (area->y_end - area->y_begin + tile_height - 1) / tile_height;
+    struct traversal t = {area, tile_width, tile_height, columns, fn, ctx};
+    if(columns > 0 && rows > 0){
+      parallel_for(0, columns * rows, 1, traverse_tile_range, &t);
+    }
+  }
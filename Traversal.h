@@ -0,0 +1,46 @@
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+#include "Picture.h"
+
+  // edge length (in pixels) of square tiles for transforms that read along
+  // the other axis: a 32x32 source tile and its destination tile fit
+  // comfortably in L1 cache
+  #define TILE_SIZE 32
+
+  // approximate number of bytes in the band of rows handed to a single job
+  // by parallel_traverse_rows, large enough to amortise scheduling it
+  #define BAND_BYTES 65536
+
+  // A rectangular block of pixel coordinates, [x_begin, x_end) x [y_begin, y_end)
+  struct region {
+    int x_begin;
+    int y_begin;
+    int x_end;
+    int y_end;
+  };
+
+  // callback applied by a traversal to each block of the area it visits
+  typedef void (*region_fn)(struct region *block, void *ctx);
+
+  // set up a region covering the whole of the picture
+  struct region whole_picture(struct picture *pic);
+
+  // visit the area one row at a time, from top to bottom, so that every
+  // block handed to fn is a contiguous span of memory
+  void traverse_rows(struct region *area, region_fn fn, void *ctx);
+
+  // visit the area as tile_width x tile_height tiles in row-major tile order,
+  // for transforms whose reads and writes run along different axes or which
+  // reuse their source pixels across several rows
+  void traverse_tiles(struct region *area, int tile_width, int tile_height, region_fn fn, void *ctx);
+
+  // as traverse_rows, but with bands of rows spread across the shared thread
+  // pool; fn must only write to the rows of the block it is given
+  void parallel_traverse_rows(struct region *area, region_fn fn, void *ctx);
+
+  // as traverse_tiles, but with the tiles spread across the shared thread
+  // pool; fn must only write to the pixels of the tile it is given
+  void parallel_traverse_tiles(struct region *area, int tile_width, int tile_height, region_fn fn, void *ctx);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "Utils.h"
+#include "Picture.h"
+#include "Orientation.h"
+#include "PicProcess.h"
+
+/* Benchmark comparing the old column-by-column pixel order with the traversal layer. */
+
+#define DEFAULT_MAX_MEGAPIXELS 100
+#define REPEATS 3
+
+static const int megapixel_sizes[] = {1, 4, 16, 50, 100};
+
+/* Hardware counters for cache references and misses (-1 when unavailable). */
+struct cache_counters {
+    int refs_fd;
+    int misses_fd;
+};
+
+struct measurement {
+    double seconds;
+    long long refs;
+    long long misses;
+};
+
+static int open_counter(unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_counter(int fd) {
+    long long value = -1;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+    return value;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Old pixel order: x in the outer loop, so consecutive accesses are a row apart. */
+static void column_order_invert(struct picture *pic) {
+    for (int i = 0; i < pic->width; i++) {
+        for (int j = 0; j < pic->height; j++) {
+            unsigned char *rgb = get_row(pic, j) + i * PIXEL_CHANNELS;
+            for (int c = 0; c < PIXEL_CHANNELS; c++)
+                rgb[c] = 255 - rgb[c];
+        }
+    }
+}
+
+/* Old 90 degree rotation: column-order writes and reads a full source row apart. */
+static void column_order_rotate_90(struct picture *pic) {
+    struct picture tmp;
+    init_picture_from_copy(&tmp, pic);
+    clear_picture(pic);
+    init_picture_from_size(pic, tmp.height, tmp.width);
+    for (int i = 0; i < pic->width; i++) {
+        for (int j = 0; j < pic->height; j++) {
+            memcpy(get_row(pic, j) + i * PIXEL_CHANNELS,
+                   get_row(&tmp, pic->width - 1 - i) + j * PIXEL_CHANNELS, PIXEL_CHANNELS);
+        }
+    }
+    clear_picture(&tmp);
+}
+
+static void traversal_invert(struct picture *pic) {
+    invert_picture(pic);
+}
+
+static void traversal_rotate_90(struct picture *pic) {
+    rotate_picture(pic, 90);
+    materialise_picture(pic);
+}
+
+/* Runs the transform REPEATS times and keeps the fastest run. */
+static struct measurement measure(struct cache_counters *cc, struct picture *pic,
+                                  void (*transform)(struct picture *pic)) {
+    struct measurement best = {-1, -1, -1};
+    for (int r = 0; r < REPEATS; r++) {
+        if (cc->refs_fd >= 0) {
+            ioctl(cc->refs_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(cc->misses_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(cc->refs_fd, PERF_EVENT_IOC_ENABLE, 0);
+            ioctl(cc->misses_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        double start = now();
+        transform(pic);
+        double seconds = now() - start;
+        if (cc->refs_fd >= 0) {
+            ioctl(cc->refs_fd, PERF_EVENT_IOC_DISABLE, 0);
+            ioctl(cc->misses_fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        if (best.seconds < 0 || seconds < best.seconds) {
+            best.seconds = seconds;
+            best.refs = read_counter(cc->refs_fd);
+            best.misses = read_counter(cc->misses_fd);
+        }
+    }
+    return best;
+}
+
+static void report(const char *name, double megapixels, struct measurement m) {
+    printf("  %-24s %9.1f MP/s", name, megapixels / m.seconds);
+    if (m.refs > 0 && m.misses >= 0)
+        printf("   miss rate %5.1f%% (%lld misses)\n", 100.0 * m.misses / m.refs, m.misses);
+    else
+        printf("   miss rate n/a\n");
+}
+
+// ---------- MAIN PROGRAM ---------- \\
+
+  int main(int argc, char **argv){
+
+    /* Usage: ./traversal_bench [max megapixels] */
+    int max_megapixels = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_MEGAPIXELS;
+
+    struct cache_counters cc;
+    cc.refs_fd = open_counter(PERF_COUNT_HW_CACHE_REFERENCES);
+    cc.misses_fd = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+    if (cc.refs_fd < 0 || cc.misses_fd < 0) {
+        printf("[!] hardware cache counters unavailable, reporting throughput only\n");
+        cc.refs_fd = cc.misses_fd = -1;
+    }
+
+    int no_of_sizes = sizeof(megapixel_sizes) / sizeof(megapixel_sizes[0]);
+    for (int s = 0; s < no_of_sizes && megapixel_sizes[s] <= max_megapixels; s++) {
+        /* 4:3 picture with the requested number of megapixels */
+        int width = sqrt(megapixel_sizes[s] * 1e6 * 4 / 3);
+        int height = megapixel_sizes[s] * 1e6 / width;
+        double megapixels = (double) width * height / 1e6;
+
+        struct picture pic;
+        if (!init_picture_from_size(&pic, width, height)) {
+            printf("[!] unable to allocate a %i MP picture\n", megapixel_sizes[s]);
+            break;
+        }
+        for (int j = 0; j < height; j++) {
+            unsigned char *row = get_row(&pic, j);
+            for (int k = 0; k < width * PIXEL_CHANNELS; k++)
+                row[k] = (unsigned char) (k * 31 + j * 17);
+        }
+
+        printf("%i x %i (%.1f MP):\n", width, height, megapixels);
+        report("invert, column order", megapixels, measure(&cc, &pic, column_order_invert));
+        report("invert, traversal", megapixels, measure(&cc, &pic, traversal_invert));
+        report("rotate 90, column order", megapixels, measure(&cc, &pic, column_order_rotate_90));
+        report("rotate 90, traversal", megapixels, measure(&cc, &pic, traversal_rotate_90));
+
+        clear_picture(&pic);
+    }
+    return 0;
+  }
@@ -1,59 +1,96 @@
 #include "Utils.h"
+#include "ThreadPool.h"
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
-  #define DEFAULT_COMPRESSION_QUALITY -1
   #define FULL_COLOUR_CHANNELS 3
 
-  sod_img create_image(int width, int height){
-    return sod_make_image(width, height, FULL_COLOUR_CHANNELS);   
+  // codec jobs to run on the shared thread pool
+  struct codec_jobs {
+    void (*job)(void *, int);
+    void *job_data;
+  };
+
+  static void run_codec_jobs(void *ctx, int lo, int hi){
+    struct codec_jobs *jobs = ctx;
+    for(int i = lo; i < hi; i++){
+      jobs->job(jobs->job_data, i);
+    }
   }
 
-  void free_image(sod_img img){
-    sod_free_image(img);   
+  void run_in_parallel(void *user, int no_jobs, void (*job)(void *, int), void *job_data){
+    struct codec_jobs jobs = { job, job_data };
+    parallel_for(0, no_jobs, 1, run_codec_jobs, &jobs);
   }
 
-  sod_img load_image(const char *path){
-    sod_img input;
+  bool load_pixels(const char *path, int scale, ProcImgDest dest, void *user){
     if( access(path, F_OK) == IO_ERROR ){
       printf("[!] error reading from file %s (check it exists)\n", path);
-      input.data = 0;
-      return input;
+      return false;
     }
-    input = sod_img_load_from_file(path, SOD_IMG_COLOR);  
-    if(input.data == 0){
-      printf("[!] unsupported image format (expecting jpeg, png or bmp)\n");
+    if( scale != 1 && scale != 2 && scale != 4 && scale != 8 ){
+      printf("[!] images can't be loaded at scale 1/%i (must be 1, 2, 4 or 8)\n", scale);
+      return false;
     }
-    return input;
-  }
-    
-  bool save_image(sod_img img, const char *path){
-    int ret = sod_img_save_as_jpeg(img, path, DEFAULT_COMPRESSION_QUALITY);
-    if(ret != SOD_OK){
-      printf("[!] error saving file to %s\n", path);
+    // splitting the decode only pays off when there are workers to share it,
+    // since without restart markers it costs an extra pass over the blocks
+    sod_img_set_load_parallel(shared_thread_pool()->no_workers > 1 ? run_in_parallel : NULL, NULL);
+    if(sod_img_load_into(path, FULL_COLOUR_CHANNELS, scale, dest, user) != SOD_OK){
+      printf("[!] unsupported image format (expecting jpeg, png or bmp)\n");
       return false;
     }
     return true;
   }
 
-  sod_img copy_image(sod_img img){
-    return sod_copy_image(img);   
-  }
-
-  int get_image_width(sod_img img){
-    return img.w;   
+  enum image_format image_format_for_path(const char *path){
+    if(has_extension(path, ".png")){
+      return FORMAT_PNG;
+    }
+    if(has_extension(path, ".bmp")){
+      return FORMAT_BMP;
+    }
+    if(has_extension(path, ".ppm")){
+      return FORMAT_PPM;
+    }
+    return FORMAT_JPEG;
   }
 
-  int get_image_height(sod_img img){
-    return img.h;    
-  } 
-
-  int get_pixel_value(sod_img img, int rgb, int x, int y){
-    float intensity = sod_img_get_pixel(img, x, y, rgb);
-    int rgb_value =  intensity * MAX_PIXEL_INTENSITY;
-    return rgb_value;
+  bool save_pixels(const unsigned char *pixels, int width, int height, int stride, const char *path,
+                   const struct save_options *options){
+    struct save_options defaults = DEFAULT_SAVE_OPTIONS;
+    if(options == NULL){
+      options = &defaults;
+    }
+    int ret = SOD_OUTOFMEM;
+    switch(image_format_for_path(path)){
+      case FORMAT_PNG:
+        ret = sod_img_blob_save_as_png_stride(path, pixels, width, height, FULL_COLOUR_CHANNELS, stride,
+                                              options->png_level, options->png_filter,
+                                              run_in_parallel, NULL);
+        break;
+      case FORMAT_BMP:
+        ret = sod_img_blob_save_as_bmp_stride(path, pixels, width, height, FULL_COLOUR_CHANNELS, stride);
+        break;
+      case FORMAT_PPM:
+        ret = sod_img_blob_save_as_ppm(path, pixels, width, height, FULL_COLOUR_CHANNELS, stride);
+        break;
+      case FORMAT_JPEG:
+        ret = sod_img_blob_save_as_jpeg_stride(path, pixels, width, height, FULL_COLOUR_CHANNELS, stride,
+                                               options->quality, options->subsample_chroma,
+                                               run_in_parallel, NULL);
+        break;
+    }
+    if(ret != SOD_OK){
+      printf("[!] error saving file to %s\n", path);
+      return false;
+    }
+    return true;
   }
 
-  void set_pixel_value(sod_img img, int rgb, int x, int y, int val){
-    float intensity = val / MAX_PIXEL_INTENSITY;  
-    sod_img_set_pixel(img, x, y, rgb, intensity);  
+  bool has_extension(const char *path, const char *extension){
+    size_t path_length = strlen(path);
+    size_t extension_length = strlen(extension);
+    return path_length >= extension_length &&
+           strcasecmp(path + path_length - extension_length, extension) == 0;
   }
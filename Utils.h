@@ -9,34 +9,72 @@
   #define IO_ERROR -1
   #define MAX_PIXEL_INTENSITY 255.0
 
-  // Create a new instance of a sod image of the specified width 
-  // and height, using the full RGB colour model.
-  sod_img create_image(int width, int height);
-  
-  // Free the memory used by sod image provided as argument
-  void free_image(sod_img img);
-  
-  // Create a sod image from the the image file at the specified location.
-  sod_img load_image(const char *path);  
+  // range of JPEG qualities, from the smallest file to the best picture
+  #define MIN_SAVE_QUALITY 1
+  #define MAX_SAVE_QUALITY 100
+
+  // PNG deflate levels: the fastest, and the default, which searches harder
+  // for repeats and makes a somewhat smaller file
+  #define FAST_PNG_LEVEL 1
+  #define DEFAULT_PNG_LEVEL 8
+
+  // PNG row filters: try them all on each row and keep the one that looks
+  // cheapest, or take each byte less the one above it on every row, which is
+  // a fifth of the filtering work and does about as well on photos
+  #define PNG_ADAPTIVE_FILTER -1
+  #define PNG_UP_FILTER 2
+
+  // The file formats pictures are saved in, chosen by the file extension.
+  enum image_format { FORMAT_JPEG, FORMAT_PNG, FORMAT_BMP, FORMAT_PPM };
+
+  // How a picture is encoded when it is saved; each encoder only reads the
+  // options of its own format.
+  struct save_options {
+    // JPEG quality, between MIN_SAVE_QUALITY and MAX_SAVE_QUALITY
+    int quality;
+    // store the colour at half the width and height of the picture (4:2:0),
+    // which halves the encoding work and roughly halves the file
+    bool subsample_chroma;
+    // PNG deflate level, from FAST_PNG_LEVEL up
+    int png_level;
+    // PNG filter applied to every row (0 to 4, such as PNG_UP_FILTER), or
+    // PNG_ADAPTIVE_FILTER
+    int png_filter;
+  };
+
+  // options used when none are given: best quality, full resolution colour,
+  // smallest PNG
+  #define DEFAULT_SAVE_OPTIONS ((struct save_options) { MAX_SAVE_QUALITY, false, DEFAULT_PNG_LEVEL, PNG_ADAPTIVE_FILTER })
+
+  // Decode the image file at the specified location straight into the
+  // buffer returned by dest, as interleaved 8-bit RGB pixels (see
+  // ProcImgDest in sod.h), without creating a sod image. The image is
+  // reduced to 1/scale of its width and height, rounding up, for a scale of
+  // 1, 2, 4 or 8; JPEG files are decoded at that size to begin with, which
+  // saves most of the decoding work for previews.
+  bool load_pixels(const char *path, int scale, ProcImgDest dest, void *user);
   
-  // Saves the given image in the given destination.
-  bool save_image(sod_img img, const char *path);
+  // Find the format a file saved at the given location is encoded in: PNG,
+  // BMP or PPM for a path ending in ".png", ".bmp" or ".ppm", and JPEG for
+  // any other
+  enum image_format image_format_for_path(const char *path);
+
+  // Saves a row-major buffer of interleaved 8-bit RGB pixels, where each row
+  // starts stride bytes after the previous one, in the given destination, in
+  // the format of its extension, encoded as the options say
+  // (DEFAULT_SAVE_OPTIONS if NULL).
+  // The rows are encoded in place, without creating a sod image; JPEG and PNG
+  // files are encoded in bands spread across the shared thread pool.
+  bool save_pixels(const unsigned char *pixels, int width, int height, int stride, const char *path,
+                   const struct save_options *options);
     
-  // Clones the image provided as argument
-  sod_img copy_image(sod_img img);
-  
-  // Find the width of the provided image
-  int get_image_width(sod_img img);
-  
-  // Find the height of the provided image
-  int get_image_height(sod_img img);
-  
-  // Find the R/G/B value of the pixel at (x,y) in the image 
-  // NOTE: (rgb = 0 for red, rgb = 1 for green, rgb = 2 for blue)
-  int get_pixel_value(sod_img img, int rgb, int x, int y);
-  
-  // Set the R/G/B pixel intensity for pixel at (x,y)
-  // NOTE: (rgb = 0 for red, rgb = 1 for green, rgb = 2 for blue)
-  void set_pixel_value(sod_img img, int rgb, int x, int y, int val);
+  // Runs job(job_data, i) for i from 0 to no_jobs - 1 across the shared
+  // thread pool and waits for them all; the parallel callback given to the
+  // SOD codecs (user is unused).
+  void run_in_parallel(void *user, int no_jobs, void (*job)(void *, int), void *job_data);
+
+  // Check whether the path ends in the given extension (such as ".jpg"),
+  // ignoring case
+  bool has_extension(const char *path, const char *extension);
 
 #endif
@@ -66,6 +66,26 @@ def run_test(test_name, cmd_line, expected_image, error_as_fail=true)
   puts ""
 end
 
+def run_raw_mapping_test(test_name, raw_file)
+
+  # check the raw picture file is loaded straight from its mapping, not copied
+  puts "> running: #{test_name}"
+  puts "--------------------------------------"
+  system %Q(./raw_picture_check #{raw_file} 2>&1)
+  test_success = $?.exitstatus == 0
+
+  if(!test_success) then
+    puts "  - raw picture was not loaded in place!"
+    @testscores << {"score": 0, "name": "#{test_name}", "possible": 1}
+    puts ""
+    return
+  end
+
+  puts ("  + raw picture loaded in place")
+  @testscores << {"score": 1, "name": "#{test_name}", "possible": 1}
+  puts ""
+end
+
 #####################################################################
 
 # MAIN PROGRAM START:
@@ -88,17 +108,23 @@ else
   run_test("grayscale test 1", "test_images/test.jpg test_grayscale.jpg grayscale", "test_grayscale.jpeg")
   run_test("grayscale test 2", "test_images/me.jpg classic.jpg grayscale", "classic.jpeg")
   
-  run_test("rotate 90 test", "test_images/test.jpg test_rotate_90.jpg rotate 90", "test_rotate_90.jpeg")
-  run_test("rotate 180 test", "test_images/test.jpg test_rotate_180.jpg rotate 180", "test_rotate_180.jpeg")
-  run_test("rotate 270 test", "test_images/test.jpg test_rotate_270.jpg rotate 270", "test_rotate_270.jpeg")
+  run_test("rotate 90 test", "test_images/test.jpg test_rotate_90.jpg rotate 90", "test_rotate_90_lossless.jpeg")
+  run_test("rotate 180 test", "test_images/test.jpg test_rotate_180.jpg rotate 180", "test_rotate_180_lossless.jpeg")
+  run_test("rotate 270 test", "test_images/test.jpg test_rotate_270.jpg rotate 270", "test_rotate_270_lossless.jpeg")
 
-  run_test("flip H test 1", "test_images/test.jpg test_flip_H.jpg flip H", "test_flip_H.jpeg")
+  run_test("flip H test 1", "test_images/test.jpg test_flip_H.jpg flip H", "test_flip_H_lossless.jpeg")
   run_test("flip H test 2", "test_images/keep_calm.jpg keep_calm_H.jpg flip H", "keep_calm_H.jpeg")
-  run_test("flip V test 1", "test_images/test.jpg test_flip_V.jpg flip V", "test_flip_V.jpeg")
+  run_test("flip V test 1", "test_images/test.jpg test_flip_V.jpg flip V", "test_flip_V_lossless.jpeg")
   run_test("flip V test 2", "test_images/keep_calm.jpg keep_calm_V.jpg flip V", "keep_calm_V.jpeg")
+  run_test("chained rotate and flip test", "test_images/test.jpg chained_rotate_90.jpg rotate 90 flip H flip V rotate 90 flip H flip H rotate 270 rotate 180", "test_rotate_90_lossless.jpeg")
+  run_test("lossless rotate round trip test", "test_images/test.jpg round_trip.jpg rotate 90 rotate 270 flip H flip V rotate 180", "test.jpg")
+  run_test("blur between rotations test", "test_images/test.jpg rotated_blur.jpg rotate 90 blur rotate 270", "test_blur.jpeg")
   
   run_test("blur test 1", "test_images/test.jpg test_blur.jpg blur", "test_blur.jpeg")
   run_test("blur test 2", "test_images/dip.jpg blip.jpg blur", "blip.jpeg")
+  run_test("blur radius 1 test", "test_images/test.jpg r1-test_blur.jpg blur 1", "test_blur.jpeg")
+  run_test("fused blur test", "test_images/test.jpg fused-test_10_blurs.jpg blur blur blur blur blur blur blur blur blur blur", "test_10_blurs.jpeg")
+  run_test("long fused blur test", "test_images/test.jpg fused-test_60_blurs.jpg #{(["blur"] * 60).join(" ")}", "test_60_blurs.jpeg")
   run_test("repeated blur test 1", "test_images/ducks2.jpg need_glasses1.jpg blur", "need_glasses1.jpeg")
   for blur_cnt in 2..10
     run_test("repeated blur test #{blur_cnt}", "need_glasses#{blur_cnt-1}.jpg need_glasses#{blur_cnt}.jpg blur", "need_glasses#{blur_cnt}.jpeg")  
@@ -111,6 +137,44 @@ else
     run_test("repeated blur test #{blur_cnt}", "par-need_glasses#{blur_cnt-1}.jpg par-need_glasses#{blur_cnt}.jpg parallel-blur", "need_glasses#{blur_cnt}.jpeg")  
   end
   
+  run_test("tiled blur test 1", "test_images/test.jpg tiled-test_blur.jpg tiled-blur", "test_blur.jpeg")
+  run_test("tiled blur test 2", "test_images/dip.jpg tiled-blip.jpg tiled-blur", "blip.jpeg")
+
+  run_test("shrink test", "test_images/test.jpg test_shrink_2.jpg shrink 2", "test_shrink_2.jpeg")
+  run_test("shrink after inverts test", "test_images/test.jpg test_inverted_twice_shrink_2.jpg invert invert shrink 2", "test_shrink_2.jpeg")
+  run_test("shrink while loading test", "test_images/test.jpg test_shrink_4.jpg --fast-shrink shrink 2 shrink 2", "test_shrink_4.jpeg")
+  run_test("shrink after invert test", "test_images/test.jpg test_inverted_shrink_2.jpg invert shrink 2", "test_inverted_shrink_2.jpeg")
+
+  run_test("quality and subsampling test", "test_images/test.jpg test_subsampled.jpg --quality 75 --subsample invert", "test_subsampled.jpeg")
+
+  run_test("streamed invert test", "test_images/test.jpg str-test_inverted.jpg --stream invert", "test_inverted.jpeg")
+  run_test("streamed grayscale test", "test_images/test.jpg str-test_grayscale.jpg --stream grayscale", "test_grayscale.jpeg")
+  run_test("streamed flip H test", "test_images/keep_calm.jpg str-keep_calm_H.jpg --stream flip H", "keep_calm_H.jpeg")
+  run_test("streamed blur test", "test_images/dip.jpg str-blip.jpg --stream blur", "blip.jpeg")
+  run_test("streamed chained blur test", "test_images/test.jpg str-test_10_blurs.jpg --stream blur parallel-blur tiled-blur blur 1 blur blur blur blur blur blur", "test_10_blurs.jpeg")
+  run_test("streamed subsampling test", "test_images/test.jpg str-test_subsampled.jpg --stream --quality 75 --subsample invert", "test_subsampled.jpeg")
+  run_test("stream fallback test", "test_images/test.jpg str-test_inverted_shrink_2.jpg --stream invert shrink 2", "test_inverted_shrink_2.jpeg")
+
+  run_test("raw picture save test", "test_images/test.jpg raw-test_blur_1.tcraw blur", nil)
+  run_test("raw picture load and save test", "raw-test_blur_1.tcraw raw-test_blur_5.tcraw blur blur blur blur", nil)
+  run_test("raw picture intermediates test", "raw-test_blur_5.tcraw raw-test_10_blurs.jpg blur blur blur blur blur", "test_10_blurs.jpeg")
+  run_test("raw picture flip test", "test_images/keep_calm.jpg raw-keep_calm_H.tcraw flip H", nil)
+  run_test("raw picture reencode test", "raw-keep_calm_H.tcraw raw-keep_calm_H.jpg --quality 100", "keep_calm_H.jpeg")
+  run_raw_mapping_test("raw picture mapped load test 1", "raw-test_blur_5.tcraw")
+  run_raw_mapping_test("raw picture mapped load test 2", "raw-keep_calm_H.tcraw")
+  run_test("raw picture save over input test 1", "raw-keep_calm_H.tcraw raw-keep_calm_H.tcraw flip H", nil)
+  run_test("raw picture save over input test 2", "raw-keep_calm_H.tcraw raw-keep_calm_H.tcraw flip H", nil)
+  run_test("raw picture reencode over input test", "raw-keep_calm_H.tcraw raw-keep_calm_HH.jpg --quality 100", "keep_calm_H.jpeg")
+
+  run_test("png save test", "test_images/test.jpg png-test_blur_1.png blur", nil)
+  run_test("png intermediates test", "png-test_blur_1.png png-test_10_blurs.jpg blur blur blur blur blur blur blur blur blur", "test_10_blurs.jpeg")
+  run_test("fast png save test", "test_images/test.jpg fpng-test_blur_5.png --fast-png blur blur blur blur blur", nil)
+  run_test("fast png intermediates test", "fpng-test_blur_5.png fpng-test_10_blurs.jpg blur blur blur blur blur", "test_10_blurs.jpeg")
+  run_test("bmp flip test", "test_images/keep_calm.jpg bmp-keep_calm_H.bmp flip H", nil)
+  run_test("bmp reencode test", "bmp-keep_calm_H.bmp bmp-keep_calm_H.jpg --quality 100", "keep_calm_H.jpeg")
+  run_test("ppm streamed invert test", "test_images/test.jpg ppm-test_inverted.ppm --stream invert", nil)
+  run_test("ppm reencode test", "ppm-test_inverted.ppm ppm-test_inverted.jpg --quality 100", "test_inverted.jpeg")
+  
   puts "----------------------------------------"
   puts "           IO ERROR Test Cases          " 
   puts "----------------------------------------"
@@ -130,6 +194,16 @@ else
   
   run_test("flip arg error test", "test_images/test.jpg output.jpg flip O", nil, false)
   
+  run_test("blur arg error test 1", "test_images/test.jpg output.jpg blur 0", nil, false)
+  run_test("blur arg error test 2", "test_images/test.jpg output.jpg blur -3", nil, false)
+
+  run_test("shrink arg error test 1", "test_images/test.jpg output.jpg shrink 3", nil, false)
+  run_test("shrink arg error test 2", "test_images/test.jpg output.jpg shrink 16", nil, false)
+
+  run_test("quality arg error test 1", "test_images/test.jpg output.jpg invert --quality 0", nil, false)
+  run_test("quality arg error test 2", "test_images/test.jpg output.jpg invert --quality 101", nil, false)
+  run_test("quality arg error test 3", "test_images/test.jpg output.jpg invert --quality", nil, false)
+  
   # clean up the files generated by the tests
   system %Q(make clean)
 end
@@ -217,7 +217,7 @@ struct sod_vfs {
 	int(*xExecutable)(const char *);                /* Tells whether the filename is executable */
 	int(*xGetenv)(const char *, SyBlob *);      /* Gets the value of an environment variable */
 	int(*xSetenv)(const char *, const char *);       /* Sets the value of an environment variable */
-	int(*xMmap)(const char *, void **, size_t *); /* Read-only memory map of the whole file */
+	int(*xMmap)(const char *, void **, size_t *); /* Private (copy-on-write) memory map of the whole file */
 	void(*xUnmap)(void *, size_t);                /* Unmap a memory view */
 	void(*xTempDir)(SyBlob *);                 /* Get path of the temporary directory */
 	float(*xTicks)();                          /* High precision timer */
@@ -1497,14 +1497,15 @@ static int WinVfs_Mmap(const char *zPath, void **ppMap, size_t *pSize)
 	/* Get the file size */
 	dwSizeLow = GetFileSize(pHandle, &dwSizeHigh);
 	/* Create the mapping */
-	pMapHandle = CreateFileMappingW(pHandle, 0, PAGE_READONLY, dwSizeHigh, dwSizeLow, 0);
+	pMapHandle = CreateFileMappingW(pHandle, 0, PAGE_WRITECOPY, dwSizeHigh, dwSizeLow, 0);
 	if (pMapHandle == 0) {
 		CloseHandle(pHandle);
 		return -1;
 	}
 	*pSize = ((int64_t)dwSizeHigh << 32) | dwSizeLow;
 	/* Obtain the view */
-	pView = MapViewOfFile(pMapHandle, FILE_MAP_READ, 0, 0, (SIZE_T)(*pSize));
+	/* Writes to a copy-on-write view stay in the process and never reach the file */
+	pView = MapViewOfFile(pMapHandle, FILE_MAP_COPY, 0, 0, (SIZE_T)(*pSize));
 	if (pView) {
 		/* Let the upper layer point to the view */
 		*ppMap = pView;
@@ -1846,8 +1847,9 @@ static int UnixVfs_Mmap(const char *zPath, void **ppMap, size_t *pSize)
 	}
 	/* stat the handle */
 	fstat(fd, &st);
-	/* Obtain a memory view of the whole file */
-	pMap = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* Obtain a memory view of the whole file, whose pages are copied on
+	 * write so that writes stay in the process and never reach the file */
+	pMap = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 	rc = SOD_OK;
 	if (pMap == MAP_FAILED) {
 		rc = -1;
@@ -13530,6 +13532,23 @@ void sod_realnet_destroy(sod_realnet * pNet)
 	_CrtDumpMemoryLeaks();
 #endif /* #ifdSOD_MEM_DEBUG */
 }
+/*
+* Map the whole file at zPath into memory through the built-in VFS (see xMmap). Pages are only
+* read from the file when first touched, and may be written to without changing the file.
+*/
+int sod_vfs_mmap(const char *zPath, void **ppMap, size_t *pSize)
+{
+	const sod_vfs *pVfs = sodExportBuiltinVfs();
+	return pVfs->xMmap(zPath, ppMap, pSize) == SOD_OK ? SOD_OK : SOD_IOERR;
+}
+/*
+* Release a view obtained from sod_vfs_mmap().
+*/
+void sod_vfs_unmap(void *pMap, size_t nSize)
+{
+	const sod_vfs *pVfs = sodExportBuiltinVfs();
+	pVfs->xUnmap(pMap, nSize);
+}
 #ifndef SOD_DISABLE_IMG_READER
 #ifdef _MSC_VER
 /* Disable the nonstandard extension used: non-constant aggregate initializer warning */
@@ -13604,6 +13623,35 @@ sod_img sod_img_load_from_file(const char *zFile, int nChannels)
 	return im;
 }
 /*
+* Let the image decoder spread its work across the threads of xParallel (see ProcParallelJobs),
+* or keep it on the calling thread when xParallel is NULL.
+*/
+void sod_img_set_load_parallel(ProcParallelJobs xParallel, void *pUserData)
+{
+	stbi_set_parallel_on_load(xParallel, pUserData);
+}
+/*
+* Decode the image file straight into the buffer returned by xDest (see ProcImgDest) as
+* interleaved 8-bit pixels, without going through a planar float sod_img. The image is reduced
+* to 1/nScale of its width and height (rounding up), nScale being 1, 2, 4 or 8; JPEG images
+* are decoded at that size directly.
+*/
+int sod_img_load_into(const char *zFile, int nChannels, int nScale, ProcImgDest xDest, void *pUserData)
+{
+	const sod_vfs *pVfs = sodExportBuiltinVfs();
+	void *pMap = 0;
+	size_t sz = 0; /* gcc warn */
+	int c, rc;
+	if (SOD_OK != pVfs->xMmap(zFile, &pMap, &sz)) {
+		rc = stbi_load_into(zFile, xDest, pUserData, &c, nChannels, nScale);
+	}
+	else {
+		rc = stbi_load_from_memory_into((const unsigned char *)pMap, (int)sz, xDest, pUserData, &c, nChannels, nScale);
+		pVfs->xUnmap(pMap, sz);
+	}
+	return rc ? SOD_OK : SOD_UNSUPPORTED;
+}
+/*
 * Extract path fields.
 */
 static int ExtractPathInfo(const char *zPath, size_t nByte, sod_path_info *pOut)
@@ -13825,6 +13873,20 @@ int sod_img_blob_save_as_png(const char * zPath, const unsigned char *zBlob, int
 	return rc ? SOD_OK : SOD_IOERR;
 }
 /*
+* Same as sod_img_blob_save_as_png() for a blob whose rows start nStride bytes apart, deflated at
+* nLevel (1 is the fastest, 8 the default of sod_img_blob_save_as_png(), and higher levels search
+* harder for matches). nFilter is the PNG filter (0 to 4) applied to every row, or a negative value
+* to try all five on each row and keep the one that looks cheapest, which costs five times the
+* filtering. When xParallel is not NULL, bands of rows are filtered, and pieces of the image
+* deflated, concurrently through it (see ProcParallelJobs).
+*/
+int sod_img_blob_save_as_png_stride(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride, int nLevel, int nFilter, ProcParallelJobs xParallel, void *pUserData)
+{
+	int rc;
+	rc = stbi_write_png_parallel(zPath, width, height, nChannels, (const void *)zBlob, nStride, nLevel, nFilter < 0 ? -1 : nFilter, xParallel, pUserData);
+	return rc ? SOD_OK : SOD_IOERR;
+}
+/*
 * CAPIREF: Refer to the official documentation at https://sod.pixlab.io/api.html for the expected parameters this interface takes.
 */
 int sod_img_blob_save_as_jpeg(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int Quality)
@@ -13834,6 +13896,19 @@ int sod_img_blob_save_as_jpeg(const char * zPath, const unsigned char *zBlob, in
 	return rc ? SOD_OK : SOD_IOERR;
 }
 /*
+* Same as sod_img_blob_save_as_jpeg() for a blob whose rows start nStride bytes apart. The encoder
+* reads the rows in place, so no copy of the image is made. When bSubsample is set, the chroma is
+* stored at half the width and height of the image (4:2:0), which takes about half the encoding work.
+* When xParallel is not NULL, bands of the image separated by restart markers are encoded
+* concurrently through it (see ProcParallelJobs).
+*/
+int sod_img_blob_save_as_jpeg_stride(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride, int Quality, int bSubsample, ProcParallelJobs xParallel, void *pUserData)
+{
+	int rc;
+	rc = stbi_write_jpg_parallel(zPath, width, height, nChannels, (const void *)zBlob, nStride, Quality < 0 ? 100 : Quality, bSubsample, xParallel, pUserData);
+	return rc ? SOD_OK : SOD_IOERR;
+}
+/*
 * CAPIREF: Refer to the official documentation at https://sod.pixlab.io/api.html for the expected parameters this interface takes.
 */
 int sod_img_blob_save_as_bmp(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels)
@@ -13842,6 +13917,25 @@ int sod_img_blob_save_as_bmp(const char * zPath, const unsigned char *zBlob, int
 	rc = stbi_write_bmp(zPath, width, height, nChannels, (const void *)zBlob);
 	return rc ? SOD_OK : SOD_IOERR;
 }
+/*
+* Same as sod_img_blob_save_as_bmp() for a blob whose rows start nStride bytes apart.
+*/
+int sod_img_blob_save_as_bmp_stride(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride)
+{
+	int rc;
+	rc = stbi_write_bmp_stride(zPath, width, height, nChannels, (const void *)zBlob, nStride);
+	return rc ? SOD_OK : SOD_IOERR;
+}
+/*
+* Save a blob whose rows start nStride bytes apart as a binary PPM file, or as a PGM file for one or
+* two channels; alpha is dropped. Rows without alpha are written straight from the blob.
+*/
+int sod_img_blob_save_as_ppm(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride)
+{
+	int rc;
+	rc = stbi_write_pnm(zPath, width, height, nChannels, (const void *)zBlob, nStride);
+	return rc ? SOD_OK : SOD_IOERR;
+}
 #endif /* SOD_DISABLE_IMG_WRITER  */
 #endif /* SOD_DISABLE_IMG_READER */
 #ifdef SOD_ENABLE_OPENCV
@@ -167,6 +167,20 @@ typedef void (*ProcRnnCallback)(const char *, size_t, void *);
 * The documentation is available to consult at https://sod.pixlab.io/c_api/sod_cnn_config.html.
 */
 typedef void(*ProcLogCallback)(const char *, size_t, void *);
+/*
+* Destination callback to be used in conjunction with the `sod_img_load_into()` interface.
+* Called with the image width, height and number of channels once they are known, it returns
+* the buffer to decode the interleaved 8-bit pixels into, and sets the distance in bytes between
+* the starts of two consecutive rows. The buffer must hold one byte past the end of the last row.
+*/
+typedef unsigned char *(*ProcImgDest)(void *pUserData, int width, int height, int nChannels, int *pStride);
+/*
+* Worker callback to be used in conjunction with the `sod_img_blob_save_as_jpeg_stride()`,
+* `sod_img_blob_save_as_png_stride()` and `sod_img_set_load_parallel()` interfaces.
+* It must call xJob(pJobData, i) once for each i in [0, nJobs), on any threads, and only return once
+* all of them are done.
+*/
+typedef void (*ProcParallelJobs)(void *pUserData, int nJobs, void (*xJob)(void *, int), void *pJobData);
 /* 
  * Macros to be used in conjunction with the `sod_img_load_from_file()` or `sod_img_load_from_mem()` interfaces.
  */
@@ -270,9 +284,14 @@ SOD_APIEXPORT sod_img sod_make_random_image(int w, int h, int c);
 SOD_APIEXPORT sod_img sod_copy_image(sod_img m);
 SOD_APIEXPORT void sod_free_image(sod_img m);
 
+SOD_APIEXPORT int sod_vfs_mmap(const char *zPath, void **ppMap, size_t *pSize);
+SOD_APIEXPORT void sod_vfs_unmap(void *pMap, size_t nSize);
+
 #ifndef SOD_DISABLE_IMG_READER
 SOD_APIEXPORT sod_img sod_img_load_from_file(const char *zFile, int nChannels);
 SOD_APIEXPORT sod_img sod_img_load_from_mem(const unsigned char *zBuf, int buf_len, int nChannels);
+SOD_APIEXPORT int sod_img_load_into(const char *zFile, int nChannels, int nScale, ProcImgDest xDest, void *pUserData);
+SOD_APIEXPORT void sod_img_set_load_parallel(ProcParallelJobs xParallel, void *pUserData);
 SOD_APIEXPORT int  sod_img_set_load_from_directory(const char *zPath, sod_img ** apLoaded, int * pnLoaded, int max_entries);
 SOD_APIEXPORT void sod_img_set_release(sod_img *aLoaded, int nEntries);
 #ifndef SOD_DISABLE_IMG_WRITER
@@ -280,7 +299,11 @@ SOD_APIEXPORT int sod_img_save_as_png(sod_img input, const char *zPath);
 SOD_APIEXPORT int sod_img_save_as_jpeg(sod_img input, const char *zPath, int Quality);
 SOD_APIEXPORT int sod_img_blob_save_as_png(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels);
 SOD_APIEXPORT int sod_img_blob_save_as_jpeg(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int Quality);
+SOD_APIEXPORT int sod_img_blob_save_as_jpeg_stride(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride, int Quality, int bSubsample, ProcParallelJobs xParallel, void *pUserData);
 SOD_APIEXPORT int sod_img_blob_save_as_bmp(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels);
+SOD_APIEXPORT int sod_img_blob_save_as_png_stride(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride, int nLevel, int nFilter, ProcParallelJobs xParallel, void *pUserData);
+SOD_APIEXPORT int sod_img_blob_save_as_bmp_stride(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride);
+SOD_APIEXPORT int sod_img_blob_save_as_ppm(const char * zPath, const unsigned char *zBlob, int width, int height, int nChannels, int nStride);
 #endif /* SOD_DISABLE_IMG_WRITER */
 #define sod_img_load_color(zPath) sod_img_load_from_file(zPath, SOD_IMG_COLOR)
 #define sod_img_load_grayscale(zPath) sod_img_load_from_file(zPath, SOD_IMG_GRAYSCALE)
@@ -382,6 +382,32 @@ extern "C" {
 	// for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+	////////////////////////////////////
+	//
+	// 8-bits-per-channel interface, decoding into a caller-provided buffer
+	//
+	// Once the size of the image is known, 'dest' is called with the image
+	// width, height and number of channels in the output, and returns the
+	// buffer to decode into, setting *stride_in_bytes to the distance between
+	// the starts of two consecutive rows. The buffer must hold one byte past
+	// the end of the last row. JPEG and simple (8-bit, non-interlaced,
+	// unpaletted) PNG images are decoded straight into it; other images are
+	// decoded as usual and then copied. Returns 1 on success, 0 on failure
+	// (which may come after 'dest' was called).
+	//
+	// 'scale' reduces the image to 1/scale of its size in each direction
+	// (rounding up), for scale 1, 2, 4 or 8. JPEG images are decoded at the
+	// reduced size to begin with, using smaller IDCTs; other images are
+	// decoded in full and averaged down.
+
+	typedef stbi_uc *stbi_dest_func(void *user, int x, int y, int channels, int *stride_in_bytes);
+
+	STBIDEF int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_dest_func *dest, void *user, int *channels_in_file, int desired_channels, int scale);
+
+#ifndef STBI_NO_STDIO
+	STBIDEF int stbi_load_into(char const *filename, stbi_dest_func *dest, void *user, int *channels_in_file, int desired_channels, int scale);
+#endif
+
 	////////////////////////////////////
 	//
 	// 16-bits-per-channel interface
@@ -448,6 +474,45 @@ extern "C" {
 	STBIDEF int      stbi_is_16_bit_from_file(FILE *f);
 #endif
 
+#ifndef STBI_NO_JPEG
+	// quantized DCT coefficients of a JPEG image, as needed for lossless transforms
+	typedef struct
+	{
+		int x, y;   // image size in pixels
+		int comp;   // number of components, 1 (grey) or 3 (YCbCr)
+		struct
+		{
+			int id;                 // component identifier from the frame header
+			int h, v;               // sampling factors (1x1 for a single component)
+			int blocks_w, blocks_h; // number of 8x8 blocks coded for this component
+			int coeff_stride;       // number of blocks between two rows of blocks in coeff
+			stbi_us quant[64];      // quantization table, natural order
+			short *coeff;           // 64 quantized coefficients per block, natural order
+			void *raw_coeff;        // allocation coeff points into
+		} component[4];
+	} stbi_jpeg_coefficients;
+
+#ifndef STBI_NO_STDIO
+	// read the quantized coefficients of a baseline or progressive JPEG without
+	// running the IDCT; returns 0 for files that are not grey or YCbCr JPEGs
+	STBIDEF int      stbi_jpeg_load_coefficients(char const *filename, stbi_jpeg_coefficients *coefficients);
+#endif
+	STBIDEF void     stbi_jpeg_free_coefficients(stbi_jpeg_coefficients *coefficients);
+
+#ifndef STBI_NO_STDIO
+	// decode a baseline JPEG a band of rows at a time, keeping only a few MCU
+	// rows of it in memory: open reads the headers, up to the first scan, and
+	// fails unless that scan holds every component (neither progressive nor
+	// with the components in separate scans); each read then writes the next
+	// *band_rows rows of the image to out, or fewer for the last band, and
+	// returns how many it wrote, 0 once the image is done or if it fails
+	typedef struct stbi__jpeg_stream stbi_jpeg_stream;
+	STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open(char const *filename, int desired_channels, int *x, int *y, int *band_rows);
+	STBIDEF int      stbi_jpeg_stream_read(stbi_jpeg_stream *stream, stbi_uc *out, int stride_in_bytes);
+	STBIDEF void     stbi_jpeg_stream_close(stbi_jpeg_stream *stream);
+#endif
+#endif
+
 
 
 	// for image formats that explicitly notate that they have premultiplied alpha,
@@ -462,6 +527,15 @@ extern "C" {
 	// flip the image vertically, so the first pixel in the output array is the bottom left
 	STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+	// let the JPEG decoder spread its work across threads: 'parallel' must run
+	// job(job_context, i) once for each i in [0, count), on any threads, and
+	// return when all of them are done. Segments between restart markers are
+	// then decoded concurrently (for images in memory), and the IDCT,
+	// upsampling and color conversion run in parallel stripes. NULL (the
+	// default) decodes on the calling thread only.
+	typedef void stbi_parallel_func(void *context, int count, void(*job)(void *job_context, int index), void *job_context);
+	STBIDEF void stbi_set_parallel_on_load(stbi_parallel_func *parallel, void *context);
+
 	// ZLIB client - used by PNG, available for other purposes
 
 	STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -683,6 +757,22 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// x86 AVX2
+// the AVX2 kernels are compiled with a per-function target attribute instead
+// of -mavx2, so the rest of the library still runs on any SSE2 machine, and
+// they are only selected when the CPU (and OS) reports AVX2 support.
+// #define STBI_NO_AVX2 to leave them out.
+#if defined(STBI_SSE2) && (defined(__GNUC__) || defined(__clang__)) && !defined(STBI_NO_AVX2)
+#define STBI_AVX2
+#include <immintrin.h>
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+
+static int stbi__avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -718,6 +808,16 @@ typedef struct
 
 	stbi_uc *img_buffer, *img_buffer_end;
 	stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+	// caller-provided output buffer for stbi_load_into, and the buffer it
+	// returned once the decoder asked for it
+	stbi_dest_func *dest;
+	void *dest_user;
+	stbi_uc *dest_out;
+
+	// log2 of the factor to reduce the image by, until a decoder has taken
+	// it on; whatever is left is averaged down by stbi__load_into
+	int shrink;
 } stbi__context;
 
 
@@ -728,6 +828,9 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
 	s->io.read = NULL;
 	s->read_from_callbacks = 0;
+	s->dest = NULL;
+	s->dest_out = NULL;
+	s->shrink = 0;
 	s->img_buffer = s->img_buffer_original = (stbi_uc *)buffer;
 	s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *)buffer + len;
 }
@@ -737,6 +840,9 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
 {
 	s->io = *c;
 	s->io_user_data = user;
+	s->dest = NULL;
+	s->dest_out = NULL;
+	s->shrink = 0;
 	s->buflen = sizeof(s->buffer_start);
 	s->read_from_callbacks = 1;
 	s->img_buffer_original = s->buffer_start;
@@ -856,8 +962,27 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
-// this is not threadsafe
-static const char *stbi__g_failure_reason;
+// each thread has a failure reason of its own where the compiler allows it, so
+// that decoders running jobs in parallel (see stbi_set_parallel_on_load) don't
+// race to set it; define STBI_NO_THREAD_LOCALS to share one between threads
+#ifndef STBI_NO_THREAD_LOCALS
+	#if defined(__cplusplus) && __cplusplus >= 201103L
+		#define STBI_THREAD_LOCAL thread_local
+	#elif defined(__GNUC__) && __GNUC__ < 5
+		#define STBI_THREAD_LOCAL __thread
+	#elif defined(_MSC_VER)
+		#define STBI_THREAD_LOCAL __declspec(thread)
+	#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+		#define STBI_THREAD_LOCAL _Thread_local
+	#elif defined(__GNUC__)
+		#define STBI_THREAD_LOCAL __thread
+	#endif
+#endif
+#ifndef STBI_THREAD_LOCAL
+	#define STBI_THREAD_LOCAL
+#endif
+
+static STBI_THREAD_LOCAL const char *stbi__g_failure_reason;
 
 STBIDEF const char *stbi_failure_reason(void)
 {
@@ -942,6 +1067,19 @@ static void *stbi__malloc_mad3(int a, int b, int c, int add)
 	return stbi__malloc(a*b*c + add);
 }
 
+// get the buffer an 8-bit decoder writes its final pixels into: the caller's
+// buffer when loading with stbi_load_into, otherwise a new allocation with
+// 'add' bytes to spare; the decoder writes row j at output + j * *stride
+static stbi_uc *stbi__get_output(stbi__context *s, int comp, int add, int *stride)
+{
+	if (s->dest) {
+		s->dest_out = s->dest(s->dest_user, s->img_x, s->img_y, comp, stride);
+		return s->dest_out;
+	}
+	*stride = comp * s->img_x;
+	return (stbi_uc *)stbi__malloc_mad3(comp, s->img_x, s->img_y, add);
+}
+
 #if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR)
 static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 {
@@ -985,6 +1123,15 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 	stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+static stbi_parallel_func *stbi__parallel_on_load = NULL;
+static void *stbi__parallel_on_load_context = NULL;
+
+STBIDEF void stbi_set_parallel_on_load(stbi_parallel_func *parallel, void *context)
+{
+	stbi__parallel_on_load = parallel;
+	stbi__parallel_on_load_context = context;
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
 	memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1249,6 +1396,83 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
 	return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+// average each 2^shrink x 2^shrink block of a packed x by y image into one
+// pixel of out, the blocks on the right and bottom edges being cut short
+static void stbi__shrink_image(stbi_uc *out, int stride, stbi_uc const *in, int x, int y, int channels, int shrink)
+{
+	int i, j, c, u, v;
+	int f = 1 << shrink;
+	for (j = 0; j < (y + f - 1) >> shrink; ++j) {
+		int v0 = j << shrink, v1 = v0 + f < y ? v0 + f : y;
+		for (i = 0; i < (x + f - 1) >> shrink; ++i) {
+			int u0 = i << shrink, u1 = u0 + f < x ? u0 + f : x;
+			unsigned int count = (v1 - v0) * (u1 - u0);
+			for (c = 0; c < channels; ++c) {
+				unsigned int sum = count / 2;
+				for (v = v0; v < v1; ++v)
+					for (u = u0; u < u1; ++u)
+						sum += in[((size_t)v * x + u) * channels + c];
+				out[(size_t)stride * j + i * channels + c] = (stbi_uc)(sum / count);
+			}
+		}
+	}
+}
+
+static int stbi__load_into(stbi__context *s, stbi_dest_func *dest, void *user, int *comp, int req_comp, int scale)
+{
+	int x, y, n, channels, stride, j;
+	stbi_uc *result, *out;
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8) return stbi__err("bad scale", "Internal error");
+	s->shrink = (scale > 1) + (scale > 2) + (scale > 4);
+	// flipping on load works on a packed image, so decode it as usual
+	s->dest = stbi__vertically_flip_on_load ? NULL : dest;
+	s->dest_user = user;
+	s->dest_out = NULL;
+	result = stbi__load_and_postprocess_8bit(s, &x, &y, &n, req_comp);
+	if (result == NULL) return 0;
+	if (comp) *comp = n;
+	if (result == s->dest_out) return 1;
+
+	// the decoder couldn't write into the caller's buffer, copy the image
+	// over, reducing it if the decoder didn't
+	channels = req_comp ? req_comp : n;
+	if (s->shrink)
+		out = dest(user, (x + scale - 1) >> s->shrink, (y + scale - 1) >> s->shrink, channels, &stride);
+	else
+		out = dest(user, x, y, channels, &stride);
+	if (out) {
+		if (s->shrink)
+			stbi__shrink_image(out, stride, result, x, y, channels, s->shrink);
+		else
+			for (j = 0; j < y; ++j)
+				memcpy(out + (size_t)stride * j, result + (size_t)x * channels * j, (size_t)x * channels);
+	}
+	STBI_FREE(result);
+	if (!out) return stbi__err("outofmem", "Out of memory");
+	return 1;
+}
+
+STBIDEF int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_dest_func *dest, void *user, int *comp, int req_comp, int scale)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_into(&s, dest, user, comp, req_comp, scale);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into(char const *filename, stbi_dest_func *dest, void *user, int *comp, int req_comp, int scale)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	stbi__context s;
+	int result;
+	if (!f) return stbi__err("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__load_into(&s, dest, user, comp, req_comp, scale);
+	fclose(f);
+	return result;
+}
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1743,6 +1967,9 @@ typedef struct
 		stbi_uc *linebuf;
 		short   *coeff;   // progressive only
 		int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
+		int      deferred;         // baseline blocks kept in coeff until stbi__jpeg_finish
+		int      shrink;           // log2 of the factor the IDCT reduces its blocks by
+		int      window;           // rows of blocks kept in data when streaming, 0 for all of them
 	} img_comp[4];
 
 	stbi__uint32   code_buffer; // jpeg entropy-coded buffer
@@ -1763,6 +1990,10 @@ typedef struct
 	int scan_n, order[4];
 	int restart_interval, todo;
 
+	int coeff_only;   // keep the quantized coefficients of every scan, skip the IDCT
+	int shrink;       // log2 of the factor the image is reduced by
+	int stream;       // decode an MCU row at a time, into a window of the component planes
+
 	// kernels
 	void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
 	void(*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -1968,6 +2199,15 @@ static const stbi_uc stbi__jpeg_dezigzag[64 + 15] =
 	63, 63, 63, 63, 63, 63, 63
 };
 
+// dequantization table that leaves the coefficients quantized, for coeff_only
+static const stbi__uint16 stbi__jpeg_unit_dequant[64] =
+{
+	1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1
+};
+
 // decode one 64-entry block--
 static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi__uint16 *dequant)
 {
@@ -2289,6 +2529,92 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
 	}
 }
 
+// reduced-size IDCTs, after the IJG's jidctred.c, for decoding at 1/2, 1/4
+// and 1/8 scale: each output pixel stands for a 2x2, 4x4 or 8x8 square of the
+// full-size block, and the coefficients that can't reach it are skipped
+#define stbi__f2f13(x)      ((int) (((x) * 8192 + 0.5)))
+#define stbi__descale(x,n)  (((x) + (1 << ((n) - 1))) >> (n))
+
+static void stbi__idct_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+	int i, t0, t2, t10, t12, val[32], *v = val;
+	stbi_uc *o;
+	short *d = data;
+
+	// columns, keeping 2 extra bits of precision; column 4 is not needed
+	for (i = 0; i < 8; ++i, ++d, ++v) {
+		if (i == 4) continue;
+		if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+			v[0] = v[8] = v[16] = v[24] = d[0] * 4;
+			continue;
+		}
+		t0 = d[0] * (1 << 14);
+		t2 = d[16] * stbi__f2f13(1.847759065) - d[48] * stbi__f2f13(0.765366865);
+		t10 = t0 + t2;
+		t12 = t0 - t2;
+		t0 = d[8] * stbi__f2f13(1.061594337) - d[24] * stbi__f2f13(2.172734803)
+			+ d[40] * stbi__f2f13(1.451774981) - d[56] * stbi__f2f13(0.211164243);
+		t2 = d[8] * stbi__f2f13(2.562915447) + d[24] * stbi__f2f13(0.899976223)
+			- d[40] * stbi__f2f13(0.601344887) - d[56] * stbi__f2f13(0.509795579);
+		v[0] = stbi__descale(t10 + t2, 12);
+		v[24] = stbi__descale(t10 - t2, 12);
+		v[8] = stbi__descale(t12 + t0, 12);
+		v[16] = stbi__descale(t12 - t0, 12);
+	}
+
+	// rows, removing the precision bits and the 1/8 scale of the 2D IDCT
+	for (i = 0, v = val, o = out; i < 4; ++i, v += 8, o += out_stride) {
+		t0 = v[0] * (1 << 14);
+		t2 = v[2] * stbi__f2f13(1.847759065) - v[6] * stbi__f2f13(0.765366865);
+		t10 = t0 + t2;
+		t12 = t0 - t2;
+		t0 = v[1] * stbi__f2f13(1.061594337) - v[3] * stbi__f2f13(2.172734803)
+			+ v[5] * stbi__f2f13(1.451774981) - v[7] * stbi__f2f13(0.211164243);
+		t2 = v[1] * stbi__f2f13(2.562915447) + v[3] * stbi__f2f13(0.899976223)
+			- v[5] * stbi__f2f13(0.601344887) - v[7] * stbi__f2f13(0.509795579);
+		o[0] = stbi__clamp(stbi__descale(t10 + t2, 19) + 128);
+		o[3] = stbi__clamp(stbi__descale(t10 - t2, 19) + 128);
+		o[1] = stbi__clamp(stbi__descale(t12 + t0, 19) + 128);
+		o[2] = stbi__clamp(stbi__descale(t12 - t0, 19) + 128);
+	}
+}
+
+static void stbi__idct_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+	int i, t0, t10, val[16], *v = val;
+	stbi_uc *o;
+	short *d = data;
+
+	// columns, of which only the odd ones and column 0 are needed
+	for (i = 0; i < 8; ++i, ++d, ++v) {
+		if (i == 2 || i == 4 || i == 6) continue;
+		if (d[8] == 0 && d[24] == 0 && d[40] == 0 && d[56] == 0) {
+			v[0] = v[8] = d[0] * 4;
+			continue;
+		}
+		t10 = d[0] * (1 << 15);
+		t0 = d[8] * stbi__f2f13(3.624509785) - d[24] * stbi__f2f13(1.272758580)
+			+ d[40] * stbi__f2f13(0.850430095) - d[56] * stbi__f2f13(0.720959822);
+		v[0] = stbi__descale(t10 + t0, 13);
+		v[8] = stbi__descale(t10 - t0, 13);
+	}
+
+	for (i = 0, v = val, o = out; i < 2; ++i, v += 8, o += out_stride) {
+		t10 = v[0] * (1 << 15);
+		t0 = v[1] * stbi__f2f13(3.624509785) - v[3] * stbi__f2f13(1.272758580)
+			+ v[5] * stbi__f2f13(0.850430095) - v[7] * stbi__f2f13(0.720959822);
+		o[0] = stbi__clamp(stbi__descale(t10 + t0, 20) + 128);
+		o[1] = stbi__clamp(stbi__descale(t10 - t0, 20) + 128);
+	}
+}
+
+static void stbi__idct_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+	STBI_NOTUSED(out_stride);
+	// the average of the block is its DC term over 8
+	out[0] = stbi__clamp(stbi__descale(data[0], 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2470,6 +2796,181 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT. the rows stay 8x16-bit as in the sse2 version, but the
+// 32-bit intermediates of all eight columns fit in one register, which halves
+// the widened arithmetic. bit-identical to stbi__idct_simd.
+static STBI__AVX2_TARGET void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+{
+	__m128i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m128i tmp;
+
+	// dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_set1_epi32((int) (((unsigned) (y) << 16) | ((unsigned) (x) & 0xffff)))
+
+	// out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+	// out(1) = c1[even]*x + c1[odd]*y
+	// with columns 0-3 in the low half and 4-7 in the high half
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+	// out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+	// wide add
+#define dct_wadd(out, a, b) \
+      __m256i out = _mm256_add_epi32(a, b)
+
+	// wide sub
+#define dct_wsub(out, a, b) \
+      __m256i out = _mm256_sub_epi32(a, b)
+
+	// butterfly a/b, add bias, then shift by "s" and pack; packs works within
+	// each 128-bit half, so the permute puts the columns back in order
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, dif), 0xd8); \
+         out0 = _mm256_castsi256_si128(packed); \
+         out1 = _mm256_extracti128_si256(packed, 1); \
+      }
+
+	// 8-bit interleave step (for transposes)
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+	// 16-bit interleave step (for transposes)
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+	__m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+	__m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+	__m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+	__m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+	__m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+	__m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+	__m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+	__m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+	// rounding biases in column/row passes, see stbi__idct_block for explanation.
+	__m256i bias_0 = _mm256_set1_epi32(512);
+	__m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+	// load
+	row0 = _mm_load_si128((const __m128i *) (data + 0 * 8));
+	row1 = _mm_load_si128((const __m128i *) (data + 1 * 8));
+	row2 = _mm_load_si128((const __m128i *) (data + 2 * 8));
+	row3 = _mm_load_si128((const __m128i *) (data + 3 * 8));
+	row4 = _mm_load_si128((const __m128i *) (data + 4 * 8));
+	row5 = _mm_load_si128((const __m128i *) (data + 5 * 8));
+	row6 = _mm_load_si128((const __m128i *) (data + 6 * 8));
+	row7 = _mm_load_si128((const __m128i *) (data + 7 * 8));
+
+	// column pass
+	dct_pass(bias_0, 10);
+
+	{
+		// 16bit 8x8 transpose pass 1
+		dct_interleave16(row0, row4);
+		dct_interleave16(row1, row5);
+		dct_interleave16(row2, row6);
+		dct_interleave16(row3, row7);
+
+		// transpose pass 2
+		dct_interleave16(row0, row2);
+		dct_interleave16(row1, row3);
+		dct_interleave16(row4, row6);
+		dct_interleave16(row5, row7);
+
+		// transpose pass 3
+		dct_interleave16(row0, row1);
+		dct_interleave16(row2, row3);
+		dct_interleave16(row4, row5);
+		dct_interleave16(row6, row7);
+	}
+
+	// row pass
+	dct_pass(bias_1, 17);
+
+	{
+		// pack
+		__m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+		__m128i p1 = _mm_packus_epi16(row2, row3);
+		__m128i p2 = _mm_packus_epi16(row4, row5);
+		__m128i p3 = _mm_packus_epi16(row6, row7);
+
+		// 8bit 8x8 transpose pass 1
+		dct_interleave8(p0, p2); // a0e0a1e1...
+		dct_interleave8(p1, p3); // c0g0c1g1...
+
+		// transpose pass 2
+		dct_interleave8(p0, p1); // a0c0e0g0...
+		dct_interleave8(p2, p3); // b0d0f0h0...
+
+		// transpose pass 3
+		dct_interleave8(p0, p2); // a0b0c0d0...
+		dct_interleave8(p1, p3); // a4b4c4d4...
+
+		// store
+		_mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+	}
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2712,68 +3213,206 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
 	// since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+// idct block (i, j) of component n into its pixels, whose blocks are only
+// 8 >> shrink pixels a side when the image is being reduced
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int i, int j, short data[64])
 {
-	stbi__jpeg_reset(z);
-	if (!z->progressive) {
-		if (z->scan_n == 1) {
-			int i, j;
-			STBI_SIMD_ALIGN(short, data[64]);
-			int n = z->order[0];
-			// non-interleaved data, we just need to process one block at a time,
-			// in trivial scanline order
-			// number of blocks to do just depends on how many actual "pixels" this
-			// component has, independent of interleaved MCU blocking and such
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j) {
-				for (i = 0; i < w; ++i) {
-					int ha = z->img_comp[n].ha;
-					if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
-					// every data block is an MCU, so countdown the restart interval
-					if (--z->todo <= 0) {
-						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-						// if it's NOT a restart, then just bail, so we get corrupt data
-						// rather than no data
-						if (!STBI__RESTART(z->marker)) return 1;
-						stbi__jpeg_reset(z);
-					}
-				}
+	static void(*const reduced_idct[3])(stbi_uc *out, int out_stride, short data[64]) = { stbi__idct_4x4, stbi__idct_2x2, stbi__idct_1x1 };
+	int shrink = z->img_comp[n].shrink, size = 8 >> shrink;
+	stbi_uc *out;
+	if (z->img_comp[n].window) j %= z->img_comp[n].window;
+	out = z->img_comp[n].data + z->img_comp[n].w2*j*size + i*size;
+	if (shrink)
+		reduced_idct[shrink - 1](out, z->img_comp[n].w2, data);
+	else
+		z->idct_block_kernel(out, z->img_comp[n].w2, data);
+}
+
+// number of MCUs in the current scan; a scan of a single component is not
+// interleaved, so each of its blocks is an MCU
+static int stbi__jpeg_scan_mcus(stbi__jpeg *z)
+{
+	if (z->scan_n == 1) {
+		int n = z->order[0];
+		return ((z->img_comp[n].x + 7) >> 3) * ((z->img_comp[n].y + 7) >> 3);
+	}
+	return z->img_mcu_x * z->img_mcu_y;
+}
+
+// decode MCUs [first, last) of a baseline scan, starting at the current
+// position in the entropy-coded data
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int last)
+{
+	STBI_SIMD_ALIGN(short, buffer[64]);
+	int m;
+	if (z->scan_n == 1) {
+		int n = z->order[0];
+		int ha = z->img_comp[n].ha;
+		int keep = z->coeff_only || z->img_comp[n].deferred;
+		const stbi__uint16 *dequant = z->coeff_only ? stbi__jpeg_unit_dequant : z->dequant[z->img_comp[n].tq];
+		// non-interleaved data, we just need to process one block at a time,
+		// in trivial scanline order
+		// number of blocks to do just depends on how many actual "pixels" this
+		// component has, independent of interleaved MCU blocking and such
+		int w = (z->img_comp[n].x + 7) >> 3;
+		int i = first % w, j = first / w;
+		for (m = first; m < last; ++m) {
+			short *data = keep ? z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w) : buffer;
+			if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, (stbi__uint16 *)dequant)) return 0;
+			if (!keep)
+				stbi__jpeg_idct(z, n, i, j, data);
+			// every data block is an MCU, so countdown the restart interval
+			if (--z->todo <= 0) {
+				if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+				// if it's NOT a restart, then just bail, so we get corrupt data
+				// rather than no data
+				if (!STBI__RESTART(z->marker)) return 1;
+				stbi__jpeg_reset(z);
 			}
-			return 1;
+			if (++i == w) i = 0, ++j;
 		}
-		else { // interleaved
-			int i, j, k, x, y;
-			STBI_SIMD_ALIGN(short, data[64]);
-			for (j = 0; j < z->img_mcu_y; ++j) {
-				for (i = 0; i < z->img_mcu_x; ++i) {
-					// scan an interleaved mcu... process scan_n components in order
-					for (k = 0; k < z->scan_n; ++k) {
-						int n = z->order[k];
-						// scan out an mcu's worth of this component; that's just determined
-						// by the basic H and V specified for the component
-						for (y = 0; y < z->img_comp[n].v; ++y) {
-							for (x = 0; x < z->img_comp[n].h; ++x) {
-								int x2 = (i*z->img_comp[n].h + x) * 8;
-								int y2 = (j*z->img_comp[n].v + y) * 8;
-								int ha = z->img_comp[n].ha;
-								if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-								z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
-							}
-						}
-					}
-					// after all interleaved components, that's an interleaved MCU,
-					// so now count down the restart interval
-					if (--z->todo <= 0) {
-						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-						if (!STBI__RESTART(z->marker)) return 1;
-						stbi__jpeg_reset(z);
+		return 1;
+	}
+	else { // interleaved
+		int k, x, y;
+		int i = first % z->img_mcu_x, j = first / z->img_mcu_x;
+		for (m = first; m < last; ++m) {
+			// scan an interleaved mcu... process scan_n components in order
+			for (k = 0; k < z->scan_n; ++k) {
+				int n = z->order[k];
+				int ha = z->img_comp[n].ha;
+				int keep = z->coeff_only || z->img_comp[n].deferred;
+				const stbi__uint16 *dequant = z->coeff_only ? stbi__jpeg_unit_dequant : z->dequant[z->img_comp[n].tq];
+				// scan out an mcu's worth of this component; that's just determined
+				// by the basic H and V specified for the component
+				for (y = 0; y < z->img_comp[n].v; ++y) {
+					for (x = 0; x < z->img_comp[n].h; ++x) {
+						int x2 = i*z->img_comp[n].h + x;
+						int y2 = j*z->img_comp[n].v + y;
+						short *data = keep ? z->img_comp[n].coeff + 64 * (x2 + y2 * z->img_comp[n].coeff_w) : buffer;
+						if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, (stbi__uint16 *)dequant)) return 0;
+						if (!keep)
+							stbi__jpeg_idct(z, n, x2, y2, data);
 					}
 				}
 			}
-			return 1;
+			// after all interleaved components, that's an interleaved MCU,
+			// so now count down the restart interval
+			if (--z->todo <= 0) {
+				if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+				if (!STBI__RESTART(z->marker)) return 1;
+				stbi__jpeg_reset(z);
+			}
+			if (++i == z->img_mcu_x) i = 0, ++j;
+		}
+		return 1;
+	}
+}
+
+// the restart intervals of a baseline scan, decoded as independent jobs
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi_uc **start, **end; // entropy-coded data of each interval
+	stbi_uc *failed;        // whether each interval failed, set by its own job
+	int total;              // MCUs in the scan
+} stbi__jpeg_restarts;
+
+static void stbi__jpeg_decode_restart(void *context, int index)
+{
+	stbi__jpeg_restarts *r = (stbi__jpeg_restarts *)context;
+	int first = index * r->z->restart_interval;
+	int last = first + r->z->restart_interval;
+	stbi__context s;
+	// a private copy of the decoder state; the tables are only read, and
+	// every block of the component planes is written by a single interval
+	stbi__jpeg *z = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	r->failed[index] = 1;
+	if (!z) return;
+	*z = *r->z;
+	stbi__start_mem(&s, r->start[index], (int)(r->end[index] - r->start[index]));
+	z->s = &s;
+	stbi__jpeg_reset(z);
+	r->failed[index] = !stbi__jpeg_decode_mcus(z, first, last < r->total ? last : r->total);
+	STBI_FREE(z);
+}
+
+// decode the restart intervals of a baseline scan in parallel; returns 1 once
+// it has, or -1 if the scan can't be split that way or an interval failed to
+// decode, leaving the scan to the serial decoder, which then reports why on
+// the calling thread
+static int stbi__jpeg_decode_restarts(stbi__jpeg *z)
+{
+	stbi__context *s = z->s;
+	stbi__jpeg_restarts r;
+	stbi_uc *p, *q, *marker = NULL;
+	int count, i = 0;
+
+	// the entropy-coded data must be in memory to find its restart markers
+	if (!stbi__parallel_on_load || !z->restart_interval || s->read_from_callbacks) return -1;
+	r.z = z;
+	r.total = stbi__jpeg_scan_mcus(z);
+	count = (r.total + z->restart_interval - 1) / z->restart_interval;
+	if (count < 2) return -1;
+	r.start = (stbi_uc **)stbi__malloc_mad2(count, 2 * sizeof(stbi_uc *) + 1, 0);
+	if (!r.start) return -1;
+	r.end = r.start + count;
+	r.failed = (stbi_uc *)(r.end + count);
+
+	// the data runs up to the first marker that is not RSTn, skipping
+	// stuffed zero bytes and fill bytes
+	r.start[0] = p = s->img_buffer;
+	while ((p = (stbi_uc *)memchr(p, 0xff, s->img_buffer_end - p)) != NULL) {
+		for (q = p + 1; q < s->img_buffer_end && *q == 0xff; ++q);
+		if (q == s->img_buffer_end) break;
+		if (*q == 0) { p = q + 1; continue; }
+		r.end[i++] = p;
+		if (*q < 0xd0 || *q > 0xd7 || i == count) { marker = q - 1; break; }
+		r.start[i] = p = q + 1;
+	}
+	// otherwise truncated or with a different number of intervals, which the
+	// serial decoder copes with
+	if (!marker || i != count || STBI__RESTART(*q)) {
+		STBI_FREE(r.start);
+		return -1;
+	}
+
+	stbi__parallel_on_load(stbi__parallel_on_load_context, count, stbi__jpeg_decode_restart, &r);
+	for (i = 0; i < count && !r.failed[i]; ++i);
+	STBI_FREE(r.start);
+	if (i < count) return -1;
+
+	// carry on from the marker after the scan
+	s->img_buffer = marker;
+	z->marker = STBI__MARKER_none;
+	return 1;
+}
+
+// keep the blocks of a baseline scan in coeff, so that stbi__jpeg_finish can
+// run their IDCT in parallel
+static void stbi__jpeg_defer_idct(stbi__jpeg *z)
+{
+	int k;
+	if (!stbi__parallel_on_load || z->coeff_only) return;
+	for (k = 0; k < z->scan_n; ++k) {
+		int n = z->order[k];
+		if (!z->img_comp[n].raw_coeff) {
+			z->img_comp[n].raw_coeff = stbi__malloc_mad3(z->img_comp[n].coeff_w * 8, z->img_comp[n].coeff_h * 8, sizeof(short), 15);
+			if (!z->img_comp[n].raw_coeff) continue; // decode this one directly
+			z->img_comp[n].coeff = (short*)(((size_t)z->img_comp[n].raw_coeff + 15) & ~15);
 		}
+		z->img_comp[n].deferred = 1;
+	}
+}
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+	stbi__jpeg_reset(z);
+	if (!z->progressive) {
+		int r = stbi__jpeg_decode_restarts(z);
+		if (r >= 0) return r;
+		stbi__jpeg_defer_idct(z);
+		return stbi__jpeg_decode_mcus(z, 0, stbi__jpeg_scan_mcus(z));
 	}
 	else {
 		if (z->scan_n == 1) {
@@ -2847,25 +3486,46 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
 		data[i] *= dequant[i];
 }
 
-static void stbi__jpeg_finish(stbi__jpeg *z)
+// whether the IDCT of component n was left for stbi__jpeg_finish
+static int stbi__jpeg_finishes(stbi__jpeg *z, int n)
 {
-	if (z->progressive) {
-		// dequantize and idct the data
-		int i, j, n;
-		for (n = 0; n < z->s->img_n; ++n) {
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j) {
-				for (i = 0; i < w; ++i) {
-					short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-					stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
-				}
-			}
-		}
+	return z->progressive || z->img_comp[n].deferred;
+}
+
+// dequantize (progressive only, baseline blocks are kept dequantized) and
+// idct one row of blocks, counting the rows of all finished components in turn
+static void stbi__jpeg_finish_row(void *context, int index)
+{
+	stbi__jpeg *z = (stbi__jpeg *)context;
+	int i, n, w;
+	for (n = 0; n < z->s->img_n; ++n) {
+		int h = (z->img_comp[n].y + 7) >> 3;
+		if (!stbi__jpeg_finishes(z, n)) continue;
+		if (index < h) break;
+		index -= h;
+	}
+	w = (z->img_comp[n].x + 7) >> 3;
+	for (i = 0; i < w; ++i) {
+		short *data = z->img_comp[n].coeff + 64 * (i + index * z->img_comp[n].coeff_w);
+		if (z->progressive)
+			stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+		stbi__jpeg_idct(z, n, i, index, data);
 	}
 }
 
+static void stbi__jpeg_finish(stbi__jpeg *z)
+{
+	int n, rows = 0;
+	for (n = 0; n < z->s->img_n; ++n)
+		if (stbi__jpeg_finishes(z, n))
+			rows += (z->img_comp[n].y + 7) >> 3;
+	if (stbi__parallel_on_load)
+		stbi__parallel_on_load(stbi__parallel_on_load_context, rows, stbi__jpeg_finish_row, z);
+	else
+		for (n = 0; n < rows; ++n)
+			stbi__jpeg_finish_row(z, n);
+}
+
 static int stbi__process_marker(stbi__jpeg *z, int m)
 {
 	int L;
@@ -3066,6 +3726,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 	if (scan != STBI__SCAN_load) return 1;
 
 	if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
+	if (z->stream && z->progressive) return stbi__err("progressive", "JPEG format not supported: streaming progressive");
 
 	for (i = 0; i < s->img_n; ++i) {
 		if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
@@ -3092,24 +3753,41 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 		//
 		// img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
 		// so these muls can't overflow with 32-bit ints (which we require)
-		z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-		z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+		z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+		z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+		// when reducing the image, subsampled components are reduced less, as
+		// far as that brings them up to the resolution of the reduced image
+		// (as libjpeg does), so they need less upsampling; each block is then
+		// decoded to 8 >> shrink pixels a side
+		z->img_comp[i].shrink = z->shrink;
+		while (z->img_comp[i].shrink > 0 && (h_max / z->img_comp[i].h) % (2 << (z->shrink - z->img_comp[i].shrink)) == 0
+			&& (v_max / z->img_comp[i].v) % (2 << (z->shrink - z->img_comp[i].shrink)) == 0)
+			--z->img_comp[i].shrink;
+		z->img_comp[i].w2 = z->img_comp[i].coeff_w * (8 >> z->img_comp[i].shrink);
+		z->img_comp[i].h2 = z->img_comp[i].coeff_h * (8 >> z->img_comp[i].shrink);
 		z->img_comp[i].coeff = 0;
 		z->img_comp[i].raw_coeff = 0;
+		z->img_comp[i].deferred = 0;
 		z->img_comp[i].linebuf = NULL;
-		z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-		if (z->img_comp[i].raw_data == NULL)
-			return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
-		// align blocks for idct using mmx/sse
-		z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
-		if (z->progressive) {
-			// w2, h2 are multiples of 8 (see above)
-			z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-			z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-			z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+		// a stream keeps three MCU rows: the one being output, and the ones
+		// either side of it that upsampling reads from; a single component is
+		// not interleaved, so its MCU rows are rows of blocks
+		z->img_comp[i].window = z->stream ? 3 * (s->img_n == 1 ? 1 : z->img_comp[i].v) : 0;
+		if (!z->coeff_only) {
+			z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].window ? z->img_comp[i].window * 8 : z->img_comp[i].h2, 15);
+			if (z->img_comp[i].raw_data == NULL)
+				return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
+			// align blocks for idct using mmx/sse
+			z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+		}
+		if (z->progressive || z->coeff_only) {
+			z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
 			if (z->img_comp[i].raw_coeff == NULL)
 				return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
 			z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
+			// blocks that no scan covers must read back as zero
+			if (z->coeff_only)
+				memset(z->img_comp[i].coeff, 0, (size_t)z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short));
 		}
 	}
 
@@ -3187,7 +3865,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
 		}
 		m = stbi__get_marker(j);
 	}
-	if (j->progressive)
+	if (!j->coeff_only)
 		stbi__jpeg_finish(j);
 	return 1;
 }
@@ -3389,6 +4067,86 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// same filter as stbi__resample_row_hv_2_simd, 16 input pixels at a time
+static STBI__AVX2_TARGET stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate 2x2 samples for every one in input
+	int i = 0, t0, t1;
+
+	if (w == 1) {
+		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+		return out;
+	}
+
+	t1 = 3 * in_near[0] + in_far[0];
+	// as in the sse2 version, the last pixel in a row is left to the scalar
+	// loop for the filter boundary conditions.
+	for (; i < ((w - 1) & ~15); i += 16) {
+		// load and perform the vertical filtering pass
+		// this uses 3*x + y = 4*x + (y - x)
+		__m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+		__m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+		__m256i diff = _mm256_sub_epi16(farw, nearw);
+		__m256i nears = _mm256_slli_epi16(nearw, 2);
+		__m256i curr = _mm256_add_epi16(nears, diff); // current row
+
+		// "prev" and "next" are the current row shifted by 1 pixel; alignr
+		// only shifts within 128-bit halves, so the pixel crossing the middle
+		// comes from a copy of the row with its halves moved over.
+		__m256i lo_up = _mm256_permute2x128_si256(curr, curr, 0x08); // [0, curr.lo]
+		__m256i hi_down = _mm256_permute2x128_si256(curr, curr, 0x81); // [curr.hi, 0]
+		__m256i prv0 = _mm256_alignr_epi8(curr, lo_up, 14);
+		__m256i nxt0 = _mm256_alignr_epi8(hi_down, curr, 2);
+		__m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+		__m256i next = _mm256_insert_epi16(nxt0, 3 * in_near[i + 16] + in_far[i + 16], 15);
+
+		// horizontal filter, polyphase implementation since it's convenient:
+		// even pixels = 3*cur + prev = cur*4 + (prev - cur)
+		// odd  pixels = 3*cur + next = cur*4 + (next - cur)
+		// note the shared term.
+		__m256i bias = _mm256_set1_epi16(8);
+		__m256i curs = _mm256_slli_epi16(curr, 2);
+		__m256i prvd = _mm256_sub_epi16(prev, curr);
+		__m256i nxtd = _mm256_sub_epi16(next, curr);
+		__m256i curb = _mm256_add_epi16(curs, bias);
+		__m256i even = _mm256_add_epi16(prvd, curb);
+		__m256i odd = _mm256_add_epi16(nxtd, curb);
+
+		// interleave even and odd pixels, then undo scaling. the unpacks and
+		// the pack all stay within 128-bit halves, so each half holds the
+		// output of 8 consecutive input pixels.
+		__m256i int0 = _mm256_unpacklo_epi16(even, odd);
+		__m256i int1 = _mm256_unpackhi_epi16(even, odd);
+		__m256i de0 = _mm256_srli_epi16(int0, 4);
+		__m256i de1 = _mm256_srli_epi16(int1, 4);
+
+		// pack and write output
+		__m256i outv = _mm256_packus_epi16(de0, de1);
+		_mm256_storeu_si256((__m256i *) (out + i * 2), outv);
+
+		// "previous" value for next iter
+		t1 = 3 * in_near[i + 15] + in_far[i + 15];
+	}
+
+	t0 = t1;
+	t1 = 3 * in_near[i] + in_far[i];
+	out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+	for (++i; i < w; ++i) {
+		t0 = t1;
+		t1 = 3 * in_near[i] + in_far[i];
+		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+	}
+	out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
 	// resample with nearest-neighbor
@@ -3423,7 +4181,7 @@ static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc
 		out[0] = (stbi_uc)r;
 		out[1] = (stbi_uc)g;
 		out[2] = (stbi_uc)b;
-		out[3] = 255;
+		if (step == 4) out[3] = 255; // never past the end of a row
 		out += step;
 	}
 }
@@ -3557,15 +4315,115 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 		out[0] = (stbi_uc)r;
 		out[1] = (stbi_uc)g;
 		out[2] = (stbi_uc)b;
-		out[3] = 255;
+		if (step == 4) out[3] = 255; // never past the end of a row
 		out += step;
 	}
 }
 #endif
 
+#ifdef STBI_AVX2
+// same arithmetic as stbi__YCbCr_to_RGB_simd, 16 pixels at a time. unlike the
+// sse2 version this also accelerates step == 3, which is what 3-channel
+// loads ask for; the interleave is done with byte shuffles.
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+	int i = 0;
+	__m128i signflip = _mm_set1_epi8(-0x80);
+	__m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f*4096.0f + 0.5f));
+	__m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f*4096.0f + 0.5f));
+	__m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f*4096.0f + 0.5f));
+	__m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f*4096.0f + 0.5f));
+	__m256i y_bias = _mm256_set1_epi16(128);
+	__m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+	// shuffles spreading 16 r, g or b bytes over the three 16-byte blocks
+	// of rgbrgb... output; -1 leaves a zero for the other channels
+	__m128i r_to_0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+	__m128i g_to_0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+	__m128i b_to_0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+	__m128i r_to_1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+	__m128i g_to_1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+	__m128i b_to_1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+	__m128i r_to_2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+	__m128i g_to_2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+	__m128i b_to_2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+	for (; i + 15 < count; i += 16) {
+		// load
+		__m128i y_bytes = _mm_loadu_si128((__m128i *) (y + i));
+		__m128i cr_bytes = _mm_loadu_si128((__m128i *) (pcr + i));
+		__m128i cb_bytes = _mm_loadu_si128((__m128i *) (pcb + i));
+		__m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+		__m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+		// widen to short (and left-shift y, cr, cb by 8)
+		__m256i yw = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+		__m256i crw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cr_biased), 8);
+		__m256i cbw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cb_biased), 8);
+
+		// color transform
+		__m256i yws = _mm256_srli_epi16(yw, 4);
+		__m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+		__m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+		__m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+		__m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+		__m256i rws = _mm256_add_epi16(cr0, yws);
+		__m256i gwt = _mm256_add_epi16(cb0, yws);
+		__m256i bws = _mm256_add_epi16(yws, cb1);
+		__m256i gws = _mm256_add_epi16(gwt, cr1);
+
+		// descale
+		__m256i rw = _mm256_srai_epi16(rws, 4);
+		__m256i bw = _mm256_srai_epi16(bws, 4);
+		__m256i gw = _mm256_srai_epi16(gws, 4);
+
+		if (step == 4) {
+			// back to byte, set up for transpose; each 128-bit half holds
+			// 8 pixels, and the transpose stays within the halves
+			__m256i brb = _mm256_packus_epi16(rw, bw);
+			__m256i gxb = _mm256_packus_epi16(gw, xw);
+
+			// transpose to interleave channels
+			__m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+			__m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+			__m256i o0 = _mm256_unpacklo_epi16(t0, t1); // pixels 0-3, 8-11
+			__m256i o1 = _mm256_unpackhi_epi16(t0, t1); // pixels 4-7, 12-15
+
+			// store
+			_mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+			_mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+			out += 64;
+		}
+		else {
+			// back to byte, with the channels in separate registers
+			__m256i rgb = _mm256_permute4x64_epi64(_mm256_packus_epi16(rw, gw), 0xd8);
+			__m256i bbb = _mm256_permute4x64_epi64(_mm256_packus_epi16(bw, bw), 0xd8);
+			__m128i rb = _mm256_castsi256_si128(rgb);
+			__m128i gb = _mm256_extracti128_si256(rgb, 1);
+			__m128i bb = _mm256_castsi256_si128(bbb);
+
+			// interleave channels and store
+			__m128i o0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(rb, r_to_0), _mm_shuffle_epi8(gb, g_to_0)), _mm_shuffle_epi8(bb, b_to_0));
+			__m128i o1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(rb, r_to_1), _mm_shuffle_epi8(gb, g_to_1)), _mm_shuffle_epi8(bb, b_to_1));
+			__m128i o2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(rb, r_to_2), _mm_shuffle_epi8(gb, g_to_2)), _mm_shuffle_epi8(bb, b_to_2));
+			_mm_storeu_si128((__m128i *) (out + 0), o0);
+			_mm_storeu_si128((__m128i *) (out + 16), o1);
+			_mm_storeu_si128((__m128i *) (out + 32), o2);
+			out += 48;
+		}
+	}
+
+	// the scalar version produces the same results for the last few pixels
+	stbi__YCbCr_to_RGB_row(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+	j->coeff_only = 0;
+	j->shrink = 0;
+	j->stream = 0;
 	j->idct_block_kernel = stbi__idct_block;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3578,6 +4436,14 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
 	}
 #endif
 
+#ifdef STBI_AVX2
+	if (stbi__avx2_available()) {
+		j->idct_block_kernel = stbi__idct_avx2;
+		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+	}
+#endif
+
 #ifdef STBI_NEON
 	j->idct_block_kernel = stbi__idct_simd;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
@@ -3608,6 +4474,225 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 	return (stbi_uc)((t + (t >> 8)) >> 8);
 }
 
+// row y of component k, which a stream keeps in a window of the rows
+static stbi_uc *stbi__jpeg_comp_row(stbi__jpeg *z, int k, int y)
+{
+	if (z->img_comp[k].window) y %= z->img_comp[k].window * 8;
+	return z->img_comp[k].data + (size_t)y * z->img_comp[k].w2;
+}
+
+// set up the resampler of component k for the sampling factors of the image
+static void stbi__resample_setup(stbi__resample *r, stbi__jpeg *z, int k)
+{
+	r->hs = (z->img_h_max / z->img_comp[k].h) >> (z->shrink - z->img_comp[k].shrink);
+	r->vs = (z->img_v_max / z->img_comp[k].v) >> (z->shrink - z->img_comp[k].shrink);
+	r->ystep = r->vs >> 1;
+	r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
+	r->ypos = 0;
+	r->line0 = r->line1 = z->img_comp[k].data;
+
+	if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+	else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+	else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+	else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+	else                               r->resample = stbi__resample_row_generic;
+}
+
+// set up the resampler of component k for output row j, as if the rows
+// above it had been resampled
+static void stbi__resample_seek(stbi__resample *r, stbi__jpeg *z, int k, int j)
+{
+	int steps = (r->vs >> 1) + j;
+	int wraps = steps / r->vs;
+	int last = z->img_comp[k].y - 1;
+	r->ystep = steps % r->vs;
+	r->ypos = wraps;
+	r->line1 = stbi__jpeg_comp_row(z, k, wraps < last ? wraps : last);
+	r->line0 = stbi__jpeg_comp_row(z, k, wraps ? (wraps - 1 < last ? wraps - 1 : last) : 0);
+}
+
+// resample row j of component k into linebuf, returning where the row is
+static stbi_uc *stbi__resample_row(stbi__jpeg *z, const stbi__resample *res, int k, int j, stbi_uc *linebuf)
+{
+	stbi__resample r = *res;
+	int y_bot;
+	stbi__resample_seek(&r, z, k, j);
+	y_bot = r.ystep >= (r.vs >> 1);
+	return r.resample(linebuf, y_bot ? r.line1 : r.line0, y_bot ? r.line0 : r.line1, r.w_lores, r.hs);
+}
+
+// color-convert one row of resampled components into n output channels
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi_uc *out, stbi_uc *coutput[4], int n, int is_rgb)
+{
+	unsigned int i;
+	if (n >= 3) {
+		stbi_uc *y = coutput[0];
+		if (z->s->img_n == 3) {
+			if (is_rgb) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = y[i];
+					out[1] = coutput[1][i];
+					out[2] = coutput[2][i];
+					if (n == 4) out[3] = 255; // never past the end of a row
+					out += n;
+				}
+			}
+			else {
+				z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+			}
+		}
+		else if (z->s->img_n == 4) {
+			if (z->app14_color_transform == 0) { // CMYK
+				for (i = 0; i < z->s->img_x; ++i) {
+					stbi_uc m = coutput[3][i];
+					out[0] = stbi__blinn_8x8(coutput[0][i], m);
+					out[1] = stbi__blinn_8x8(coutput[1][i], m);
+					out[2] = stbi__blinn_8x8(coutput[2][i], m);
+					if (n == 4) out[3] = 255; // never past the end of a row
+					out += n;
+				}
+			}
+			else if (z->app14_color_transform == 2) { // YCCK
+				z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				for (i = 0; i < z->s->img_x; ++i) {
+					stbi_uc m = coutput[3][i];
+					out[0] = stbi__blinn_8x8(255 - out[0], m);
+					out[1] = stbi__blinn_8x8(255 - out[1], m);
+					out[2] = stbi__blinn_8x8(255 - out[2], m);
+					out += n;
+				}
+			}
+			else { // YCbCr + alpha?  Ignore the fourth channel for now
+				z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+			}
+		}
+		else
+			for (i = 0; i < z->s->img_x; ++i) {
+				out[0] = out[1] = out[2] = y[i];
+				if (n == 4) out[3] = 255; // never past the end of a row
+				out += n;
+			}
+	}
+	else {
+		if (is_rgb) {
+			if (n == 1)
+				for (i = 0; i < z->s->img_x; ++i)
+					*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+			else {
+				for (i = 0; i < z->s->img_x; ++i, out += 2) {
+					out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+					out[1] = 255;
+				}
+			}
+		}
+		else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+			for (i = 0; i < z->s->img_x; ++i) {
+				stbi_uc m = coutput[3][i];
+				stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+				stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+				stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+				out[0] = stbi__compute_y(r, g, b);
+				out[1] = 255;
+				out += n;
+			}
+		}
+		else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+			for (i = 0; i < z->s->img_x; ++i) {
+				out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+				out[1] = 255;
+				out += n;
+			}
+		}
+		else {
+			stbi_uc *y = coutput[0];
+			if (n == 1)
+				for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+			else
+				for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+		}
+	}
+}
+
+// output rows handed to the resampler, in stripes that can run concurrently
+#ifndef STBI__JPEG_STRIPE_PIXELS
+#define STBI__JPEG_STRIPE_PIXELS 65536
+#endif
+
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi__resample res_comp[4]; // set up for row 0
+	stbi_uc *output;
+	int output_stride;
+	int n, decode_n, is_rgb;
+	int stripe_rows;
+	stbi_uc *failed; // whether each stripe failed, set by its own job
+} stbi__jpeg_output;
+
+// resample and color-convert output rows [j_begin, j_end), using linebuf[k]
+// as the line buffer of component k
+static void stbi__jpeg_output_rows(stbi__jpeg_output *o, stbi_uc **linebuf, int j_begin, int j_end)
+{
+	stbi__jpeg *z = o->z;
+	stbi__resample res_comp[4];
+	stbi_uc *coutput[4];
+	int j, k;
+	for (k = 0; k < o->decode_n; ++k) {
+		res_comp[k] = o->res_comp[k];
+		stbi__resample_seek(&res_comp[k], z, k, j_begin);
+	}
+	for (j = j_begin; j < j_end; ++j) {
+		for (k = 0; k < o->decode_n; ++k) {
+			stbi__resample *r = &res_comp[k];
+			int y_bot = r->ystep >= (r->vs >> 1);
+			coutput[k] = r->resample(linebuf[k],
+				y_bot ? r->line1 : r->line0,
+				y_bot ? r->line0 : r->line1,
+				r->w_lores, r->hs);
+			if (++r->ystep >= r->vs) {
+				r->ystep = 0;
+				r->line0 = r->line1;
+				if (++r->ypos < z->img_comp[k].y)
+					r->line1 += z->img_comp[k].w2;
+			}
+		}
+		stbi__jpeg_convert_row(z, o->output + (size_t)o->output_stride * j, coutput, o->n, o->is_rgb);
+	}
+}
+
+static void stbi__jpeg_output_stripe(void *context, int index)
+{
+	stbi__jpeg_output *o = (stbi__jpeg_output *)context;
+	int j_begin = index * o->stripe_rows;
+	int j_end = j_begin + o->stripe_rows;
+	int k, line = o->z->s->img_x + 3;
+	stbi_uc *linebuf[4];
+	// line buffers of this stripe's own, big enough for upsampling off the
+	// edges with upsample factor of 4
+	stbi_uc *buffers = (stbi_uc *)stbi__malloc_mad2(o->decode_n, line, 0);
+	o->failed[index] = !buffers;
+	if (!buffers) return;
+	for (k = 0; k < o->decode_n; ++k)
+		linebuf[k] = buffers + k * line;
+	stbi__jpeg_output_rows(o, linebuf, j_begin, j_end < (int)o->z->s->img_y ? j_end : (int)o->z->s->img_y);
+	STBI_FREE(buffers);
+}
+
+// switch the image and component sizes over to those of the reduced
+// image the IDCT produced, where component i is subsampled 2^d times less
+// than it was in the file, d being z->shrink - z->img_comp[i].shrink
+static void stbi__jpeg_reduce_size(stbi__jpeg *z)
+{
+	int i, f = 1 << z->shrink;
+	z->s->img_x = (z->s->img_x + f - 1) >> z->shrink;
+	z->s->img_y = (z->s->img_y + f - 1) >> z->shrink;
+	for (i = 0; i < z->s->img_n; ++i) {
+		int d = z->shrink - z->img_comp[i].shrink;
+		z->img_comp[i].x = (z->s->img_x * (z->img_comp[i].h << d) + z->img_h_max - 1) / z->img_h_max;
+		z->img_comp[i].y = (z->s->img_y * (z->img_comp[i].v << d) + z->img_v_max - 1) / z->img_v_max;
+	}
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
 	int n, decode_n, is_rgb;
@@ -3618,6 +4703,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
 	// load a jpeg image from whichever source, but leave in YCbCr format
 	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+	if (z->shrink) stbi__jpeg_reduce_size(z);
 
 	// determine actual number of components to generate
 	n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
@@ -3631,148 +4717,51 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
 	// resample and color-convert
 	{
-		int k;
-		unsigned int i, j;
-		stbi_uc *output;
-		stbi_uc *coutput[4];
-
-		stbi__resample res_comp[4];
+		int k, stripes;
+		stbi_uc *linebuf[4];
+		stbi__jpeg_output o;
+		o.z = z;
+		o.n = n;
+		o.decode_n = decode_n;
+		o.is_rgb = is_rgb;
 
 		for (k = 0; k < decode_n; ++k) {
-			stbi__resample *r = &res_comp[k];
+			stbi__resample *r = &o.res_comp[k];
 
 			// allocate line buffer big enough for upsampling off the edges
 			// with upsample factor of 4
 			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
 			if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-			r->hs = z->img_h_max / z->img_comp[k].h;
-			r->vs = z->img_v_max / z->img_comp[k].v;
-			r->ystep = r->vs >> 1;
-			r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-			r->ypos = 0;
-			r->line0 = r->line1 = z->img_comp[k].data;
-
-			if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-			else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-			else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-			else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-			else                               r->resample = stbi__resample_row_generic;
+			linebuf[k] = z->img_comp[k].linebuf;
+			stbi__resample_setup(r, z, k);
 		}
 
 		// can't error after this so, this is safe
-		output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-		if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-		// now go ahead and resample
-		for (j = 0; j < z->s->img_y; ++j) {
-			stbi_uc *out = output + n * z->s->img_x * j;
-			for (k = 0; k < decode_n; ++k) {
-				stbi__resample *r = &res_comp[k];
-				int y_bot = r->ystep >= (r->vs >> 1);
-				coutput[k] = r->resample(z->img_comp[k].linebuf,
-					y_bot ? r->line1 : r->line0,
-					y_bot ? r->line0 : r->line1,
-					r->w_lores, r->hs);
-				if (++r->ystep >= r->vs) {
-					r->ystep = 0;
-					r->line0 = r->line1;
-					if (++r->ypos < z->img_comp[k].y)
-						r->line1 += z->img_comp[k].w2;
-				}
-			}
-			if (n >= 3) {
-				stbi_uc *y = coutput[0];
-				if (z->s->img_n == 3) {
-					if (is_rgb) {
-						for (i = 0; i < z->s->img_x; ++i) {
-							out[0] = y[i];
-							out[1] = coutput[1][i];
-							out[2] = coutput[2][i];
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else {
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else if (z->s->img_n == 4) {
-					if (z->app14_color_transform == 0) { // CMYK
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(coutput[0][i], m);
-							out[1] = stbi__blinn_8x8(coutput[1][i], m);
-							out[2] = stbi__blinn_8x8(coutput[2][i], m);
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else if (z->app14_color_transform == 2) { // YCCK
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(255 - out[0], m);
-							out[1] = stbi__blinn_8x8(255 - out[1], m);
-							out[2] = stbi__blinn_8x8(255 - out[2], m);
-							out += n;
-						}
-					}
-					else { // YCbCr + alpha?  Ignore the fourth channel for now
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = out[1] = out[2] = y[i];
-						out[3] = 255; // not used if n==3
-						out += n;
-					}
-			}
-			else {
-				if (is_rgb) {
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-					else {
-						for (i = 0; i < z->s->img_x; ++i, out += 2) {
-							out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-							out[1] = 255;
-						}
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						stbi_uc m = coutput[3][i];
-						stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-						stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-						stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-						out[0] = stbi__compute_y(r, g, b);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else {
-					stbi_uc *y = coutput[0];
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-					else
-						for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
-				}
+		o.output = stbi__get_output(z->s, n, 1, &o.output_stride);
+		if (!o.output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+		// now go ahead and resample, in parallel stripes if we may
+		o.stripe_rows = (STBI__JPEG_STRIPE_PIXELS + z->s->img_x - 1) / z->s->img_x;
+		stripes = (z->s->img_y + o.stripe_rows - 1) / o.stripe_rows;
+		o.failed = stbi__parallel_on_load && stripes > 1 ? (stbi_uc *)stbi__malloc(stripes) : NULL;
+		if (o.failed) {
+			stbi__parallel_on_load(stbi__parallel_on_load_context, stripes, stbi__jpeg_output_stripe, &o);
+			// a stripe that had no memory for line buffers of its own is output
+			// here, with the image's
+			for (k = 0; k < stripes; ++k) {
+				int j_end = (k + 1) * o.stripe_rows;
+				if (o.failed[k])
+					stbi__jpeg_output_rows(&o, linebuf, k * o.stripe_rows, j_end < (int)z->s->img_y ? j_end : (int)z->s->img_y);
 			}
+			STBI_FREE(o.failed);
 		}
+		else
+			stbi__jpeg_output_rows(&o, linebuf, 0, z->s->img_y);
 		stbi__cleanup_jpeg(z);
 		*out_x = z->s->img_x;
 		*out_y = z->s->img_y;
 		if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-		return output;
+		return o.output;
 	}
 }
 
@@ -3783,6 +4772,10 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
 	STBI_NOTUSED(ri);
 	j->s = s;
 	stbi__setup_jpeg(j);
+	// reduce the image with smaller IDCTs, so that it comes out at the size
+	// stbi__load_into asked for
+	j->shrink = s->shrink;
+	s->shrink = 0;
 	result = load_jpeg_image(j, x, y, comp, req_comp);
 	STBI_FREE(j);
 	return result;
@@ -3821,6 +4814,223 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 	STBI_FREE(j);
 	return result;
 }
+
+// hand the coefficient buffers of a decoded image over to the caller
+static int stbi__jpeg_take_coefficients(stbi__jpeg *j, stbi_jpeg_coefficients *c)
+{
+	int i;
+	// the coefficients are only meaningful to us as grey or YCbCr
+	if (j->s->img_n != 1 && j->s->img_n != 3)
+		return stbi__err("bad colorspace", "JPEG colorspace not supported for lossless transforms");
+	if (j->s->img_n == 3 && (j->rgb == 3 || (j->app14_color_transform == 0 && !j->jfif)))
+		return stbi__err("bad colorspace", "JPEG colorspace not supported for lossless transforms");
+
+	c->x = j->s->img_x;
+	c->y = j->s->img_y;
+	c->comp = j->s->img_n;
+	for (i = 0; i < j->s->img_n; ++i) {
+		c->component[i].id = j->img_comp[i].id;
+		if (j->s->img_n == 1) {
+			// a single component is never interleaved, so its MCU is one block
+			c->component[i].h = c->component[i].v = 1;
+			c->component[i].blocks_w = (j->img_comp[i].x + 7) >> 3;
+			c->component[i].blocks_h = (j->img_comp[i].y + 7) >> 3;
+		}
+		else {
+			c->component[i].h = j->img_comp[i].h;
+			c->component[i].v = j->img_comp[i].v;
+			c->component[i].blocks_w = j->img_comp[i].coeff_w;
+			c->component[i].blocks_h = j->img_comp[i].coeff_h;
+		}
+		c->component[i].coeff_stride = j->img_comp[i].coeff_w;
+		memcpy(c->component[i].quant, j->dequant[j->img_comp[i].tq], sizeof(c->component[i].quant));
+		c->component[i].coeff = j->img_comp[i].coeff;
+		c->component[i].raw_coeff = j->img_comp[i].raw_coeff;
+		j->img_comp[i].coeff = 0;
+		j->img_comp[i].raw_coeff = 0;
+	}
+	return 1;
+}
+
+static int stbi__jpeg_load_coefficients(stbi__context *s, stbi_jpeg_coefficients *c)
+{
+	int result;
+	stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j) return stbi__err("outofmem", "Out of memory");
+	j->s = s;
+	stbi__setup_jpeg(j);
+	j->coeff_only = 1;
+	j->s->img_n = 0; // make stbi__cleanup_jpeg safe
+	result = stbi__decode_jpeg_image(j) && stbi__jpeg_take_coefficients(j, c);
+	stbi__cleanup_jpeg(j);
+	STBI_FREE(j);
+	return result;
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_jpeg_load_coefficients(char const *filename, stbi_jpeg_coefficients *coefficients)
+{
+	stbi__context s;
+	int result;
+	FILE *f = stbi__fopen(filename, "rb");
+	if (!f) return stbi__err("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__jpeg_test(&s) && stbi__jpeg_load_coefficients(&s, coefficients);
+	fclose(f);
+	return result;
+}
+#endif
+
+STBIDEF void stbi_jpeg_free_coefficients(stbi_jpeg_coefficients *coefficients)
+{
+	int i;
+	for (i = 0; i < coefficients->comp; ++i) {
+		STBI_FREE(coefficients->component[i].raw_coeff);
+		coefficients->component[i].raw_coeff = NULL;
+		coefficients->component[i].coeff = NULL;
+	}
+}
+
+#ifndef STBI_NO_STDIO
+struct stbi__jpeg_stream
+{
+	stbi__context s;
+	stbi__jpeg z;
+	FILE *f;
+	stbi__resample res_comp[4];
+	int n, decode_n, is_rgb;
+	int mcu_rows;     // MCU rows in the scan
+	int row_mcus;     // MCUs in each of them
+	int band_rows;    // image rows each of them covers
+	int decoded;      // MCU rows decoded so far
+	int next_row;     // first image row of the next band
+};
+
+// read the headers and the first scan header, and set up the output
+static int stbi__jpeg_stream_start(stbi_jpeg_stream *js, int req_comp)
+{
+	stbi__jpeg *z = &js->z;
+	int k, m;
+	if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+	if (!stbi__decode_jpeg_header(z, STBI__SCAN_load)) return 0;
+	m = stbi__get_marker(z);
+	while (!stbi__SOS(m)) {
+		if (stbi__EOI(m)) return stbi__err("no SOS", "Corrupt JPEG");
+		if (!stbi__process_marker(z, m)) return 0;
+		m = stbi__get_marker(z);
+	}
+	if (!stbi__process_scan_header(z)) return 0;
+	if (z->scan_n != z->s->img_n) return stbi__err("multiple scans", "JPEG format not supported: streaming components in separate scans");
+	stbi__jpeg_reset(z);
+
+	js->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+	js->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+	js->decode_n = z->s->img_n == 3 && js->n < 3 && !js->is_rgb ? 1 : z->s->img_n;
+	for (k = 0; k < js->decode_n; ++k) {
+		// line buffer big enough for upsampling off the edges with upsample factor of 4
+		z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
+		if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+		stbi__resample_setup(&js->res_comp[k], z, k);
+	}
+
+	// the MCU of a single component is one block
+	if (z->scan_n == 1) {
+		js->row_mcus = (z->img_comp[0].x + 7) >> 3;
+		js->mcu_rows = (z->img_comp[0].y + 7) >> 3;
+		js->band_rows = 8;
+	}
+	else {
+		js->row_mcus = z->img_mcu_x;
+		js->mcu_rows = z->img_mcu_y;
+		js->band_rows = z->img_mcu_h;
+	}
+	js->decoded = 0;
+	js->next_row = 0;
+	return 1;
+}
+
+// check that the scan is followed by a marker, as a file that was cut short
+// is not, skipping the 0s some cameras leave after the data
+static int stbi__jpeg_stream_end(stbi__jpeg *z)
+{
+	while (z->marker == STBI__MARKER_none && !stbi__at_eof(z->s)) {
+		if (stbi__get8(z->s) == 255)
+			z->marker = stbi__get8(z->s);
+	}
+	if (z->marker == STBI__MARKER_none) return stbi__err("expected marker", "Corrupt JPEG");
+	return 1;
+}
+
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open(char const *filename, int req_comp, int *x, int *y, int *band_rows)
+{
+	stbi_jpeg_stream *js;
+	int k;
+	FILE *f = stbi__fopen(filename, "rb");
+	if (!f) {
+		stbi__err("can't fopen", "Unable to open file");
+		return NULL;
+	}
+	js = (stbi_jpeg_stream *)stbi__malloc(sizeof(stbi_jpeg_stream));
+	if (!js) {
+		fclose(f);
+		stbi__err("outofmem", "Out of memory");
+		return NULL;
+	}
+	js->f = f;
+	stbi__start_file(&js->s, f);
+	js->z.s = &js->s;
+	stbi__setup_jpeg(&js->z);
+	js->z.stream = 1;
+	js->z.restart_interval = 0;
+	js->s.img_n = 0; // make stbi__cleanup_jpeg safe
+	for (k = 0; k < 4; ++k) {
+		js->z.img_comp[k].raw_data = NULL;
+		js->z.img_comp[k].raw_coeff = NULL;
+		js->z.img_comp[k].linebuf = NULL;
+	}
+	if (!stbi__jpeg_stream_start(js, req_comp)) {
+		stbi_jpeg_stream_close(js);
+		return NULL;
+	}
+	*x = js->s.img_x;
+	*y = js->s.img_y;
+	*band_rows = js->band_rows;
+	return js;
+}
+
+STBIDEF int stbi_jpeg_stream_read(stbi_jpeg_stream *js, stbi_uc *out, int stride)
+{
+	stbi__jpeg *z = &js->z;
+	int band = js->next_row / js->band_rows;
+	int rows = z->s->img_y - js->next_row;
+	int j, k;
+	if (rows <= 0) return 0;
+	if (rows > js->band_rows) rows = js->band_rows;
+
+	// upsampling the band's last rows reads the first rows of the next MCU row
+	while (js->decoded <= band + 1 && js->decoded < js->mcu_rows) {
+		if (!stbi__jpeg_decode_mcus(z, js->decoded * js->row_mcus, (js->decoded + 1) * js->row_mcus)) return 0;
+		if (++js->decoded == js->mcu_rows && !stbi__jpeg_stream_end(z)) return 0;
+	}
+
+	for (j = 0; j < rows; ++j) {
+		stbi_uc *coutput[4];
+		for (k = 0; k < js->decode_n; ++k)
+			coutput[k] = stbi__resample_row(z, &js->res_comp[k], k, js->next_row + j, z->img_comp[k].linebuf);
+		stbi__jpeg_convert_row(z, out + (size_t)stride * j, coutput, js->n, js->is_rgb);
+	}
+	js->next_row += rows;
+	return rows;
+}
+
+STBIDEF void stbi_jpeg_stream_close(stbi_jpeg_stream *js)
+{
+	if (!js) return;
+	stbi__cleanup_jpeg(&js->z);
+	fclose(js->f);
+	STBI_FREE(js);
+}
+#endif
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -4346,6 +5556,7 @@ typedef struct
 	stbi__context *s;
 	stbi_uc *idata, *expanded, *out;
 	int depth;
+	int direct; // filter straight into the stbi_load_into buffer
 } stbi__png;
 
 
@@ -4397,7 +5608,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 	int width = x;
 
 	STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
-	a->out = (stbi_uc *)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+	if (a->direct) {
+		// 8-bit whole image: the filtered rows are the final pixels
+		int dest_stride;
+		a->out = stbi__get_output(s, out_n, 0, &dest_stride);
+		stride = dest_stride;
+	}
+	else
+		a->out = (stbi_uc *)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
 	if (!a->out) return stbi__err("outofmem", "Out of memory");
 
 	if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
@@ -4925,6 +6143,10 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 				s->img_out_n = s->img_n + 1;
 			else
 				s->img_out_n = s->img_n;
+			// decode straight into the caller's buffer when nothing rewrites
+			// or reduces the pixels after filtering
+			z->direct = s->dest && !s->shrink && !interlace && z->depth == 8 && !pal_img_n && !has_trans && !is_iphone &&
+				(req_comp == 0 || req_comp == s->img_out_n);
 			if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
 			if (has_trans) {
 				if (z->depth == 16) {
@@ -4997,7 +6219,8 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
 		*y = p->s->img_y;
 		if (n) *n = p->s->img_n;
 	}
-	STBI_FREE(p->out);      p->out = NULL;
+	if (p->out != p->s->dest_out) STBI_FREE(p->out); // never the caller's buffer
+	p->out = NULL;
 	STBI_FREE(p->expanded); p->expanded = NULL;
 	STBI_FREE(p->idata);    p->idata = NULL;
 
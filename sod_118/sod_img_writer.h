@@ -105,13 +105,77 @@ output alpha.
 
 PNG supports writing rectangles of data even when the bytes storing rows of
 data are not consecutive in memory (e.g. sub-rectangles of a larger image),
-by supplying the stride between the beginning of adjacent rows. The other
-formats do not. (Thus you cannot write a native-format BMP through the BMP
+by supplying the stride between the beginning of adjacent rows. So does
+JPEG, through
+
+int stbi_write_jpg_stride(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes, int quality);
+int stbi_write_jpg_stride_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes, int quality);
+
+which read the pixels a strip of 8 rows at a time. So does BMP, through
+
+int stbi_write_bmp_stride(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes);
+int stbi_write_bmp_stride_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes);
+
+and the binary PPM (comp 3 or 4) and PGM (comp 1 or 2) writer, which drops
+alpha and writes rows that need no conversion straight from data:
+
+int stbi_write_pnm(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes);
+int stbi_write_pnm_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes);
+
+A stride_in_bytes of 0 means rows of w * comp bytes. TGA does not take a
+stride.
+
+JPEG can be encoded on several threads, and with the chroma subsampled, with
+
+int stbi_write_jpg_parallel(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes, int quality, int subsample, stbi_write_parallel_func *parallel, void *parallel_context);
+int stbi_write_jpg_parallel_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes, int quality, int subsample, stbi_write_parallel_func *parallel, void *parallel_context);
+
+where a non-zero subsample stores Cb and Cr at half the width and height of
+the image (4:2:0), averaging each 2x2 square of pixels: the MCUs are then
+16x16 pixels, with 4 Y blocks and one block of each chroma component, which
+halves the blocks to encode and shrinks the file accordingly. parallel may be
+NULL to encode on the calling thread only; otherwise the callback, which
+brings its own threads, is:
+void stbi_write_parallel_func(void *context, int count, void (*job)(void *job_context, int index), void *job_context);
+and must run job(job_context, i) once for each i in [0, count) and return when
+all of them are done. The image is cut into bands of whole MCU rows, separated
+by restart markers, which are encoded independently and then written out in
+order; the file stays baseline. Images too small to cut are encoded as by
+stbi_write_jpg. (Thus you cannot write a native-format BMP through the BMP
 writer, both because it is in BGR order and because it may have padding
 at the end of the line.)
 
+A JPEG can also be written a band of rows at a time, so that the whole image
+never has to be in memory:
+
+int stbi_write_jpg_stream_begin(stbi_write_jpg_stream *stream, stbi_write_func *func, void *context, int w, int h, int comp, int quality, int subsample);
+int stbi_write_jpg_stream_rows(stbi_write_jpg_stream *stream, const void *data, int stride_in_bytes, int rows, stbi_write_parallel_func *parallel, void *parallel_context);
+int stbi_write_jpg_stream_end(stbi_write_jpg_stream *stream);
+
+begin writes the headers, and each call to rows encodes the next rows of the
+image from data, top to bottom. Every call but the last must pass a multiple
+of stream->band_rows rows: the bands are the restart intervals of
+stbi_write_jpg_parallel, so the file is the same as it writes, and the bands
+given to one call are encoded in parallel if parallel is not NULL. end writes
+the end of the image once all of its rows have been given. The vertical flip
+set by stbi_flip_vertically_on_write is not applied to streams.
+
 PNG allows you to set the deflate compression level by setting the global
-variable 'stbi_write_png_compression_level' (it defaults to 8).
+variable 'stbi_write_png_compression_level' (it defaults to 8). Levels 1 to 4
+also skip the lazy matching of the builtin compressor, for speed over size.
+
+A PNG can also be written with its own compression level and filter, and on
+several threads, with
+
+int stbi_write_png_parallel(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes, int compression_level, int filter, stbi_write_parallel_func *parallel, void *parallel_context);
+int stbi_write_png_parallel_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes, int compression_level, int filter, stbi_write_parallel_func *parallel, void *parallel_context);
+
+where filter is the PNG filter (0 to 4) applied to every row, or -1 to try
+all five on each row and keep the one that looks cheapest, which costs about
+five times the filtering. With parallel (as for JPEG), bands of rows are
+filtered concurrently, and the builtin compressor deflates pieces of the
+filtered data concurrently as separate blocks, each able to refer back into
+the data before it, so the file grows only slightly. parallel may be NULL.
 
 HDR expects linear float data. Since the format is always 32-bit rgb(e)
 data, alpha (if provided) is discarded, and for monochrome data it is
@@ -124,6 +188,15 @@ JPEG does ignore alpha channels in input data; quality is between 1 and 100.
 Higher quality looks better but results in a bigger image.
 JPEG baseline (no JPEG progressive).
 
+JPEG can also be written straight from quantized DCT coefficients, e.g. ones
+read with stbi_jpeg_load_coefficients() and rearranged, so that no further
+quality is lost:
+
+int stbi_write_jpg_coefficients(char const *filename, int w, int h, int comp, const stbi_write_jpg_component *components);
+
+where comp is 1 (Y) or 3 (YCbCr) and each component gives its sampling
+factors, quantization table and coefficient blocks.
+
 CREDITS:
 
 
@@ -183,21 +256,65 @@ extern int stbi_write_png_compression_level;
 extern int stbi_write_force_png_filter;
 #endif
 
+// one component of an image written from quantized DCT coefficients
+typedef struct
+{
+	int id;                      // component identifier
+	int h, v;                    // sampling factors (ignored for a single component)
+	const unsigned short *quant; // quantization table, natural order
+	const short *coeff;          // 64 quantized coefficients per block, natural order
+	int coeff_stride;            // number of blocks between two rows of blocks in coeff
+} stbi_write_jpg_component;
+
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_png(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes);
 STBIWDEF int stbi_write_bmp(char const *filename, int w, int h, int comp, const void  *data);
 STBIWDEF int stbi_write_tga(char const *filename, int w, int h, int comp, const void  *data);
 STBIWDEF int stbi_write_hdr(char const *filename, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const void  *data, int quality);
+STBIWDEF int stbi_write_jpg_stride(char const *filename, int x, int y, int comp, const void  *data, int stride_in_bytes, int quality);
+STBIWDEF int stbi_write_jpg_coefficients(char const *filename, int x, int y, int comp, const stbi_write_jpg_component *components);
 #endif
 
 typedef void stbi_write_func(void *context, void *data, int size);
+typedef void stbi_write_parallel_func(void *context, int count, void (*job)(void *job_context, int index), void *job_context);
+
+// a JPEG being written a band of rows at a time (see stbi_write_jpg_stream_begin)
+typedef struct
+{
+	stbi_write_func *func;
+	void *context;
+	int width, height, comp;
+	int mcu_size;     // 8, or 16 with the chroma subsampled 4:2:0
+	int band_rows;    // rows per restart interval
+	int bands;        // restart intervals in the image
+	int next_row;     // first row of the next band
+	int flip;         // read the rows bottom up, for stbi_flip_vertically_on_write
+	float fdtbl_Y[64], fdtbl_UV[64];
+} stbi_write_jpg_stream;
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_jpg_parallel(char const *filename, int x, int y, int comp, const void  *data, int stride_in_bytes, int quality, int subsample, stbi_write_parallel_func *parallel, void *parallel_context);
+STBIWDEF int stbi_write_png_parallel(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes, int compression_level, int filter, stbi_write_parallel_func *parallel, void *parallel_context);
+STBIWDEF int stbi_write_bmp_stride(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes);
+STBIWDEF int stbi_write_pnm(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes);
+#endif
 
 STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes);
+STBIWDEF int stbi_write_png_parallel_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes, int compression_level, int filter, stbi_write_parallel_func *parallel, void *parallel_context);
 STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data);
+STBIWDEF int stbi_write_bmp_stride_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes);
+STBIWDEF int stbi_write_pnm_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes);
 STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data);
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int quality);
+STBIWDEF int stbi_write_jpg_stride_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int stride_in_bytes, int quality);
+STBIWDEF int stbi_write_jpg_parallel_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int stride_in_bytes, int quality, int subsample, stbi_write_parallel_func *parallel, void *parallel_context);
+STBIWDEF int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const stbi_write_jpg_component *components);
+
+STBIWDEF int stbi_write_jpg_stream_begin(stbi_write_jpg_stream *stream, stbi_write_func *func, void *context, int x, int y, int comp, int quality, int subsample);
+STBIWDEF int stbi_write_jpg_stream_rows(stbi_write_jpg_stream *stream, const void *data, int stride_in_bytes, int rows, stbi_write_parallel_func *parallel, void *parallel_context);
+STBIWDEF int stbi_write_jpg_stream_end(stbi_write_jpg_stream *stream);
 
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
@@ -254,6 +371,28 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
+// SSE2 is part of the x86-64 baseline, so it is only used when the compiler
+// targets it anyway; other machines take the scalar paths
+#if defined(__SSE2__) && !defined(STBIW_NO_SIMD)
+#define STBIW_SSE2
+#include <emmintrin.h>
+#endif
+
+// the AVX2 kernels are compiled with a per-function target attribute, so the
+// rest of the writer still runs on any SSE2 machine, and are only selected
+// when the CPU (and OS) reports AVX2 support. #define STBIW_NO_AVX2 to leave
+// them out.
+#if defined(STBIW_SSE2) && (defined(__GNUC__) || defined(__clang__)) && !defined(STBIW_NO_AVX2)
+#define STBIW_AVX2
+#include <immintrin.h>
+#define STBIW__AVX2_TARGET __attribute__((target("avx2")))
+
+static int stbiw__avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi__flip_vertically_on_write = 0;
 static int stbi_write_png_compression_level = 8;
@@ -356,53 +495,62 @@ static void stbiw__putc(stbi__write_context *s, unsigned char c)
 	s->func(s->context, &c, 1);
 }
 
-static void stbiw__write3(stbi__write_context *s, unsigned char a, unsigned char b, unsigned char c)
-{
-	unsigned char arr[3];
-	arr[0] = a, arr[1] = b, arr[2] = c;
-	s->func(s->context, arr, 3);
-}
-
-static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
+// put the bytes of one pixel at o, returning the end of them (4 bytes at most)
+static unsigned char *stbiw__put_pixel(unsigned char *o, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
 {
 	unsigned char bg[3] = { 255, 0, 255 }, px[3];
 	int k;
 
 	if (write_alpha < 0)
-		s->func(s->context, &d[comp - 1], 1);
+		*o++ = d[comp - 1];
 
 	switch (comp) {
 	case 2: // 2 pixels = mono + alpha, alpha is written separately, so same as 1-channel case
 	case 1:
 		if (expand_mono)
-			stbiw__write3(s, d[0], d[0], d[0]); // monochrome bmp
+			o[0] = o[1] = o[2] = d[0], o += 3; // monochrome bmp
 		else
-			s->func(s->context, d, 1);  // monochrome TGA
+			*o++ = d[0];  // monochrome TGA
 		break;
 	case 4:
 		if (!write_alpha) {
 			// composite against pink background
 			for (k = 0; k < 3; ++k)
 				px[k] = bg[k] + ((d[k] - bg[k]) * d[3]) / 255;
-			stbiw__write3(s, px[1 - rgb_dir], px[1], px[1 + rgb_dir]);
+			o[0] = px[1 - rgb_dir], o[1] = px[1], o[2] = px[1 + rgb_dir], o += 3;
 			break;
 		}
 		/* FALLTHROUGH */
 	case 3:
-		stbiw__write3(s, d[1 - rgb_dir], d[1], d[1 + rgb_dir]);
+		o[0] = d[1 - rgb_dir], o[1] = d[1], o[2] = d[1 + rgb_dir], o += 3;
 		break;
 	}
 	if (write_alpha > 0)
-		s->func(s->context, &d[comp - 1], 1);
+		*o++ = d[comp - 1];
+	return o;
+}
+
+static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
+{
+	unsigned char px[4];
+	s->func(s->context, px, (int)(stbiw__put_pixel(px, rgb_dir, comp, write_alpha, expand_mono, d) - px));
 }
 
-static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad, int expand_mono)
+// each row is gathered into a buffer and handed over in a single call, rather
+// than a call per pixel; a stride of 0 means packed rows
+static int stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, void *data, int stride, int write_alpha, int scanline_pad, int expand_mono)
 {
-	stbiw_uint32 zero = 0;
+	unsigned char *row;
 	int i, j, j_end;
 
 	if (y <= 0)
-		return;
+		return 1;
+
+	if (stride == 0)
+		stride = x * comp;
+	row = (unsigned char *)STBIW_MALLOC((size_t)x * 4 + 4);
+	if (!row)
+		return 0;
 
 	if (stbi__flip_vertically_on_write)
 		vdir *= -1;
@@ -413,15 +561,19 @@ static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, i
 		j_end = y, j = 0;
 
 	for (; j != j_end; j += vdir) {
-		for (i = 0; i < x; ++i) {
-			unsigned char *d = (unsigned char *)data + (j*x + i)*comp;
-			stbiw__write_pixel(s, rgb_dir, comp, write_alpha, expand_mono, d);
-		}
-		s->func(s->context, &zero, scanline_pad);
+		unsigned char *d = (unsigned char *)data + (size_t)j * stride;
+		unsigned char *o = row;
+		for (i = 0; i < x; ++i, d += comp)
+			o = stbiw__put_pixel(o, rgb_dir, comp, write_alpha, expand_mono, d);
+		for (i = 0; i < scanline_pad; ++i)
+			*o++ = 0;
+		s->func(s->context, row, (int)(o - row));
 	}
+	STBIW_FREE(row);
+	return 1;
 }
 
-static int stbiw__outfile(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, int expand_mono, void *data, int alpha, int pad, const char *fmt, ...)
+static int stbiw__outfile(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, int expand_mono, void *data, int stride, int alpha, int pad, const char *fmt, ...)
 {
 	if (y < 0 || x < 0) {
 		return 0;
@@ -431,33 +583,42 @@ static int stbiw__outfile(stbi__write_context *s, int rgb_dir, int vdir, int x,
 		va_start(v, fmt);
 		stbiw__writefv(s, fmt, v);
 		va_end(v);
-		stbiw__write_pixels(s, rgb_dir, vdir, x, y, comp, data, alpha, pad, expand_mono);
-		return 1;
+		return stbiw__write_pixels(s, rgb_dir, vdir, x, y, comp, data, stride, alpha, pad, expand_mono);
 	}
 }
 
-static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, const void *data)
+static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, const void *data, int stride)
 {
 	int pad = (-x * 3) & 3;
-	return stbiw__outfile(s, -1, -1, x, y, comp, 1, (void *)data, 0, pad,
+	return stbiw__outfile(s, -1, -1, x, y, comp, 1, (void *)data, stride, 0, pad,
 		"11 4 22 4" "4 44 22 444444",
 		'B', 'M', 14 + 40 + (x * 3 + pad)*y, 0, 0, 14 + 40,  // file header
 		40, x, y, 1, 24, 0, 0, 0, 0, 0, 0);             // bitmap header
 }
 
 STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
+{
+	return stbi_write_bmp_stride_to_func(func, context, x, y, comp, data, 0);
+}
+
+STBIWDEF int stbi_write_bmp_stride_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_in_bytes)
 {
 	stbi__write_context s;
 	stbi__start_write_callbacks(&s, func, context);
-	return stbi_write_bmp_core(&s, x, y, comp, data);
+	return stbi_write_bmp_core(&s, x, y, comp, data, stride_in_bytes);
 }
 
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_bmp(char const *filename, int x, int y, int comp, const void *data)
+{
+	return stbi_write_bmp_stride(filename, x, y, comp, data, 0);
+}
+
+STBIWDEF int stbi_write_bmp_stride(char const *filename, int x, int y, int comp, const void *data, int stride_in_bytes)
 {
 	stbi__write_context s;
 	if (stbi__start_write_file(&s, filename)) {
-		int r = stbi_write_bmp_core(&s, x, y, comp, data);
+		int r = stbi_write_bmp_core(&s, x, y, comp, data, stride_in_bytes);
 		stbi__end_write_file(&s);
 		return r;
 	}
@@ -476,7 +637,7 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
 		return 0;
 
 	if (!stbi_write_tga_with_rle) {
-		return stbiw__outfile(s, -1, -1, x, y, comp, 0, (void *)data, has_alpha, 0,
+		return stbiw__outfile(s, -1, -1, x, y, comp, 0, (void *)data, 0, has_alpha, 0,
 			"111 221 2222 11", 0, 0, format, 0, 0, 0, 0, 0, x, y, (colorbytes + has_alpha) * 8, has_alpha * 8);
 	}
 	else {
@@ -571,6 +732,82 @@ STBIWDEF int stbi_write_tga(char const *filename, int x, int y, int comp, const
 }
 #endif
 
+// *************************************************************************************************
+// Binary PPM / PGM writer
+
+// put the decimal digits of a non-negative v at o, returning the end of them
+static char *stbiw__put_decimal(char *o, int v)
+{
+	char digits[10];
+	int n = 0;
+	do {
+		digits[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+	while (n)
+		*o++ = digits[--n];
+	return o;
+}
+
+static int stbi_write_pnm_core(stbi__write_context *s, int x, int y, int comp, const void *data, int stride)
+{
+	int channels = comp >= 3 ? 3 : 1;
+	unsigned char *row = NULL;
+	char header[32], *o = header;
+	int i, j;
+
+	if (x <= 0 || y <= 0 || comp < 1 || comp > 4 || !data)
+		return 0;
+	if (stride == 0)
+		stride = x * comp;
+	// rows with alpha go through a buffer without it, the others are written as they are
+	if (comp != channels) {
+		row = (unsigned char *)STBIW_MALLOC((size_t)x * channels);
+		if (!row)
+			return 0;
+	}
+
+	*o++ = 'P', *o++ = channels == 3 ? '6' : '5', *o++ = '\n';
+	o = stbiw__put_decimal(o, x);
+	*o++ = ' ';
+	o = stbiw__put_decimal(o, y);
+	*o++ = '\n', *o++ = '2', *o++ = '5', *o++ = '5', *o++ = '\n';
+	s->func(s->context, header, (int)(o - header));
+
+	for (j = 0; j < y; ++j) {
+		unsigned char *d = (unsigned char *)data + (size_t)stride * (stbi__flip_vertically_on_write ? y - 1 - j : j);
+		if (row) {
+			for (i = 0; i < x; ++i)
+				STBIW_MEMMOVE(row + i * channels, d + i * comp, channels);
+			d = row;
+		}
+		s->func(s->context, d, x * channels);
+	}
+	STBIW_FREE(row);
+	return 1;
+}
+
+STBIWDEF int stbi_write_pnm_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_in_bytes)
+{
+	stbi__write_context s;
+	stbi__start_write_callbacks(&s, func, context);
+	return stbi_write_pnm_core(&s, x, y, comp, data, stride_in_bytes);
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_pnm(char const *filename, int x, int y, int comp, const void *data, int stride_in_bytes)
+{
+	stbi__write_context s;
+	if (stbi__start_write_file(&s, filename)) {
+		int r = stbi_write_pnm_core(&s, x, y, comp, data, stride_in_bytes);
+		stbi__end_write_file(&s);
+		return r;
+	}
+	else
+		return 0;
+}
+#endif //!STBI_WRITE_NO_STDIO
+
 // *************************************************************************************************
 // Radiance RGBE HDR writer
 // by Baldur Karlsson
@@ -835,36 +1072,51 @@ static unsigned int stbiw__zhash(unsigned char *data)
 
 #define stbiw__ZHASH   16384
 
-#endif // STBIW_ZLIB_COMPRESS
+// bytes of data deflated by each job when compressing in parallel
+#define stbiw__ZSEGMENT (1 << 19)
 
-unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+static const unsigned short stbiw__zlib_lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+static const unsigned char  stbiw__zlib_lengtheb[] = { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+static const unsigned short stbiw__zlib_distc[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
+static const unsigned char  stbiw__zlib_disteb[] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+// add a position to its hash chain, first deleting the older half of the
+// entries when the chain is too long
+static void stbiw__zlib_hash_insert(unsigned char ***hash_table, int h, unsigned char *p, int quality)
+{
+	if (hash_table[h] && stbiw__sbn(hash_table[h]) == 2 * quality) {
+		STBIW_MEMMOVE(hash_table[h], hash_table[h] + quality, sizeof(hash_table[h][0])*quality);
+		stbiw__sbn(hash_table[h]) = quality;
+	}
+	stbiw__sbpush(hash_table[h], p);
+}
+
+// deflate data[begin, end) as one block of fixed huffman codes, whose matches
+// may reach back into the data before begin. A block that is not the last is
+// followed by an empty stored block, which ends it on a byte boundary, so that
+// blocks deflated separately can simply be joined. Returns the bytes as a
+// stretchy buffer, or NULL if out of memory
+static unsigned char *stbiw__zlib_deflate_block(unsigned char *data, int begin, int end, int quality, int last)
 {
-#ifdef STBIW_ZLIB_COMPRESS
-	// user provided a zlib compress implementation, use that
-	return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else // use builtin
-	static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
-	static unsigned char  lengtheb[] = { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
-	static unsigned short distc[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
-	static unsigned char  disteb[] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
 	unsigned int bitbuf = 0;
 	int i, j, bitcount = 0;
 	unsigned char *out = NULL;
 	unsigned char ***hash_table = (unsigned char***)STBIW_MALLOC(stbiw__ZHASH * sizeof(char**));
 	if (hash_table == NULL)
 		return NULL;
-	if (quality < 5) quality = 5;
 
-	stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
-	stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
-	stbiw__zlib_add(1, 1);  // BFINAL = 1
+	stbiw__zlib_add(last ? 1 : 0, 1);  // BFINAL
 	stbiw__zlib_add(1, 2);  // BTYPE = 1 -- fixed huffman
 
 	for (i = 0; i < stbiw__ZHASH; ++i)
 		hash_table[i] = NULL;
 
-	i = 0;
-	while (i < data_len - 3) {
+	// the window before the block is there to be matched
+	for (i = begin > 32768 ? begin - 32768 : 0; i < begin - 3; ++i)
+		stbiw__zlib_hash_insert(hash_table, stbiw__zhash(data + i)&(stbiw__ZHASH - 1), data + i, quality);
+
+	i = begin;
+	while (i < end - 3) {
 		// hash next 3 bytes of data to be compressed
 		int h = stbiw__zhash(data + i)&(stbiw__ZHASH - 1), best = 3;
 		unsigned char *bestloc = 0;
@@ -872,25 +1124,21 @@ unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_l
 		int n = stbiw__sbcount(hlist);
 		for (j = 0; j < n; ++j) {
 			if (hlist[j] - data > i - 32768) { // if entry lies within window
-				int d = stbiw__zlib_countm(hlist[j], data + i, data_len - i);
+				int d = stbiw__zlib_countm(hlist[j], data + i, end - i);
 				if (d >= best) best = d, bestloc = hlist[j];
 			}
 		}
-		// when hash table entry is too long, delete half the entries
-		if (hash_table[h] && stbiw__sbn(hash_table[h]) == 2 * quality) {
-			STBIW_MEMMOVE(hash_table[h], hash_table[h] + quality, sizeof(hash_table[h][0])*quality);
-			stbiw__sbn(hash_table[h]) = quality;
-		}
-		stbiw__sbpush(hash_table[h], data + i);
+		stbiw__zlib_hash_insert(hash_table, h, data + i, quality);
 
-		if (bestloc) {
+		// the lowest levels take the first match they find
+		if (bestloc && quality >= 5) {
 			// "lazy matching" - check match at *next* byte, and if it's better, do cur byte as literal
 			h = stbiw__zhash(data + i + 1)&(stbiw__ZHASH - 1);
 			hlist = hash_table[h];
 			n = stbiw__sbcount(hlist);
 			for (j = 0; j < n; ++j) {
 				if (hlist[j] - data > i - 32767) {
-					int e = stbiw__zlib_countm(hlist[j], data + i + 1, data_len - i - 1);
+					int e = stbiw__zlib_countm(hlist[j], data + i + 1, end - i - 1);
 					if (e > best) { // if next match is better, bail on current match
 						bestloc = NULL;
 						break;
@@ -902,12 +1150,12 @@ unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_l
 		if (bestloc) {
 			int d = (int)(data + i - bestloc); // distance back
 			STBIW_ASSERT(d <= 32767 && best <= 258);
-			for (j = 0; best > lengthc[j + 1] - 1; ++j);
+			for (j = 0; best > stbiw__zlib_lengthc[j + 1] - 1; ++j);
 			stbiw__zlib_huff(j + 257);
-			if (lengtheb[j]) stbiw__zlib_add(best - lengthc[j], lengtheb[j]);
-			for (j = 0; d > distc[j + 1] - 1; ++j);
+			if (stbiw__zlib_lengtheb[j]) stbiw__zlib_add(best - stbiw__zlib_lengthc[j], stbiw__zlib_lengtheb[j]);
+			for (j = 0; d > stbiw__zlib_distc[j + 1] - 1; ++j);
 			stbiw__zlib_add(stbiw__zlib_bitrev(j, 5), 5);
-			if (disteb[j]) stbiw__zlib_add(d - distc[j], disteb[j]);
+			if (stbiw__zlib_disteb[j]) stbiw__zlib_add(d - stbiw__zlib_distc[j], stbiw__zlib_disteb[j]);
 			i += best;
 		}
 		else {
@@ -916,40 +1164,147 @@ unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_l
 		}
 	}
 	// write out final bytes
-	for (; i < data_len; ++i)
+	for (; i < end; ++i)
 		stbiw__zlib_huffb(data[i]);
 	stbiw__zlib_huff(256); // end of block
-						   // pad with 0 bits to byte boundary
+	if (!last)
+		stbiw__zlib_add(0, 3);  // BFINAL = 0, BTYPE = 0 -- stored
+	// pad with 0 bits to byte boundary
 	while (bitcount)
 		stbiw__zlib_add(0, 1);
+	if (!last) {
+		// LEN = 0, NLEN = ~0
+		stbiw__sbpush(out, 0x00);
+		stbiw__sbpush(out, 0x00);
+		stbiw__sbpush(out, 0xff);
+		stbiw__sbpush(out, 0xff);
+	}
 
 	for (i = 0; i < stbiw__ZHASH; ++i)
 		(void) stbiw__sbfree(hash_table[i]);
 	STBIW_FREE(hash_table);
+	return out;
+}
 
-	{
-		// compute adler32 on input
-		unsigned int s1 = 1, s2 = 0;
-		int blocklen = (int)(data_len % 5552);
-		j = 0;
-		while (j < data_len) {
-			for (i = 0; i < blocklen; ++i) s1 += data[j + i], s2 += s1;
-			s1 %= 65521, s2 %= 65521;
-			j += blocklen;
-			blocklen = 5552;
+static unsigned int stbiw__adler32(unsigned char *data, int data_len)
+{
+	unsigned int s1 = 1, s2 = 0;
+	int blocklen = (int)(data_len % 5552);
+	int i, j = 0;
+	while (j < data_len) {
+		for (i = 0; i < blocklen; ++i) s1 += data[j + i], s2 += s1;
+		s1 %= 65521, s2 %= 65521;
+		j += blocklen;
+		blocklen = 5552;
+	}
+	return (s2 << 16) | s1;
+}
+
+// the adler32 of two pieces of data one after the other, from the adler32 of
+// each and the length of the second
+static unsigned int stbiw__adler32_combine(unsigned int adler1, unsigned int adler2, int len2)
+{
+	unsigned int rem = (unsigned int)(len2 % 65521);
+	unsigned int s1 = adler1 & 0xffff;
+	unsigned int s2 = (rem * s1) % 65521;
+	s1 += (adler2 & 0xffff) + 65521 - 1;
+	s2 += (adler1 >> 16) + (adler2 >> 16) + 65521 - rem;
+	if (s1 >= 65521) s1 -= 65521;
+	if (s1 >= 65521) s1 -= 65521;
+	if (s2 >= 2 * 65521) s2 -= 2 * 65521;
+	if (s2 >= 65521) s2 -= 65521;
+	return (s2 << 16) | s1;
+}
+
+// the pieces of the data deflated by each job
+typedef struct
+{
+	unsigned char *data;
+	int data_len, segment_len, segments, quality;
+	unsigned char **block;   // deflated block of each piece, a stretchy buffer
+	unsigned int *adler;     // adler32 of each piece
+} stbiw__zlib_segments;
+
+static void stbiw__zlib_deflateSegment(void *context, int index)
+{
+	stbiw__zlib_segments *jobs = (stbiw__zlib_segments *)context;
+	int last = index == jobs->segments - 1;
+	int begin = index * jobs->segment_len;
+	int end = last ? jobs->data_len : begin + jobs->segment_len;
+	jobs->block[index] = stbiw__zlib_deflate_block(jobs->data, begin, end, jobs->quality, last);
+	jobs->adler[index] = stbiw__adler32(jobs->data + begin, end - begin);
+}
+
+#endif // STBIW_ZLIB_COMPRESS
+
+// with parallel, pieces of the data are deflated concurrently, each as a block
+// of its own; otherwise the whole of it goes in a single block
+static unsigned char *stbiw__zlib_compress(unsigned char *data, int data_len, int *out_len, int quality,
+	stbi_write_parallel_func *parallel, void *parallel_context)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+	// user provided a zlib compress implementation, use that
+	(void)parallel;
+	(void)parallel_context;
+	return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else // use builtin
+	stbiw__zlib_segments jobs;
+	unsigned char *out = NULL, *o;
+	unsigned int adler = 1;
+	int i, len = 2 + 4, ok;
+	if (quality < 1) quality = 1;
+
+	jobs.data = data;
+	jobs.data_len = data_len;
+	jobs.segment_len = stbiw__ZSEGMENT;
+	jobs.segments = parallel && data_len > stbiw__ZSEGMENT ? (data_len + stbiw__ZSEGMENT - 1) / stbiw__ZSEGMENT : 1;
+	jobs.quality = quality;
+	jobs.block = (unsigned char **)STBIW_MALLOC(jobs.segments * sizeof(unsigned char *));
+	jobs.adler = (unsigned int *)STBIW_MALLOC(jobs.segments * sizeof(unsigned int));
+	ok = jobs.block != NULL && jobs.adler != NULL;
+	if (ok) {
+		for (i = 0; i < jobs.segments; ++i)
+			jobs.block[i] = NULL;
+		if (jobs.segments == 1)
+			stbiw__zlib_deflateSegment(&jobs, 0);
+		else
+			parallel(parallel_context, jobs.segments, stbiw__zlib_deflateSegment, &jobs);
+		for (i = 0; i < jobs.segments; ++i) {
+			int segment_len = i == jobs.segments - 1 ? data_len - i * jobs.segment_len : jobs.segment_len;
+			ok &= jobs.block[i] != NULL;
+			len += stbiw__sbcount(jobs.block[i]);
+			adler = i ? stbiw__adler32_combine(adler, jobs.adler[i], segment_len) : jobs.adler[i];
+		}
+	}
+	if (ok)
+		out = (unsigned char *)STBIW_MALLOC(len);
+	if (out) {
+		o = out;
+		*o++ = 0x78;   // DEFLATE 32K window
+		*o++ = 0x5e;   // FLEVEL = 1
+		for (i = 0; i < jobs.segments; ++i) {
+			STBIW_MEMMOVE(o, jobs.block[i], stbiw__sbcount(jobs.block[i]));
+			o += stbiw__sbcount(jobs.block[i]);
 		}
-		stbiw__sbpush(out, STBIW_UCHAR(s2 >> 8));
-		stbiw__sbpush(out, STBIW_UCHAR(s2));
-		stbiw__sbpush(out, STBIW_UCHAR(s1 >> 8));
-		stbiw__sbpush(out, STBIW_UCHAR(s1));
-	}
-	*out_len = stbiw__sbn(out);
-	// make returned pointer freeable
-	STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
-	return (unsigned char *)stbiw__sbraw(out);
+		*o++ = STBIW_UCHAR(adler >> 24);
+		*o++ = STBIW_UCHAR(adler >> 16);
+		*o++ = STBIW_UCHAR(adler >> 8);
+		*o++ = STBIW_UCHAR(adler);
+		*out_len = len;
+	}
+	for (i = 0; jobs.block && jobs.adler && i < jobs.segments; ++i)
+		(void) stbiw__sbfree(jobs.block[i]);
+	STBIW_FREE(jobs.block);
+	STBIW_FREE(jobs.adler);
+	return out;
 #endif // STBIW_ZLIB_COMPRESS
 }
 
+unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+	return stbiw__zlib_compress(data, data_len, out_len, quality, NULL, NULL);
+}
+
 static unsigned int stbiw__crc32(unsigned char *buffer, int len)
 {
 	static unsigned int crc_table[256] =
@@ -1013,7 +1368,7 @@ static unsigned char stbiw__paeth(int a, int b, int c)
 	return STBIW_UCHAR(c);
 }
 
-// @OPTIMIZE: provide an option that always forces left-predict or paeth predict
+// the switch is outside the loops, so that each filter runs a loop of its own
 static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int width, int height, int y, int n, int filter_type, signed char *line_buffer)
 {
 	static int mapping[] = { 0,1,2,3,4 };
@@ -1023,38 +1378,97 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
 	int type = mymap[filter_type];
 	unsigned char *z = pixels + stride_bytes * (stbi__flip_vertically_on_write ? height - 1 - y : y);
 	int signed_stride = stbi__flip_vertically_on_write ? -stride_bytes : stride_bytes;
-	for (i = 0; i < n; ++i) {
-		switch (type) {
-		case 0: line_buffer[i] = z[i]; break;
-		case 1: line_buffer[i] = z[i]; break;
-		case 2: line_buffer[i] = z[i] - z[i - signed_stride]; break;
-		case 3: line_buffer[i] = z[i] - (z[i - signed_stride] >> 1); break;
-		case 4: line_buffer[i] = (signed char)(z[i] - stbiw__paeth(0, z[i - signed_stride], 0)); break;
-		case 5: line_buffer[i] = z[i]; break;
-		case 6: line_buffer[i] = z[i]; break;
-		}
+	unsigned char *u = y != 0 ? z - signed_stride : z; // the row above, only read past the first row
+	switch (type) {
+	case 0:
+		for (i = 0; i < width*n; ++i) line_buffer[i] = z[i];
+		break;
+	case 1:
+	case 6:
+		for (i = 0; i < n; ++i) line_buffer[i] = z[i];
+		for (; i < width*n; ++i) line_buffer[i] = z[i] - z[i - n];
+		break;
+	case 2:
+		for (i = 0; i < width*n; ++i) line_buffer[i] = z[i] - u[i];
+		break;
+	case 3:
+		for (i = 0; i < n; ++i) line_buffer[i] = z[i] - (u[i] >> 1);
+		for (; i < width*n; ++i) line_buffer[i] = z[i] - ((z[i - n] + u[i]) >> 1);
+		break;
+	case 4:
+		for (i = 0; i < n; ++i) line_buffer[i] = (signed char)(z[i] - stbiw__paeth(0, u[i], 0));
+		for (; i < width*n; ++i) line_buffer[i] = z[i] - stbiw__paeth(z[i - n], u[i], u[i - n]);
+		break;
+	case 5:
+		for (i = 0; i < n; ++i) line_buffer[i] = z[i];
+		for (; i < width*n; ++i) line_buffer[i] = z[i] - (z[i - n] >> 1);
+		break;
+	}
+}
+
+// bytes of filtered rows in each band filtered by a job
+#define stbiw__PNG_BAND (1 << 18)
+
+// the rows of an image being filtered, in bands of rows
+typedef struct
+{
+	unsigned char *pixels, *filt;
+	int stride_bytes, x, y, n;
+	int force_filter;   // filter of every row, or -1 to pick one for each row
+	int band_rows;
+} stbiw__png_rows;
+
+// filter row j into filt, where it is preceded by its filter type
+static void stbiw__png_filter_row(stbiw__png_rows *rows, int j)
+{
+	int x = rows->x, n = rows->n;
+	unsigned char *row = rows->filt + (size_t)j * (x*n + 1);
+	signed char *line_buffer = (signed char *)row + 1;
+	int filter_type;
+	if (rows->force_filter > -1) {
+		filter_type = rows->force_filter;
+		stbiw__encode_png_line(rows->pixels, rows->stride_bytes, x, rows->y, j, n, filter_type, line_buffer);
 	}
-	for (i = n; i < width*n; ++i) {
-		switch (type) {
-		case 0: line_buffer[i] = z[i]; break;
-		case 1: line_buffer[i] = z[i] - z[i - n]; break;
-		case 2: line_buffer[i] = z[i] - z[i - signed_stride]; break;
-		case 3: line_buffer[i] = z[i] - ((z[i - n] + z[i - signed_stride]) >> 1); break;
-		case 4: line_buffer[i] = z[i] - stbiw__paeth(z[i - n], z[i - signed_stride], z[i - signed_stride - n]); break;
-		case 5: line_buffer[i] = z[i] - (z[i - n] >> 1); break;
-		case 6: line_buffer[i] = z[i] - stbiw__paeth(z[i - n], 0, 0); break;
+	else { // Estimate the best filter by running through all of them:
+		int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
+		for (filter_type = 0; filter_type < 5; filter_type++) {
+			stbiw__encode_png_line(rows->pixels, rows->stride_bytes, x, rows->y, j, n, filter_type, line_buffer);
+
+			// Estimate the entropy of the line using this filter; the less, the better.
+			est = 0;
+			for (i = 0; i < x*n; ++i) {
+				est += abs((signed char)line_buffer[i]);
+			}
+			if (est < best_filter_val) {
+				best_filter_val = est;
+				best_filter = filter_type;
+			}
+		}
+		if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
+			stbiw__encode_png_line(rows->pixels, rows->stride_bytes, x, rows->y, j, n, best_filter, line_buffer);
+			filter_type = best_filter;
 		}
 	}
+	row[0] = (unsigned char)filter_type;
 }
 
-unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+static void stbiw__png_filterBand(void *context, int index)
+{
+	stbiw__png_rows *rows = (stbiw__png_rows *)context;
+	int j = index * rows->band_rows;
+	int j_end = j + rows->band_rows < rows->y ? j + rows->band_rows : rows->y;
+	for (; j < j_end; ++j)
+		stbiw__png_filter_row(rows, j);
+}
+
+static unsigned char *stbiw__png_to_mem(unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len,
+	int compression_level, int force_filter, stbi_write_parallel_func *parallel, void *parallel_context)
 {
-	int force_filter = stbi_write_force_png_filter;
 	int ctype[5] = { -1, 0, 4, 2, 6 };
 	unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
-	unsigned char *out, *o, *filt, *zlib;
-	signed char *line_buffer;
-	int j, zlen;
+	unsigned char *out, *o, *zlib;
+	stbiw__png_rows rows;
+	int j, bands, zlen;
 
 	if (stride_bytes == 0)
 		stride_bytes = x * n;
@@ -1063,41 +1477,22 @@ unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, in
 		force_filter = -1;
 	}
 
-	filt = (unsigned char *)STBIW_MALLOC((x*n + 1) * y); if (!filt) return 0;
-	line_buffer = (signed char *)STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
-	for (j = 0; j < y; ++j) {
-		int filter_type;
-		if (force_filter > -1) {
-			filter_type = force_filter;
-			stbiw__encode_png_line(pixels, stride_bytes, x, y, j, n, force_filter, line_buffer);
-		}
-		else { // Estimate the best filter by running through all of them:
-			int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
-			for (filter_type = 0; filter_type < 5; filter_type++) {
-				stbiw__encode_png_line(pixels, stride_bytes, x, y, j, n, filter_type, line_buffer);
-
-				// Estimate the entropy of the line using this filter; the less, the better.
-				est = 0;
-				for (i = 0; i < x*n; ++i) {
-					est += abs((signed char)line_buffer[i]);
-				}
-				if (est < best_filter_val) {
-					best_filter_val = est;
-					best_filter = filter_type;
-				}
-			}
-			if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
-				stbiw__encode_png_line(pixels, stride_bytes, x, y, j, n, best_filter, line_buffer);
-				filter_type = best_filter;
-			}
-		}
-		// when we get here, filter_type contains the filter type, and line_buffer contains the data
-		filt[j*(x*n + 1)] = (unsigned char)filter_type;
-		STBIW_MEMMOVE(filt + j * (x*n + 1) + 1, line_buffer, x*n);
-	}
-	STBIW_FREE(line_buffer);
-	zlib = stbi_zlib_compress(filt, y*(x*n + 1), &zlen, stbi_write_png_compression_level);
-	STBIW_FREE(filt);
+	rows.filt = (unsigned char *)STBIW_MALLOC((x*n + 1) * y); if (!rows.filt) return 0;
+	rows.pixels = pixels;
+	rows.stride_bytes = stride_bytes;
+	rows.x = x;
+	rows.y = y;
+	rows.n = n;
+	rows.force_filter = force_filter;
+	rows.band_rows = stbiw__PNG_BAND / (x*n + 1) + 1;
+	bands = (y + rows.band_rows - 1) / rows.band_rows;
+	if (parallel && bands > 1)
+		parallel(parallel_context, bands, stbiw__png_filterBand, &rows);
+	else
+		for (j = 0; j < bands; ++j)
+			stbiw__png_filterBand(&rows, j);
+	zlib = stbiw__zlib_compress(rows.filt, y*(x*n + 1), &zlen, compression_level, parallel, parallel_context);
+	STBIW_FREE(rows.filt);
 	if (!zlib) return 0;
 
 	// each tag requires 12 bytes of overhead
@@ -1134,12 +1529,23 @@ unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, in
 	return out;
 }
 
+unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+	return stbiw__png_to_mem(pixels, stride_bytes, x, y, n, out_len, stbi_write_png_compression_level, stbi_write_force_png_filter, NULL, NULL);
+}
+
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
+{
+	return stbi_write_png_parallel(filename, x, y, comp, data, stride_bytes, stbi_write_png_compression_level, stbi_write_force_png_filter, NULL, NULL);
+}
+
+STBIWDEF int stbi_write_png_parallel(char const *filename, int x, int y, int comp, const void *data, int stride_bytes,
+	int compression_level, int filter, stbi_write_parallel_func *parallel, void *parallel_context)
 {
 	FILE *f;
 	int len;
-	unsigned char *png = stbi_write_png_to_mem((unsigned char *)data, stride_bytes, x, y, comp, &len);
+	unsigned char *png = stbiw__png_to_mem((unsigned char *)data, stride_bytes, x, y, comp, &len, compression_level, filter, parallel, parallel_context);
 	if (png == NULL) return 0;
 #ifdef STBI_MSC_SECURE_CRT
 	if (fopen_s(&f, filename, "wb"))
@@ -1156,9 +1562,15 @@ STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const
 #endif
 
 STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes)
+{
+	return stbi_write_png_parallel_to_func(func, context, x, y, comp, data, stride_bytes, stbi_write_png_compression_level, stbi_write_force_png_filter, NULL, NULL);
+}
+
+STBIWDEF int stbi_write_png_parallel_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes,
+	int compression_level, int filter, stbi_write_parallel_func *parallel, void *parallel_context)
 {
 	int len;
-	unsigned char *png = stbi_write_png_to_mem((unsigned char *)data, stride_bytes, x, y, comp, &len);
+	unsigned char *png = stbiw__png_to_mem((unsigned char *)data, stride_bytes, x, y, comp, &len, compression_level, filter, parallel, parallel_context);
 	if (png == NULL) return 0;
 	func(context, png, len);
 	STBIW_FREE(png);
@@ -1252,11 +1664,10 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
 	bits[0] = val & ((1 << bits[1]) - 1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
-	const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
-	const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
-	int dataOff, i, diff, end0pos;
-	int DU[64];
+// DCT, quantize and zigzag one block of level shifted samples into DU; the
+// samples are overwritten
+static void stbiw__jpg_quantizeDU(float *CDU, const float *fdtbl, int *DU) {
+	int dataOff, i;
 
 	// DCT rows
 	for (dataOff = 0; dataOff<64; dataOff += 8) {
@@ -1273,6 +1684,148 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
 		// ceilf() and floorf() are C99, not C89, but I /think/ they're not needed here anyway?
 		DU[stbiw__jpg_ZigZag[i]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
 	}
+}
+
+#ifdef STBIW_SSE2
+// the butterflies of stbiw__jpg_DCT applied to 8 vectors at once, so that
+// every lane goes through the same operations in the same order as the
+// scalar code and comes out bit-identical
+#define stbiw__jpg_DCT_lanes(type, add, sub, mul, set1, d) \
+	do { \
+		type tmp0 = add(d[0], d[7]), tmp7 = sub(d[0], d[7]); \
+		type tmp1 = add(d[1], d[6]), tmp6 = sub(d[1], d[6]); \
+		type tmp2 = add(d[2], d[5]), tmp5 = sub(d[2], d[5]); \
+		type tmp3 = add(d[3], d[4]), tmp4 = sub(d[3], d[4]); \
+		type tmp10 = add(tmp0, tmp3), tmp13 = sub(tmp0, tmp3); \
+		type tmp11 = add(tmp1, tmp2), tmp12 = sub(tmp1, tmp2); \
+		type z1 = mul(add(tmp12, tmp13), set1(0.707106781f)); \
+		type z2, z3, z4, z5, z11, z13; \
+		d[0] = add(tmp10, tmp11); \
+		d[4] = sub(tmp10, tmp11); \
+		d[2] = add(tmp13, z1); \
+		d[6] = sub(tmp13, z1); \
+		tmp10 = add(tmp4, tmp5); \
+		tmp11 = add(tmp5, tmp6); \
+		tmp12 = add(tmp6, tmp7); \
+		z5 = mul(sub(tmp10, tmp12), set1(0.382683433f)); \
+		z2 = add(mul(tmp10, set1(0.541196100f)), z5); \
+		z4 = add(mul(tmp12, set1(1.306562965f)), z5); \
+		z3 = mul(tmp11, set1(0.707106781f)); \
+		z11 = add(tmp7, z3); \
+		z13 = sub(tmp7, z3); \
+		d[5] = add(z13, z2); \
+		d[3] = sub(z13, z2); \
+		d[1] = add(z11, z4); \
+		d[7] = sub(z11, z4); \
+	} while (0)
+
+// transpose the 4x4 blocks of an 8x8 block held as left and right halves of
+// its rows, so that lo[c] and hi[c] hold the top and bottom of column c
+static void stbiw__jpg_transpose_sse2(__m128 lo[8], __m128 hi[8]) {
+	__m128 t;
+	_MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+	_MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+	_MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+	_MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+	// the top right and bottom left blocks swap places
+	t = hi[0]; hi[0] = lo[4]; lo[4] = t;
+	t = hi[1]; hi[1] = lo[5]; lo[5] = t;
+	t = hi[2]; hi[2] = lo[6]; lo[6] = t;
+	t = hi[3]; hi[3] = lo[7]; lo[7] = t;
+}
+
+// stbiw__jpg_quantizeDU with the DCT running on 4 rows or columns at a time
+static void stbiw__jpg_quantizeDU_sse2(float *CDU, const float *fdtbl, int *DU) {
+	const __m128 sign = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f);
+	__m128 lo[8], hi[8];
+	int q[64];
+	int i;
+
+	// the left and right halves of each row
+	for (i = 0; i < 8; ++i) {
+		lo[i] = _mm_loadu_ps(CDU + i * 8);
+		hi[i] = _mm_loadu_ps(CDU + i * 8 + 4);
+	}
+	// DCT rows, with the block transposed so that each vector holds the same
+	// element of 4 rows, then DCT columns back in the original layout
+	stbiw__jpg_transpose_sse2(lo, hi);
+	stbiw__jpg_DCT_lanes(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, lo);
+	stbiw__jpg_DCT_lanes(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, hi);
+	stbiw__jpg_transpose_sse2(lo, hi);
+	stbiw__jpg_DCT_lanes(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, lo);
+	stbiw__jpg_DCT_lanes(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, hi);
+
+	// quantize, rounding halves away from zero as the scalar code does
+	for (i = 0; i < 8; ++i) {
+		__m128 vl = _mm_mul_ps(lo[i], _mm_loadu_ps(fdtbl + i * 8));
+		__m128 vh = _mm_mul_ps(hi[i], _mm_loadu_ps(fdtbl + i * 8 + 4));
+		vl = _mm_add_ps(vl, _mm_or_ps(_mm_and_ps(vl, sign), half));
+		vh = _mm_add_ps(vh, _mm_or_ps(_mm_and_ps(vh, sign), half));
+		_mm_storeu_si128((__m128i *)(q + i * 8), _mm_cvttps_epi32(vl));
+		_mm_storeu_si128((__m128i *)(q + i * 8 + 4), _mm_cvttps_epi32(vh));
+	}
+	// zigzag
+	for (i = 0; i < 64; ++i) {
+		DU[stbiw__jpg_ZigZag[i]] = q[i];
+	}
+}
+#endif
+
+#ifdef STBIW_AVX2
+// transpose an 8x8 block held as one vector per row
+static STBIW__AVX2_TARGET void stbiw__jpg_transpose_avx2(__m256 r[8]) {
+	__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+	__m256 u0 = _mm256_shuffle_ps(t0, t2, 0x44), u1 = _mm256_shuffle_ps(t0, t2, 0xee);
+	__m256 u2 = _mm256_shuffle_ps(t1, t3, 0x44), u3 = _mm256_shuffle_ps(t1, t3, 0xee);
+	__m256 u4 = _mm256_shuffle_ps(t4, t6, 0x44), u5 = _mm256_shuffle_ps(t4, t6, 0xee);
+	__m256 u6 = _mm256_shuffle_ps(t5, t7, 0x44), u7 = _mm256_shuffle_ps(t5, t7, 0xee);
+	r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+	r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+	r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+	r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+	r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+	r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+	r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+	r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+// stbiw__jpg_quantizeDU with the DCT running on all 8 rows or columns at once
+static STBIW__AVX2_TARGET void stbiw__jpg_quantizeDU_avx2(float *CDU, const float *fdtbl, int *DU) {
+	const __m256 sign = _mm256_set1_ps(-0.0f), half = _mm256_set1_ps(0.5f);
+	__m256 r[8];
+	int q[64];
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		r[i] = _mm256_loadu_ps(CDU + i * 8);
+	}
+	// DCT rows on the transposed block, then DCT columns
+	stbiw__jpg_transpose_avx2(r);
+	stbiw__jpg_DCT_lanes(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps, r);
+	stbiw__jpg_transpose_avx2(r);
+	stbiw__jpg_DCT_lanes(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps, r);
+
+	// quantize, rounding halves away from zero as the scalar code does
+	for (i = 0; i < 8; ++i) {
+		__m256 v = _mm256_mul_ps(r[i], _mm256_loadu_ps(fdtbl + i * 8));
+		v = _mm256_add_ps(v, _mm256_or_ps(_mm256_and_ps(v, sign), half));
+		_mm256_storeu_si256((__m256i *)(q + i * 8), _mm256_cvttps_epi32(v));
+	}
+	// zigzag
+	for (i = 0; i < 64; ++i) {
+		DU[stbiw__jpg_ZigZag[i]] = q[i];
+	}
+}
+#endif
+
+// entropy code one block of quantized coefficients, in zigzag order
+static int stbiw__jpg_encodeDU(stbi__write_context *s, int *bitBuf, int *bitCnt, const int *DU, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+	const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+	const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+	int i, diff, end0pos;
 
 	// Encode DC
 	diff = DU[0] - DC;
@@ -1318,71 +1871,334 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
 	return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
-	// Constants that don't pollute global namespace
-	static const unsigned char std_dc_luminance_nrcodes[] = { 0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
-	static const unsigned char std_dc_luminance_values[] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
-	static const unsigned char std_ac_luminance_nrcodes[] = { 0,0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d };
-	static const unsigned char std_ac_luminance_values[] = {
-		0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
-		0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
-		0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
-		0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
-		0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
-		0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
-		0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
-	};
-	static const unsigned char std_dc_chrominance_nrcodes[] = { 0,0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };
-	static const unsigned char std_dc_chrominance_values[] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
-	static const unsigned char std_ac_chrominance_nrcodes[] = { 0,0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 };
-	static const unsigned char std_ac_chrominance_values[] = {
-		0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
-		0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
-		0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
-		0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
-		0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
-		0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
-		0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
-	};
-	// Huffman tables
-	static const unsigned short YDC_HT[256][2] = { { 0,2 },{ 2,3 },{ 3,3 },{ 4,3 },{ 5,3 },{ 6,3 },{ 14,4 },{ 30,5 },{ 62,6 },{ 126,7 },{ 254,8 },{ 510,9 } };
-	static const unsigned short UVDC_HT[256][2] = { { 0,2 },{ 1,2 },{ 2,2 },{ 6,3 },{ 14,4 },{ 30,5 },{ 62,6 },{ 126,7 },{ 254,8 },{ 510,9 },{ 1022,10 },{ 2046,11 } };
-	static const unsigned short YAC_HT[256][2] = {
-		{ 10,4 },{ 0,2 },{ 1,2 },{ 4,3 },{ 11,4 },{ 26,5 },{ 120,7 },{ 248,8 },{ 1014,10 },{ 65410,16 },{ 65411,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 12,4 },{ 27,5 },{ 121,7 },{ 502,9 },{ 2038,11 },{ 65412,16 },{ 65413,16 },{ 65414,16 },{ 65415,16 },{ 65416,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 28,5 },{ 249,8 },{ 1015,10 },{ 4084,12 },{ 65417,16 },{ 65418,16 },{ 65419,16 },{ 65420,16 },{ 65421,16 },{ 65422,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 58,6 },{ 503,9 },{ 4085,12 },{ 65423,16 },{ 65424,16 },{ 65425,16 },{ 65426,16 },{ 65427,16 },{ 65428,16 },{ 65429,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 59,6 },{ 1016,10 },{ 65430,16 },{ 65431,16 },{ 65432,16 },{ 65433,16 },{ 65434,16 },{ 65435,16 },{ 65436,16 },{ 65437,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 122,7 },{ 2039,11 },{ 65438,16 },{ 65439,16 },{ 65440,16 },{ 65441,16 },{ 65442,16 },{ 65443,16 },{ 65444,16 },{ 65445,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 123,7 },{ 4086,12 },{ 65446,16 },{ 65447,16 },{ 65448,16 },{ 65449,16 },{ 65450,16 },{ 65451,16 },{ 65452,16 },{ 65453,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 250,8 },{ 4087,12 },{ 65454,16 },{ 65455,16 },{ 65456,16 },{ 65457,16 },{ 65458,16 },{ 65459,16 },{ 65460,16 },{ 65461,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 504,9 },{ 32704,15 },{ 65462,16 },{ 65463,16 },{ 65464,16 },{ 65465,16 },{ 65466,16 },{ 65467,16 },{ 65468,16 },{ 65469,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 505,9 },{ 65470,16 },{ 65471,16 },{ 65472,16 },{ 65473,16 },{ 65474,16 },{ 65475,16 },{ 65476,16 },{ 65477,16 },{ 65478,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 506,9 },{ 65479,16 },{ 65480,16 },{ 65481,16 },{ 65482,16 },{ 65483,16 },{ 65484,16 },{ 65485,16 },{ 65486,16 },{ 65487,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 1017,10 },{ 65488,16 },{ 65489,16 },{ 65490,16 },{ 65491,16 },{ 65492,16 },{ 65493,16 },{ 65494,16 },{ 65495,16 },{ 65496,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 1018,10 },{ 65497,16 },{ 65498,16 },{ 65499,16 },{ 65500,16 },{ 65501,16 },{ 65502,16 },{ 65503,16 },{ 65504,16 },{ 65505,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 2040,11 },{ 65506,16 },{ 65507,16 },{ 65508,16 },{ 65509,16 },{ 65510,16 },{ 65511,16 },{ 65512,16 },{ 65513,16 },{ 65514,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 65515,16 },{ 65516,16 },{ 65517,16 },{ 65518,16 },{ 65519,16 },{ 65520,16 },{ 65521,16 },{ 65522,16 },{ 65523,16 },{ 65524,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 2041,11 },{ 65525,16 },{ 65526,16 },{ 65527,16 },{ 65528,16 },{ 65529,16 },{ 65530,16 },{ 65531,16 },{ 65532,16 },{ 65533,16 },{ 65534,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 }
-	};
-	static const unsigned short UVAC_HT[256][2] = {
-		{ 0,2 },{ 1,2 },{ 4,3 },{ 10,4 },{ 24,5 },{ 25,5 },{ 56,6 },{ 120,7 },{ 500,9 },{ 1014,10 },{ 4084,12 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 11,4 },{ 57,6 },{ 246,8 },{ 501,9 },{ 2038,11 },{ 4085,12 },{ 65416,16 },{ 65417,16 },{ 65418,16 },{ 65419,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 26,5 },{ 247,8 },{ 1015,10 },{ 4086,12 },{ 32706,15 },{ 65420,16 },{ 65421,16 },{ 65422,16 },{ 65423,16 },{ 65424,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 27,5 },{ 248,8 },{ 1016,10 },{ 4087,12 },{ 65425,16 },{ 65426,16 },{ 65427,16 },{ 65428,16 },{ 65429,16 },{ 65430,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 58,6 },{ 502,9 },{ 65431,16 },{ 65432,16 },{ 65433,16 },{ 65434,16 },{ 65435,16 },{ 65436,16 },{ 65437,16 },{ 65438,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 59,6 },{ 1017,10 },{ 65439,16 },{ 65440,16 },{ 65441,16 },{ 65442,16 },{ 65443,16 },{ 65444,16 },{ 65445,16 },{ 65446,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 121,7 },{ 2039,11 },{ 65447,16 },{ 65448,16 },{ 65449,16 },{ 65450,16 },{ 65451,16 },{ 65452,16 },{ 65453,16 },{ 65454,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 122,7 },{ 2040,11 },{ 65455,16 },{ 65456,16 },{ 65457,16 },{ 65458,16 },{ 65459,16 },{ 65460,16 },{ 65461,16 },{ 65462,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 249,8 },{ 65463,16 },{ 65464,16 },{ 65465,16 },{ 65466,16 },{ 65467,16 },{ 65468,16 },{ 65469,16 },{ 65470,16 },{ 65471,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 503,9 },{ 65472,16 },{ 65473,16 },{ 65474,16 },{ 65475,16 },{ 65476,16 },{ 65477,16 },{ 65478,16 },{ 65479,16 },{ 65480,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 504,9 },{ 65481,16 },{ 65482,16 },{ 65483,16 },{ 65484,16 },{ 65485,16 },{ 65486,16 },{ 65487,16 },{ 65488,16 },{ 65489,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 505,9 },{ 65490,16 },{ 65491,16 },{ 65492,16 },{ 65493,16 },{ 65494,16 },{ 65495,16 },{ 65496,16 },{ 65497,16 },{ 65498,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 506,9 },{ 65499,16 },{ 65500,16 },{ 65501,16 },{ 65502,16 },{ 65503,16 },{ 65504,16 },{ 65505,16 },{ 65506,16 },{ 65507,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 2041,11 },{ 65508,16 },{ 65509,16 },{ 65510,16 },{ 65511,16 },{ 65512,16 },{ 65513,16 },{ 65514,16 },{ 65515,16 },{ 65516,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 16352,14 },{ 65517,16 },{ 65518,16 },{ 65519,16 },{ 65520,16 },{ 65521,16 },{ 65522,16 },{ 65523,16 },{ 65524,16 },{ 65525,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
-	{ 1018,10 },{ 32707,15 },{ 65526,16 },{ 65527,16 },{ 65528,16 },{ 65529,16 },{ 65530,16 },{ 65531,16 },{ 65532,16 },{ 65533,16 },{ 65534,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 }
-	};
+// standard Huffman tables (JPEG spec, Annex K.3), shared by all JPEG writers
+static const unsigned char std_dc_luminance_nrcodes[] = { 0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
+static const unsigned char std_dc_luminance_values[] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+static const unsigned char std_ac_luminance_nrcodes[] = { 0,0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d };
+static const unsigned char std_ac_luminance_values[] = {
+	0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+	0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+	0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+	0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+	0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+	0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+	0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+static const unsigned char std_dc_chrominance_nrcodes[] = { 0,0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };
+static const unsigned char std_dc_chrominance_values[] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+static const unsigned char std_ac_chrominance_nrcodes[] = { 0,0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 };
+static const unsigned char std_ac_chrominance_values[] = {
+	0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+	0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+	0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+	0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+	0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+	0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+	0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+// Huffman tables
+static const unsigned short YDC_HT[256][2] = { { 0,2 },{ 2,3 },{ 3,3 },{ 4,3 },{ 5,3 },{ 6,3 },{ 14,4 },{ 30,5 },{ 62,6 },{ 126,7 },{ 254,8 },{ 510,9 } };
+static const unsigned short UVDC_HT[256][2] = { { 0,2 },{ 1,2 },{ 2,2 },{ 6,3 },{ 14,4 },{ 30,5 },{ 62,6 },{ 126,7 },{ 254,8 },{ 510,9 },{ 1022,10 },{ 2046,11 } };
+static const unsigned short YAC_HT[256][2] = {
+	{ 10,4 },{ 0,2 },{ 1,2 },{ 4,3 },{ 11,4 },{ 26,5 },{ 120,7 },{ 248,8 },{ 1014,10 },{ 65410,16 },{ 65411,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 12,4 },{ 27,5 },{ 121,7 },{ 502,9 },{ 2038,11 },{ 65412,16 },{ 65413,16 },{ 65414,16 },{ 65415,16 },{ 65416,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 28,5 },{ 249,8 },{ 1015,10 },{ 4084,12 },{ 65417,16 },{ 65418,16 },{ 65419,16 },{ 65420,16 },{ 65421,16 },{ 65422,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 58,6 },{ 503,9 },{ 4085,12 },{ 65423,16 },{ 65424,16 },{ 65425,16 },{ 65426,16 },{ 65427,16 },{ 65428,16 },{ 65429,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 59,6 },{ 1016,10 },{ 65430,16 },{ 65431,16 },{ 65432,16 },{ 65433,16 },{ 65434,16 },{ 65435,16 },{ 65436,16 },{ 65437,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 122,7 },{ 2039,11 },{ 65438,16 },{ 65439,16 },{ 65440,16 },{ 65441,16 },{ 65442,16 },{ 65443,16 },{ 65444,16 },{ 65445,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 123,7 },{ 4086,12 },{ 65446,16 },{ 65447,16 },{ 65448,16 },{ 65449,16 },{ 65450,16 },{ 65451,16 },{ 65452,16 },{ 65453,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 250,8 },{ 4087,12 },{ 65454,16 },{ 65455,16 },{ 65456,16 },{ 65457,16 },{ 65458,16 },{ 65459,16 },{ 65460,16 },{ 65461,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 504,9 },{ 32704,15 },{ 65462,16 },{ 65463,16 },{ 65464,16 },{ 65465,16 },{ 65466,16 },{ 65467,16 },{ 65468,16 },{ 65469,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 505,9 },{ 65470,16 },{ 65471,16 },{ 65472,16 },{ 65473,16 },{ 65474,16 },{ 65475,16 },{ 65476,16 },{ 65477,16 },{ 65478,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 506,9 },{ 65479,16 },{ 65480,16 },{ 65481,16 },{ 65482,16 },{ 65483,16 },{ 65484,16 },{ 65485,16 },{ 65486,16 },{ 65487,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 1017,10 },{ 65488,16 },{ 65489,16 },{ 65490,16 },{ 65491,16 },{ 65492,16 },{ 65493,16 },{ 65494,16 },{ 65495,16 },{ 65496,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 1018,10 },{ 65497,16 },{ 65498,16 },{ 65499,16 },{ 65500,16 },{ 65501,16 },{ 65502,16 },{ 65503,16 },{ 65504,16 },{ 65505,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 2040,11 },{ 65506,16 },{ 65507,16 },{ 65508,16 },{ 65509,16 },{ 65510,16 },{ 65511,16 },{ 65512,16 },{ 65513,16 },{ 65514,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 65515,16 },{ 65516,16 },{ 65517,16 },{ 65518,16 },{ 65519,16 },{ 65520,16 },{ 65521,16 },{ 65522,16 },{ 65523,16 },{ 65524,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 2041,11 },{ 65525,16 },{ 65526,16 },{ 65527,16 },{ 65528,16 },{ 65529,16 },{ 65530,16 },{ 65531,16 },{ 65532,16 },{ 65533,16 },{ 65534,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 }
+};
+static const unsigned short UVAC_HT[256][2] = {
+	{ 0,2 },{ 1,2 },{ 4,3 },{ 10,4 },{ 24,5 },{ 25,5 },{ 56,6 },{ 120,7 },{ 500,9 },{ 1014,10 },{ 4084,12 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 11,4 },{ 57,6 },{ 246,8 },{ 501,9 },{ 2038,11 },{ 4085,12 },{ 65416,16 },{ 65417,16 },{ 65418,16 },{ 65419,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 26,5 },{ 247,8 },{ 1015,10 },{ 4086,12 },{ 32706,15 },{ 65420,16 },{ 65421,16 },{ 65422,16 },{ 65423,16 },{ 65424,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 27,5 },{ 248,8 },{ 1016,10 },{ 4087,12 },{ 65425,16 },{ 65426,16 },{ 65427,16 },{ 65428,16 },{ 65429,16 },{ 65430,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 58,6 },{ 502,9 },{ 65431,16 },{ 65432,16 },{ 65433,16 },{ 65434,16 },{ 65435,16 },{ 65436,16 },{ 65437,16 },{ 65438,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 59,6 },{ 1017,10 },{ 65439,16 },{ 65440,16 },{ 65441,16 },{ 65442,16 },{ 65443,16 },{ 65444,16 },{ 65445,16 },{ 65446,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 121,7 },{ 2039,11 },{ 65447,16 },{ 65448,16 },{ 65449,16 },{ 65450,16 },{ 65451,16 },{ 65452,16 },{ 65453,16 },{ 65454,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 122,7 },{ 2040,11 },{ 65455,16 },{ 65456,16 },{ 65457,16 },{ 65458,16 },{ 65459,16 },{ 65460,16 },{ 65461,16 },{ 65462,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 249,8 },{ 65463,16 },{ 65464,16 },{ 65465,16 },{ 65466,16 },{ 65467,16 },{ 65468,16 },{ 65469,16 },{ 65470,16 },{ 65471,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 503,9 },{ 65472,16 },{ 65473,16 },{ 65474,16 },{ 65475,16 },{ 65476,16 },{ 65477,16 },{ 65478,16 },{ 65479,16 },{ 65480,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 504,9 },{ 65481,16 },{ 65482,16 },{ 65483,16 },{ 65484,16 },{ 65485,16 },{ 65486,16 },{ 65487,16 },{ 65488,16 },{ 65489,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 505,9 },{ 65490,16 },{ 65491,16 },{ 65492,16 },{ 65493,16 },{ 65494,16 },{ 65495,16 },{ 65496,16 },{ 65497,16 },{ 65498,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 506,9 },{ 65499,16 },{ 65500,16 },{ 65501,16 },{ 65502,16 },{ 65503,16 },{ 65504,16 },{ 65505,16 },{ 65506,16 },{ 65507,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 2041,11 },{ 65508,16 },{ 65509,16 },{ 65510,16 },{ 65511,16 },{ 65512,16 },{ 65513,16 },{ 65514,16 },{ 65515,16 },{ 65516,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 16352,14 },{ 65517,16 },{ 65518,16 },{ 65519,16 },{ 65520,16 },{ 65521,16 },{ 65522,16 },{ 65523,16 },{ 65524,16 },{ 65525,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },
+{ 1018,10 },{ 32707,15 },{ 65526,16 },{ 65527,16 },{ 65528,16 },{ 65529,16 },{ 65530,16 },{ 65531,16 },{ 65532,16 },{ 65533,16 },{ 65534,16 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 },{ 0,0 }
+};
+
+static void stbiw__jpg_writeHuffmanTables(stbi__write_context *s) {
+	static const unsigned char head[] = { 0xFF,0xC4,0x01,0xA2,0 };
+	s->func(s->context, (void*)head, sizeof(head));
+	s->func(s->context, (void*)(std_dc_luminance_nrcodes + 1), sizeof(std_dc_luminance_nrcodes) - 1);
+	s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
+	stbiw__putc(s, 0x10); // HTYACinfo
+	s->func(s->context, (void*)(std_ac_luminance_nrcodes + 1), sizeof(std_ac_luminance_nrcodes) - 1);
+	s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
+	stbiw__putc(s, 1); // HTUDCinfo
+	s->func(s->context, (void*)(std_dc_chrominance_nrcodes + 1), sizeof(std_dc_chrominance_nrcodes) - 1);
+	s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+	stbiw__putc(s, 0x11); // HTUACinfo
+	s->func(s->context, (void*)(std_ac_chrominance_nrcodes + 1), sizeof(std_ac_chrominance_nrcodes) - 1);
+	s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+}
+
+// convert pixels [x, padded_width) of a row to the Y, Cb and Cr samples of a
+// strip, repeating the last pixel past 'width' so that the row fills whole
+// blocks; level shifted as the DCT expects
+static void stbiw__jpg_rgb_to_ycbcr_pixels(const unsigned char *row, int x, int width, int padded_width, int comp, float *Y, float *U, float *V) {
+	// comp == 2 is grey+alpha (alpha is ignored)
+	int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+	for (; x < padded_width; ++x) {
+		const unsigned char *p = row + (x < width ? x : width - 1) * comp;
+		float r = p[0], g = p[ofsG], b = p[ofsB];
+		Y[x] = +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+		U[x] = -0.16874f*r - 0.33126f*g + 0.50000f*b;
+		V[x] = +0.50000f*r - 0.41869f*g - 0.08131f*b;
+	}
+}
+
+// convert one row of 'width' pixels to the Y, Cb and Cr samples of a strip
+static void stbiw__jpg_rgb_to_ycbcr_row(const unsigned char *row, int width, int padded_width, int comp, float *Y, float *U, float *V) {
+	stbiw__jpg_rgb_to_ycbcr_pixels(row, 0, width, padded_width, comp, Y, U, V);
+}
+
+#ifdef STBIW_SSE2
+static void stbiw__jpg_rgb_to_ycbcr_row_sse2(const unsigned char *row, int width, int padded_width, int comp, float *Y, float *U, float *V) {
+	int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+	int x = 0;
+	// same operations in the same order as the scalar loop, so both give
+	// bit-identical samples
+	const __m128 yr = _mm_set1_ps(0.29900f), yg = _mm_set1_ps(0.58700f), yb = _mm_set1_ps(0.11400f);
+	const __m128 ur = _mm_set1_ps(-0.16874f), ug = _mm_set1_ps(0.33126f), ub = _mm_set1_ps(0.50000f);
+	const __m128 vr = _mm_set1_ps(0.50000f), vg = _mm_set1_ps(0.41869f), vb = _mm_set1_ps(0.08131f);
+	const __m128 level = _mm_set1_ps(128.0f);
+	for (; x + 4 <= width; x += 4) {
+		const unsigned char *p = row + x * comp;
+		__m128 r = _mm_cvtepi32_ps(_mm_setr_epi32(p[0], p[comp], p[2 * comp], p[3 * comp]));
+		__m128 g = _mm_cvtepi32_ps(_mm_setr_epi32(p[ofsG], p[comp + ofsG], p[2 * comp + ofsG], p[3 * comp + ofsG]));
+		__m128 b = _mm_cvtepi32_ps(_mm_setr_epi32(p[ofsB], p[comp + ofsB], p[2 * comp + ofsB], p[3 * comp + ofsB]));
+		__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(yr, r), _mm_mul_ps(yg, g)), _mm_mul_ps(yb, b));
+		__m128 u = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(ur, r), _mm_mul_ps(ug, g)), _mm_mul_ps(ub, b));
+		__m128 v = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(vr, r), _mm_mul_ps(vg, g)), _mm_mul_ps(vb, b));
+		_mm_storeu_ps(Y + x, _mm_sub_ps(y, level));
+		_mm_storeu_ps(U + x, u);
+		_mm_storeu_ps(V + x, v);
+	}
+	stbiw__jpg_rgb_to_ycbcr_pixels(row, x, width, padded_width, comp, Y, U, V);
+}
+#endif
+
+#ifdef STBIW_AVX2
+// 8 pixels at a time; the channels are picked out of the interleaved bytes
+// with shuffles rather than loaded one by one
+static STBIW__AVX2_TARGET void stbiw__jpg_rgb_to_ycbcr_row_avx2(const unsigned char *row, int width, int padded_width, int comp, float *Y, float *U, float *V) {
+	int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+	int x = 0;
+	const __m256 yr = _mm256_set1_ps(0.29900f), yg = _mm256_set1_ps(0.58700f), yb = _mm256_set1_ps(0.11400f);
+	const __m256 ur = _mm256_set1_ps(-0.16874f), ug = _mm256_set1_ps(0.33126f), ub = _mm256_set1_ps(0.50000f);
+	const __m256 vr = _mm256_set1_ps(0.50000f), vg = _mm256_set1_ps(0.41869f), vb = _mm256_set1_ps(0.08131f);
+	const __m256 level = _mm256_set1_ps(128.0f);
+	// each 128-bit half holds 4 pixels, and the shuffles move one channel
+	// of them into the low byte of each 32-bit lane, zeroing the rest
+	const __m256i pixels = _mm256_setr_epi32(0, comp, 2 * comp, 3 * comp, 0, comp, 2 * comp, 3 * comp);
+	const __m256i zeroes = _mm256_set1_epi32((int)0x80808000);
+	const __m256i r_mask = _mm256_or_si256(pixels, zeroes);
+	const __m256i g_mask = _mm256_or_si256(_mm256_add_epi32(pixels, _mm256_set1_epi32(ofsG)), zeroes);
+	const __m256i b_mask = _mm256_or_si256(_mm256_add_epi32(pixels, _mm256_set1_epi32(ofsB)), zeroes);
+	// the second half loads 16 bytes from pixel 4, which must not run past
+	// the end of the row
+	for (; x + 4 + (16 + comp - 1) / comp <= width; x += 8) {
+		const unsigned char *p = row + x * comp;
+		__m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+			_mm_loadu_si128((const __m128i *)(p + 4 * comp)), 1);
+		__m256 r = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(bytes, r_mask));
+		__m256 g = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(bytes, g_mask));
+		__m256 b = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(bytes, b_mask));
+		__m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(yr, r), _mm256_mul_ps(yg, g)), _mm256_mul_ps(yb, b));
+		__m256 u = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ur, r), _mm256_mul_ps(ug, g)), _mm256_mul_ps(ub, b));
+		__m256 v = _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(vr, r), _mm256_mul_ps(vg, g)), _mm256_mul_ps(vb, b));
+		_mm256_storeu_ps(Y + x, _mm256_sub_ps(y, level));
+		_mm256_storeu_ps(U + x, u);
+		_mm256_storeu_ps(V + x, v);
+	}
+	stbiw__jpg_rgb_to_ycbcr_pixels(row, x, width, padded_width, comp, Y, U, V);
+}
+#endif
+
+// the pixels and quantization of an image being encoded, and the kernels
+// chosen for the CPU by stbiw__jpg_setup_kernels
+typedef struct
+{
+	const unsigned char *data;
+	int width, height, comp, stride;
+	const float *fdtbl_Y, *fdtbl_UV;
+	// the MCU size: 8, or 16 with the chroma subsampled 4:2:0
+	int mcu_size;
+	// read the rows bottom up
+	int flip;
+	void(*quantize_kernel)(float *CDU, const float *fdtbl, int *DU);
+	void(*ycbcr_kernel)(const unsigned char *row, int width, int padded_width, int comp, float *Y, float *U, float *V);
+} stbiw__jpg_image;
+
+// pick the fastest kernels the CPU supports; they all give the same output
+static void stbiw__jpg_setup_kernels(stbiw__jpg_image *image) {
+	image->quantize_kernel = stbiw__jpg_quantizeDU;
+	image->ycbcr_kernel = stbiw__jpg_rgb_to_ycbcr_row;
+#ifdef STBIW_SSE2
+	image->quantize_kernel = stbiw__jpg_quantizeDU_sse2;
+	image->ycbcr_kernel = stbiw__jpg_rgb_to_ycbcr_row_sse2;
+#endif
+#ifdef STBIW_AVX2
+	if (stbiw__avx2_available()) {
+		image->quantize_kernel = stbiw__jpg_quantizeDU_avx2;
+		image->ycbcr_kernel = stbiw__jpg_rgb_to_ycbcr_row_avx2;
+	}
+#endif
+}
+
+// copy an 8x8 block out of a strip of samples
+static void stbiw__jpg_copyBlock(const float *strip, int stride, float *block) {
+	int row;
+	for (row = 0; row < 8; ++row) {
+		memcpy(block + row * 8, strip + row * stride, 8 * sizeof(float));
+	}
+}
+
+// average each 2x2 square of a 16x16 area of a strip of samples into an 8x8
+// block, for 4:2:0 chroma
+static void stbiw__jpg_downsampleBlock(const float *strip, int stride, float *block) {
+	int row, col;
+	for (row = 0; row < 8; ++row) {
+		const float *top = strip + 2 * row * stride, *bottom = top + stride;
+		for (col = 0; col < 8; ++col) {
+			block[row * 8 + col] = (top[2 * col] + top[2 * col + 1] + bottom[2 * col] + bottom[2 * col + 1]) * 0.25f;
+		}
+	}
+}
+
+// encode the MCU rows covering image rows [y_begin, y_end), converting them
+// to YCbCr one strip of MCU rows at a time; the DC predictions start from zero
+// and the last byte is padded with 1 bits, as a restart interval needs
+static int stbiw__jpg_encodeRows(stbi__write_context *s, const stbiw__jpg_image *image, int y_begin, int y_end) {
+	static const unsigned short fillBits[] = { 0x7F, 7 };
+	int width = image->width, height = image->height, mcu_size = image->mcu_size;
+	int DCY = 0, DCU = 0, DCV = 0;
+	int bitBuf = 0, bitCnt = 0;
+	int padded_width = (width + mcu_size - 1) & ~(mcu_size - 1);
+	int strip_size = mcu_size * padded_width;
+	float *strip = (float *)STBIW_MALLOC(sizeof(float) * 3 * strip_size);
+	float *stripY = strip, *stripU = strip + strip_size, *stripV = strip + 2 * strip_size;
+	int x, y, row, block;
+	if (!strip) {
+		return 0;
+	}
+	for (y = y_begin; y < y_end; y += mcu_size) {
+		for (row = 0; row < mcu_size; ++row) {
+			// rows past the bottom repeat the last row
+			int r = y + row < height ? y + row : height - 1;
+			if (image->flip) r = height - 1 - r;
+			image->ycbcr_kernel(image->data + (size_t)r * image->stride, width, padded_width, image->comp,
+				stripY + row * padded_width, stripU + row * padded_width, stripV + row * padded_width);
+		}
+		for (x = 0; x < width; x += mcu_size) {
+			float YDU[64], UDU[64], VDU[64];
+			int DU[64];
+
+			// the Y blocks of the MCU, left to right then top to bottom
+			for (block = 0; block < mcu_size * mcu_size / 64; ++block) {
+				int bx = x + (block & 1) * 8, by = (block >> 1) * 8;
+				stbiw__jpg_copyBlock(stripY + by * padded_width + bx, padded_width, YDU);
+				image->quantize_kernel(YDU, image->fdtbl_Y, DU);
+				DCY = stbiw__jpg_encodeDU(s, &bitBuf, &bitCnt, DU, DCY, YDC_HT, YAC_HT);
+			}
+			if (mcu_size == 16) {
+				stbiw__jpg_downsampleBlock(stripU + x, padded_width, UDU);
+				stbiw__jpg_downsampleBlock(stripV + x, padded_width, VDU);
+			}
+			else {
+				stbiw__jpg_copyBlock(stripU + x, padded_width, UDU);
+				stbiw__jpg_copyBlock(stripV + x, padded_width, VDU);
+			}
+
+			image->quantize_kernel(UDU, image->fdtbl_UV, DU);
+			DCU = stbiw__jpg_encodeDU(s, &bitBuf, &bitCnt, DU, DCU, UVDC_HT, UVAC_HT);
+			image->quantize_kernel(VDU, image->fdtbl_UV, DU);
+			DCV = stbiw__jpg_encodeDU(s, &bitBuf, &bitCnt, DU, DCV, UVDC_HT, UVAC_HT);
+		}
+	}
+	STBIW_FREE(strip);
+
+	// Do the bit alignment of the next marker
+	stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+	return 1;
+}
+
+// aim for restart intervals of about this many MCUs, enough work to be worth
+// a job of its own while still giving large images plenty of them
+#ifndef STBIW_JPG_SEGMENT_MCUS
+#define STBIW_JPG_SEGMENT_MCUS 1024
+#endif
+
+// the entropy-coded data of one restart interval, encoded into memory
+typedef struct
+{
+	unsigned char *data;
+	int size, capacity;
+	int ok;
+} stbiw__jpg_segment;
+
+typedef struct
+{
+	const stbiw__jpg_image *image;
+	stbiw__jpg_segment *segment;
+	int segment_rows;
+} stbiw__jpg_segments;
+
+static void stbiw__jpg_segment_write(void *context, void *data, int size) {
+	stbiw__jpg_segment *segment = (stbiw__jpg_segment *)context;
+	if (segment->size + size > segment->capacity) {
+		int capacity = segment->capacity ? segment->capacity * 2 : 4096;
+		unsigned char *grown;
+		while (capacity < segment->size + size) capacity *= 2;
+		grown = (unsigned char *)STBIW_REALLOC_SIZED(segment->data, segment->capacity, capacity);
+		if (!grown) {
+			segment->ok = 0;
+			return;
+		}
+		segment->data = grown;
+		segment->capacity = capacity;
+	}
+	memcpy(segment->data + segment->size, data, size);
+	segment->size += size;
+}
+
+static void stbiw__jpg_encodeSegment(void *job_context, int index) {
+	stbiw__jpg_segments *jobs = (stbiw__jpg_segments *)job_context;
+	stbiw__jpg_segment *segment = &jobs->segment[index];
+	int y_begin = index * jobs->segment_rows;
+	int y_end = y_begin + jobs->segment_rows;
+	stbi__write_context s;
+	stbi__start_write_callbacks(&s, stbiw__jpg_segment_write, segment);
+	if (y_end > jobs->image->height) y_end = jobs->image->height;
+	if (!stbiw__jpg_encodeRows(&s, jobs->image, y_begin, y_end)) {
+		segment->ok = 0;
+	}
+}
+
+// the quantization tables for a quality setting: the zigzag ordered tables
+// written to the file, and the reciprocals the quantize kernels multiply by,
+// which also undo the scaling of the AAN DCT
+static void stbiw__jpg_setupTables(int quality, unsigned char YTable[64], unsigned char UVTable[64], float fdtbl_Y[64], float fdtbl_UV[64]) {
 	static const int YQT[] = { 16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,18,22,
 		37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99 };
 	static const int UVQT[] = { 17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
@@ -1391,12 +2207,6 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 		1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
 	int row, col, i, k;
-	float fdtbl_Y[64], fdtbl_UV[64];
-	unsigned char YTable[64], UVTable[64];
-
-	if (!data || !width || !height || comp > 4 || comp < 1) {
-		return 0;
-	}
 
 	quality = quality ? quality : 90;
 	quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
@@ -1415,67 +2225,316 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 			fdtbl_UV[k] = 1 / (UVTable[stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
 		}
 	}
+}
+
+// set up a stream, cutting the image into bands of whole MCU rows that are
+// each one restart interval unless banded is 0, and write the headers
+static int stbiw__jpg_stream_begin(stbi_write_jpg_stream *stream, stbi_write_func *func, void *context, int width, int height, int comp,
+	int quality, int subsample, int banded) {
+	unsigned char YTable[64], UVTable[64];
+	int mcus_per_row;
+	stbi__write_context s;
+
+	if (!width || !height || comp > 4 || comp < 1) {
+		return 0;
+	}
+
+	stream->func = func;
+	stream->context = context;
+	stream->width = width;
+	stream->height = height;
+	stream->comp = comp;
+	stream->mcu_size = subsample ? 16 : 8;
+	stream->next_row = 0;
+	stream->flip = 0;
+
+	mcus_per_row = (width + stream->mcu_size - 1) / stream->mcu_size;
+	stream->band_rows = stream->mcu_size * ((STBIW_JPG_SEGMENT_MCUS + mcus_per_row - 1) / mcus_per_row);
+	if (!banded || stream->band_rows > height) {
+		stream->band_rows = height;
+	}
+	stream->bands = (height + stream->band_rows - 1) / stream->band_rows;
+
+	stbiw__jpg_setupTables(quality, YTable, UVTable, stream->fdtbl_Y, stream->fdtbl_UV);
+	stbi__start_write_callbacks(&s, func, context);
 
 	// Write Headers
 	{
 		static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
 		static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
+		// Y has 2x2 samples per MCU when the chroma is subsampled
 		const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height >> 8),STBIW_UCHAR(height),(unsigned char)(width >> 8),STBIW_UCHAR(width),
-			3,1,0x11,0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
+			3,1,(unsigned char)(subsample ? 0x22 : 0x11),0,2,0x11,1,3,0x11,1 };
+		s.func(s.context, (void*)head0, sizeof(head0));
+		s.func(s.context, (void*)YTable, sizeof(YTable));
+		stbiw__putc(&s, 1);
+		s.func(s.context, UVTable, sizeof(UVTable));
+		s.func(s.context, (void*)head1, sizeof(head1));
+		stbiw__jpg_writeHuffmanTables(&s);
+		if (stream->bands > 1) {
+			// DRI, in MCUs; a band is well below the 65535 limit
+			int interval = stream->band_rows / stream->mcu_size * mcus_per_row;
+			const unsigned char dri[] = { 0xFF,0xDD,0,4,(unsigned char)(interval >> 8),STBIW_UCHAR(interval) };
+			s.func(s.context, (void*)dri, sizeof(dri));
+		}
+		s.func(s.context, (void*)head2, sizeof(head2));
+	}
+	return 1;
+}
+
+STBIWDEF int stbi_write_jpg_stream_begin(stbi_write_jpg_stream *stream, stbi_write_func *func, void *context, int x, int y, int comp, int quality, int subsample)
+{
+	return stbiw__jpg_stream_begin(stream, func, context, x, y, comp, quality, subsample, 1);
+}
+
+// write the restart marker that follows band i, unless it is the last band
+static void stbiw__jpg_restart(stbi__write_context *s, const stbi_write_jpg_stream *stream, int i) {
+	if (i + 1 < stream->bands) {
+		stbiw__putc(s, 0xFF);
+		stbiw__putc(s, (unsigned char)(0xD0 + (i & 7)));
+	}
+}
+
+STBIWDEF int stbi_write_jpg_stream_rows(stbi_write_jpg_stream *stream, const void *data, int stride_in_bytes, int rows,
+	stbi_write_parallel_func *parallel, void *parallel_context)
+{
+	stbiw__jpg_image image;
+	stbi__write_context s;
+	int i, first, segments;
+
+	// only the bottom of the image may end part way through a band
+	if (!data || rows <= 0 || rows > stream->height - stream->next_row
+		|| (rows % stream->band_rows && stream->next_row + rows != stream->height)) {
+		return 0;
+	}
+	if (stride_in_bytes == 0)
+		stride_in_bytes = stream->width * stream->comp;
+	first = stream->next_row / stream->band_rows;
+	segments = (rows + stream->band_rows - 1) / stream->band_rows;
+	stream->next_row += rows;
+
+	// the rows past the bottom of a band are only read for the last band,
+	// where they repeat the last row of the image
+	image.data = (const unsigned char *)data;
+	image.width = stream->width;
+	image.height = rows;
+	image.comp = stream->comp;
+	image.stride = stride_in_bytes;
+	image.fdtbl_Y = stream->fdtbl_Y;
+	image.fdtbl_UV = stream->fdtbl_UV;
+	image.mcu_size = stream->mcu_size;
+	image.flip = stream->flip;
+	stbiw__jpg_setup_kernels(&image);
+	stbi__start_write_callbacks(&s, stream->func, stream->context);
+
+	// Encode 8x8 macroblocks
+	if (segments == 1 || !parallel) {
+		for (i = 0; i < segments; ++i) {
+			int y_begin = i * stream->band_rows;
+			int y_end = y_begin + stream->band_rows < rows ? y_begin + stream->band_rows : rows;
+			if (!stbiw__jpg_encodeRows(&s, &image, y_begin, y_end)) {
+				return 0;
+			}
+			stbiw__jpg_restart(&s, stream, first + i);
+		}
+	}
+	else {
+		stbiw__jpg_segment *segment = (stbiw__jpg_segment *)STBIW_MALLOC(sizeof(stbiw__jpg_segment) * segments);
+		int ok = segment != NULL;
+		if (ok) {
+			stbiw__jpg_segments jobs;
+			jobs.image = &image;
+			jobs.segment = segment;
+			jobs.segment_rows = stream->band_rows;
+			for (i = 0; i < segments; ++i) {
+				segment[i].data = NULL;
+				segment[i].size = segment[i].capacity = 0;
+				segment[i].ok = 1;
+			}
+			parallel(parallel_context, segments, stbiw__jpg_encodeSegment, &jobs);
+			// write the segments out in order, each followed by its restart marker
+			for (i = 0; i < segments; ++i) {
+				ok &= segment[i].ok;
+				if (ok) {
+					s.func(s.context, segment[i].data, segment[i].size);
+					stbiw__jpg_restart(&s, stream, first + i);
+				}
+				STBIW_FREE(segment[i].data);
+			}
+			STBIW_FREE(segment);
+		}
+		if (!ok) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+STBIWDEF int stbi_write_jpg_stream_end(stbi_write_jpg_stream *stream)
+{
+	stbi__write_context s;
+	if (stream->next_row != stream->height) {
+		return 0;
+	}
+	// EOI
+	stbi__start_write_callbacks(&s, stream->func, stream->context);
+	stbiw__putc(&s, 0xFF);
+	stbiw__putc(&s, 0xD9);
+	return 1;
+}
+
+// a stream given every row at once: one band, or with parallel one band per
+// restart interval
+static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int stride, int quality,
+	int subsample, stbi_write_parallel_func *parallel, void *parallel_context) {
+	stbi_write_jpg_stream stream;
+	if (!data || !stbiw__jpg_stream_begin(&stream, s->func, s->context, width, height, comp, quality, subsample, parallel != NULL)) {
+		return 0;
+	}
+	if (stride == 0)
+		stride = width * comp;
+	stream.flip = stbi__flip_vertically_on_write;
+	return stbi_write_jpg_stream_rows(&stream, data, stride, height, parallel, parallel_context) && stbi_write_jpg_stream_end(&stream);
+}
+
+STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
+{
+	return stbi_write_jpg_stride_to_func(func, context, x, y, comp, data, x * comp, quality);
+}
+
+STBIWDEF int stbi_write_jpg_stride_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_in_bytes, int quality)
+{
+	return stbi_write_jpg_parallel_to_func(func, context, x, y, comp, data, stride_in_bytes, quality, 0, NULL, NULL);
+}
+
+STBIWDEF int stbi_write_jpg_parallel_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_in_bytes, int quality,
+	int subsample, stbi_write_parallel_func *parallel, void *parallel_context)
+{
+	stbi__write_context s;
+	stbi__start_write_callbacks(&s, func, context);
+	return stbi_write_jpg_core(&s, x, y, comp, (void *)data, stride_in_bytes, quality, subsample, parallel, parallel_context);
+}
+
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const void *data, int quality)
+{
+	return stbi_write_jpg_stride(filename, x, y, comp, data, x * comp, quality);
+}
+
+STBIWDEF int stbi_write_jpg_stride(char const *filename, int x, int y, int comp, const void *data, int stride_in_bytes, int quality)
+{
+	return stbi_write_jpg_parallel(filename, x, y, comp, data, stride_in_bytes, quality, 0, NULL, NULL);
+}
+
+STBIWDEF int stbi_write_jpg_parallel(char const *filename, int x, int y, int comp, const void *data, int stride_in_bytes, int quality,
+	int subsample, stbi_write_parallel_func *parallel, void *parallel_context)
+{
+	stbi__write_context s;
+	if (stbi__start_write_file(&s, filename)) {
+		int r = stbi_write_jpg_core(&s, x, y, comp, data, stride_in_bytes, quality, subsample, parallel, parallel_context);
+		stbi__end_write_file(&s);
+		return r;
+	}
+	else
+		return 0;
+}
+#endif
+
+static int stbi_write_jpg_coefficients_core(stbi__write_context *s, int width, int height, int comp, const stbi_write_jpg_component *components) {
+	int table[3], hs[3], vs[3];
+	int i, k, hmax = 1, vmax = 1, precise = 0;
+	int mcu_x, mcu_y, x, y;
+
+	if (!components || !width || !height || (comp != 1 && comp != 3)) {
+		return 0;
+	}
+
+	// a single component is not interleaved, so its MCU is one block
+	for (i = 0; i < comp; ++i) {
+		hs[i] = comp == 1 ? 1 : components[i].h;
+		vs[i] = comp == 1 ? 1 : components[i].v;
+		if (hs[i] < 1 || hs[i] > 4 || vs[i] < 1 || vs[i] > 4) {
+			return 0;
+		}
+		hmax = hs[i] > hmax ? hs[i] : hmax;
+		vmax = vs[i] > vmax ? vs[i] : vmax;
+		for (k = 0; k < 64; ++k) {
+			precise |= components[i].quant[k] > 255;
+		}
+	}
+	mcu_x = (width + hmax * 8 - 1) / (hmax * 8);
+	mcu_y = (height + vmax * 8 - 1) / (vmax * 8);
+
+	// Write Headers, sharing quantization tables between components where they match
+	{
+		static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0 };
+		const unsigned char head1[] = { 0xFF,(unsigned char)(precise ? 0xC1 : 0xC0),0,(unsigned char)(8 + 3 * comp),8,(unsigned char)(height >> 8),STBIW_UCHAR(height),
+			(unsigned char)(width >> 8),STBIW_UCHAR(width),(unsigned char)comp };
+		const unsigned char head2[] = { 0xFF,0xDA,0,(unsigned char)(6 + 2 * comp),(unsigned char)comp };
 		s->func(s->context, (void*)head0, sizeof(head0));
-		s->func(s->context, (void*)YTable, sizeof(YTable));
-		stbiw__putc(s, 1);
-		s->func(s->context, UVTable, sizeof(UVTable));
+		for (i = 0; i < comp; ++i) {
+			for (table[i] = 0; table[i] < i; ++table[i]) {
+				if (memcmp(components[table[i]].quant, components[i].quant, 64 * sizeof(unsigned short)) == 0) {
+					break;
+				}
+			}
+			if (table[i] == i) {
+				unsigned short zigzagged[64];
+				const unsigned char dqt[] = { 0xFF,0xDB,0,(unsigned char)(precise ? 131 : 67),(unsigned char)((precise << 4) | i) };
+				for (k = 0; k < 64; ++k) {
+					zigzagged[stbiw__jpg_ZigZag[k]] = components[i].quant[k];
+				}
+				s->func(s->context, (void*)dqt, sizeof(dqt));
+				for (k = 0; k < 64; ++k) {
+					if (precise) {
+						stbiw__putc(s, (unsigned char)(zigzagged[k] >> 8));
+					}
+					stbiw__putc(s, STBIW_UCHAR(zigzagged[k]));
+				}
+			}
+		}
 		s->func(s->context, (void*)head1, sizeof(head1));
-		s->func(s->context, (void*)(std_dc_luminance_nrcodes + 1), sizeof(std_dc_luminance_nrcodes) - 1);
-		s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
-		stbiw__putc(s, 0x10); // HTYACinfo
-		s->func(s->context, (void*)(std_ac_luminance_nrcodes + 1), sizeof(std_ac_luminance_nrcodes) - 1);
-		s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
-		stbiw__putc(s, 1); // HTUDCinfo
-		s->func(s->context, (void*)(std_dc_chrominance_nrcodes + 1), sizeof(std_dc_chrominance_nrcodes) - 1);
-		s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
-		stbiw__putc(s, 0x11); // HTUACinfo
-		s->func(s->context, (void*)(std_ac_chrominance_nrcodes + 1), sizeof(std_ac_chrominance_nrcodes) - 1);
-		s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+		for (i = 0; i < comp; ++i) {
+			stbiw__putc(s, STBIW_UCHAR(components[i].id));
+			stbiw__putc(s, (unsigned char)((hs[i] << 4) | vs[i]));
+			stbiw__putc(s, (unsigned char)table[i]);
+		}
+		stbiw__jpg_writeHuffmanTables(s);
 		s->func(s->context, (void*)head2, sizeof(head2));
+		for (i = 0; i < comp; ++i) {
+			stbiw__putc(s, STBIW_UCHAR(components[i].id));
+			stbiw__putc(s, (unsigned char)(i == 0 ? 0x00 : 0x11));
+		}
+		stbiw__putc(s, 0);
+		stbiw__putc(s, 0x3F);
+		stbiw__putc(s, 0);
 	}
 
-	// Encode 8x8 macroblocks
+	// Encode the blocks MCU by MCU
 	{
 		static const unsigned short fillBits[] = { 0x7F, 7 };
-		const unsigned char *imageData = (const unsigned char *)data;
-		int DCY = 0, DCU = 0, DCV = 0;
+		int DC[3] = { 0, 0, 0 };
 		int bitBuf = 0, bitCnt = 0;
-		// comp == 2 is grey+alpha (alpha is ignored)
-		int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
-		int x, y, pos;
-		for (y = 0; y < height; y += 8) {
-			for (x = 0; x < width; x += 8) {
-				float YDU[64], UDU[64], VDU[64];
-				for (row = y, pos = 0; row < y + 8; ++row) {
-					for (col = x; col < x + 8; ++col, ++pos) {
-						int p = (stbi__flip_vertically_on_write ? height - 1 - row : row)*width*comp + col * comp;
-						float r, g, b;
-						if (row >= height) {
-							p -= width * comp*(row + 1 - height);
-						}
-						if (col >= width) {
-							p -= comp * (col + 1 - width);
+		if (comp == 1) {
+			mcu_x = (width + 7) / 8;
+			mcu_y = (height + 7) / 8;
+		}
+		for (y = 0; y < mcu_y; ++y) {
+			for (x = 0; x < mcu_x; ++x) {
+				for (i = 0; i < comp; ++i) {
+					int bx, by;
+					for (by = y * vs[i]; by < (y + 1) * vs[i]; ++by) {
+						for (bx = x * hs[i]; bx < (x + 1) * hs[i]; ++bx) {
+							const short *block = components[i].coeff + 64 * ((size_t)by * components[i].coeff_stride + bx);
+							int DU[64];
+							for (k = 0; k < 64; ++k) {
+								DU[stbiw__jpg_ZigZag[k]] = block[k];
+							}
+							DC[i] = stbiw__jpg_encodeDU(s, &bitBuf, &bitCnt, DU, DC[i], i == 0 ? YDC_HT : UVDC_HT, i == 0 ? YAC_HT : UVAC_HT);
 						}
-
-						r = imageData[p + 0];
-						g = imageData[p + ofsG];
-						b = imageData[p + ofsB];
-						YDU[pos] = +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-						UDU[pos] = -0.16874f*r - 0.33126f*g + 0.50000f*b;
-						VDU[pos] = +0.50000f*r - 0.41869f*g - 0.08131f*b;
 					}
 				}
-
-				DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, YDU, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-				DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, UDU, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-				DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, VDU, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
 			}
 		}
 
@@ -1490,20 +2549,19 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 	return 1;
 }
 
-STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
+STBIWDEF int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const stbi_write_jpg_component *components)
 {
 	stbi__write_context s;
 	stbi__start_write_callbacks(&s, func, context);
-	return stbi_write_jpg_core(&s, x, y, comp, (void *)data, quality);
+	return stbi_write_jpg_coefficients_core(&s, x, y, comp, components);
 }
 
-
 #ifndef STBI_WRITE_NO_STDIO
-STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const void *data, int quality)
+STBIWDEF int stbi_write_jpg_coefficients(char const *filename, int x, int y, int comp, const stbi_write_jpg_component *components)
 {
 	stbi__write_context s;
 	if (stbi__start_write_file(&s, filename)) {
-		int r = stbi_write_jpg_core(&s, x, y, comp, data, quality);
+		int r = stbi_write_jpg_coefficients_core(&s, x, y, comp, components);
 		stbi__end_write_file(&s);
 		return r;
 	}